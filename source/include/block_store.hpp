@@ -0,0 +1,115 @@
+#ifndef BLOCK_STORE_HPP
+#define BLOCK_STORE_HPP
+
+#include "odf_types.hpp"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Owns the open .omni container. When the container fits in the configured
+// address-space budget it is mapped once with mmap and every access is a
+// memcpy into the mapping; larger containers fall back to pread/pwrite.
+// Nothing written is durable until flush() returns.
+//
+// Block numbers are the ones handed out by FreeBitmap; block 0 is the first
+// block of the data region that fs_format lays out after the user table.
+//
+// With checksums enabled every data block has a CRC32C in a table in front
+// of the data region. Writes update it; reads check a block the first time
+// it is read after being loaded or rewritten and fail with ERROR_IO_ERROR
+// on a mismatch. A block that passed is not checked again until it is
+// rewritten, which keeps verification off the hot read path; scrubBlock()
+// re-checks one regardless.
+class BlockStore
+{
+public:
+    BlockStore();
+    ~BlockStore();
+
+    OFSErrorCodes open(const string& path, uint64_t mmap_budget);
+    // max_blocks reserves the mapping for a data region that may later
+    // grow() to that many blocks, so block pointers never move.
+    OFSErrorCodes setLayout(uint64_t data_offset, uint32_t block_size, unsigned int total_blocks,
+                            unsigned int max_blocks = 0);
+
+    // Extends the container (preallocated with fallocate) and the checksum
+    // table so the data region holds total_blocks blocks.
+    OFSErrorCodes grow(unsigned int total_blocks);
+    void close();
+    bool isOpen() const;
+    bool isMapped() const;
+
+    uint32_t blockSize() const;
+    unsigned int totalBlocks() const;
+
+    // Raw container access by byte offset (header, user table, ...).
+    OFSErrorCodes readAt(uint64_t offset, void* out, size_t size) const;
+    OFSErrorCodes writeAt(uint64_t offset, const void* data, size_t size);
+    char* mappedAt(uint64_t offset) const;
+
+    // Pointer to a data block inside the mapping, or nullptr in pread mode.
+    const char* blockData(unsigned int block) const;
+
+    OFSErrorCodes readBlock(unsigned int block, char* out) const;
+    OFSErrorCodes writeBlock(unsigned int block, const char* data, size_t len);
+
+    // Byte range helpers working on a file's extent list. Each extent the
+    // range crosses is one contiguous read or write. Writes never touch
+    // bytes outside [offset, offset + size) of the mapped range.
+    OFSErrorCodes readRange(const vector<Extent>& extents, uint64_t offset, char* out, size_t size) const;
+    OFSErrorCodes writeRange(const vector<Extent>& extents, uint64_t offset, const char* data, size_t size);
+    OFSErrorCodes zeroRange(const vector<Extent>& extents, uint64_t offset, size_t size);
+
+    // Loads the checksum table stored at table_offset (4 bytes per block).
+    OFSErrorCodes enableChecksums(uint64_t table_offset);
+    bool checksumsEnabled() const;
+
+    // Checks a block before its bytes are used through blockData(). True if
+    // it matches its checksum (or checksums are off).
+    bool verifyBlock(unsigned int block) const;
+    bool verifyRange(const vector<Extent>& extents, uint64_t offset, size_t size) const;
+
+    // Re-reads a block and checks it even if it passed before.
+    bool scrubBlock(unsigned int block);
+
+    // Blocks found corrupt and not rewritten since.
+    uint64_t corruptBlocks() const;
+
+    // Flush points: msync the mapping (or fdatasync the descriptor).
+    OFSErrorCodes flush();
+    OFSErrorCodes flushRange(uint64_t offset, size_t size);
+
+private:
+    int fd_;
+    char* map_;
+    uint64_t map_size_;
+    uint64_t file_size_;
+    uint64_t mmap_budget_;
+    uint64_t map_reserve_;      // Bytes to map even if the file is shorter
+    uint64_t data_offset_;
+    uint32_t block_size_;
+    unsigned int total_blocks_;
+
+    uint64_t sums_offset_;
+    vector<uint32_t> sums_;
+    mutable vector<uint8_t> checked_;   // BLOCK_UNCHECKED / BLOCK_OK / BLOCK_BAD
+    mutable uint64_t corrupt_;
+
+    uint64_t blockOffset(unsigned int block) const;
+
+    uint32_t blockSum(unsigned int block, vector<char>& scratch) const;
+    void setChecked(unsigned int block, uint8_t state) const;
+    // Checks / re-sums every block overlapping container bytes [phys, phys + size).
+    bool verifySpan(uint64_t phys, size_t size) const;
+    OFSErrorCodes readVerified(uint64_t phys, char* out, size_t size) const;
+    OFSErrorCodes updateSums(uint64_t phys, size_t size, const char* data);
+
+    // Container offset of logical byte `pos` of a file and how many bytes
+    // from there stay inside the same extent. False if pos is past the end.
+    bool locate(const vector<Extent>& extents, uint64_t pos, uint64_t& phys, uint64_t& run) const;
+    OFSErrorCodes mapContainer();
+    void unmapContainer();
+};
+
+#endif
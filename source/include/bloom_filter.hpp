@@ -0,0 +1,38 @@
+#ifndef BLOOM_FILTER_HPP
+#define BLOOM_FILTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Counting Bloom filter over 32-bit key hashes, so keys can be removed as
+// well as added. Counters are 4 bits wide, and the four a key uses all lie
+// in the same 64-byte block, so a query touches one cache line. A counter
+// that reaches 15 stays there: it may have lost count, so removals no
+// longer lower it. mayContain() never says no for a key that was added and
+// not removed.
+class BloomFilter
+{
+public:
+    BloomFilter();
+
+    // Empties the filter and sizes it for about `keys` keys.
+    void reset(size_t keys);
+
+    void add(uint32_t hash);
+    void remove(uint32_t hash);
+    bool mayContain(uint32_t hash) const;
+
+    size_t memoryUsage() const;
+
+private:
+    vector<uint64_t> words_;
+    size_t block_mask_;
+
+    // Word index and nibble shift of the i-th counter of a key.
+    void counter(uint64_t mixed, int i, size_t& word, unsigned& shift) const;
+};
+
+#endif
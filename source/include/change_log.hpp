@@ -0,0 +1,108 @@
+#ifndef CHANGE_LOG_HPP
+#define CHANGE_LOG_HPP
+
+#include "odf_types.hpp"
+#include "block_store.hpp"
+#include <string>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+enum class LogOp : uint32_t
+{
+    FILE_CREATE = 1,
+    FILE_EDIT = 2,
+    FILE_DELETE = 3,
+    FILE_TRUNCATE = 4,
+    FILE_RENAME = 5,
+    SET_PERMISSIONS = 6,
+    DIR_CREATE = 7,
+    DIR_DELETE = 8,
+    USER_CREATE = 9,
+    USER_DELETE = 10,
+    FILE_ROLLBACK = 11,
+    SET_COMPRESSION = 12,
+    DIR_RENAME = 13,
+    DIR_DELETE_RECURSIVE = 14,
+    TREE_COPY = 15
+};
+
+// One logical redo record. The payload always starts with the acting user
+// and role so replay can rebuild an equivalent session.
+class LogRecord
+{
+public:
+    LogRecord(LogOp op, const SessionInfo* actor);
+    LogRecord(LogOp op, uint64_t time, string payload);
+
+    void putU32(uint32_t v);
+    void putU64(uint64_t v);
+    void putString(const string& s);
+    void putBytes(const char* data, size_t size);
+
+    bool getU32(uint32_t& v);
+    bool getU64(uint64_t& v);
+    bool getString(string& s);
+
+    LogOp op() const { return op_; }
+    uint64_t time() const { return time_; }
+    const string& payload() const { return payload_; }
+
+private:
+    LogOp op_;
+    uint64_t time_;
+    string payload_;
+    size_t pos_;
+};
+
+// Write-ahead change log kept in the region at OMNIHeader::change_log_offset.
+// append() copies a record into the region; commit() waits until it is
+// durable. Concurrent committers are batched: the first one waits for the
+// commit window if others are committing too, then a single flush covers
+// every record appended so far.
+class ChangeLog
+{
+public:
+    ChangeLog();
+
+    OFSErrorCodes open(BlockStore* store, uint64_t offset, uint64_t size, uint32_t commit_window_us);
+    bool isOpen() const;
+
+    // Returns the record's LSN, or 0 when the region has no room left.
+    uint64_t append(const LogRecord& rec);
+    OFSErrorCodes commit(uint64_t lsn);
+
+    // Calls fn for every valid record of the current epoch newer than
+    // after_lsn, in LSN order.
+    size_t replay(const function<void(LogRecord&)>& fn, uint64_t after_lsn = 0);
+
+    // Discards all records (used once their effects are checkpointed).
+    OFSErrorCodes reset();
+
+    uint64_t usedBytes() const;
+    uint64_t capacity() const;
+    uint64_t lastLsn() const;
+
+private:
+    BlockStore* store_;
+    uint64_t offset_;
+    uint64_t size_;
+    uint32_t window_us_;
+
+    uint32_t epoch_;
+    uint64_t next_lsn_;
+    uint64_t tail_;
+    uint64_t synced_tail_;
+    uint64_t durable_lsn_;
+    bool flushing_;
+    uint32_t committers_;       // Threads inside commit()
+
+    mutable mutex mu_;
+    condition_variable cv_;
+
+    OFSErrorCodes writeRegionHeader();
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "odf_types.hpp"
+#include <vector>
+
+using namespace std;
+
+struct FileSystemInstance;
+
+// A checkpoint is a compact image of the inode table and directory entries
+// written into data blocks as a chain: the first 4 bytes of every block hold
+// the next block number + 1 (0 ends the chain). OMNILayout in the header
+// points at the head of the newest complete chain and records the last
+// change log LSN it covers, so fs_init loads it and replays only the tail.
+
+// Writes a new checkpoint of fs, switches the header to it, frees the
+// previous chain and empties the change log.
+int checkpoint_write(FileSystemInstance* fs);
+
+// Blocks that writes to compressed files and the defragmenter replace, and
+// those checkpoint_release() defers, stay allocated in fs->deferred_free
+// until the next checkpoint, since the one on disk may still reference them. Writes a checkpoint when there are any,
+// so they can be allocated again. False if nothing was reclaimed, and
+// always during log replay or without a change log. Only call it between
+// mutations: the checkpoint captures the in-memory state as it is.
+bool checkpoint_reclaim(FileSystemInstance* fs);
+
+// Frees the extents a file lets go of. A block losing its last reference
+// that was shared at any point since the last checkpoint goes to
+// fs->deferred_free instead: replaying a logged write that unshared it
+// copies it again, so it must still hold the data the checkpoint saw.
+void checkpoint_release(FileSystemInstance* fs, const vector<Extent>& extents);
+
+// Loads the checkpoint named by the header into fs->inodes, rebuilds
+// fs->tree and fs->meta from it and marks every referenced block as used. *lsn receives the last LSN it covers.
+int checkpoint_load(FileSystemInstance* fs, uint64_t* lsn);
+
+// Checkpoints g_fs.
+int fs_checkpoint();
+
+#endif
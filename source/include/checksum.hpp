@@ -0,0 +1,20 @@
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// 32-bit FNV-1a. Pass the previous result as seed to checksum data in pieces.
+uint32_t fnv1a32(const void* data, size_t size, uint32_t seed = 2166136261u);
+
+// CRC32C (Castagnoli), used for block checksums. Runs on the SSE4.2 crc32
+// instruction when the CPU has it and on slice-by-8 tables otherwise; both
+// give the same result. Pass the previous result as seed to continue it.
+uint32_t crc32c(const void* data, size_t size, uint32_t seed = 0);
+uint32_t crc32c_slice8(const void* data, size_t size, uint32_t seed = 0);
+bool crc32c_hardware();
+
+// 64-bit XXH64, used to fingerprint data blocks for deduplication.
+uint64_t xxhash64(const void* data, size_t size, uint64_t seed = 0);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef COMPRESS_HPP
+#define COMPRESS_HPP
+
+#include "odf_types.hpp"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct FileSystemInstance;
+
+// Inode::compression values. A file is either stored plain or LZ
+// compressed. On a directory the value is the policy for files created
+// below it: COMPRESS_NONE defers to the parent directory (and finally to the
+// policy of "/", then the `compression` config key), COMPRESS_OFF stops
+// compression from being inherited.
+static const uint32_t COMPRESS_NONE = 0;
+static const uint32_t COMPRESS_LZ = 1;
+static const uint32_t COMPRESS_OFF = 2;
+
+// Blocks of file content compressed together as one unit.
+static const uint32_t COMPRESS_UNIT_BLOCKS = 16;
+
+// LZ77 codec in the LZ4 block format: sequences of literals followed by a
+// match of at least 4 bytes no more than 64 KB back. lz_compress returns the
+// compressed size, or 0 when the result would not fit in capacity.
+// lz_decompress checks every length and offset, so a damaged input fails
+// instead of writing outside dst.
+size_t lz_compress(const char* src, size_t size, char* dst, size_t capacity);
+bool lz_decompress(const char* src, size_t size, char* dst, size_t raw_size);
+
+// A compressed file is a row of units of COMPRESS_UNIT_BLOCKS blocks of
+// content. Each unit is compressed on its own and stored in as few whole
+// blocks as it needs, right after the unit before it; its chunks hold the
+// stored length of every unit, 0 for a unit kept raw because compressing it
+// would not save a block. Reading a range only decodes the units it touches.
+
+// Compression for the new file fs->inodes[slot]: the policy of its nearest
+// directory that has one, else the configured default.
+uint32_t compress_policy(FileSystemInstance* fs, uint32_t slot);
+
+// Reads [offset, offset + length) of the content of fs->inodes[slot] into
+// dst, decompressing if the file is compressed.
+int content_read(FileSystemInstance* fs, uint32_t slot, uint64_t offset, uint64_t length, char* dst);
+
+// The units of a compressed file re-encoded for one write.
+struct CompressedTail
+{
+    uint64_t first_block;       // File block the re-encoded units start at
+    uint64_t tail_block;        // File block the units behind them start at
+    string bytes;               // Their stored form, each padded to whole blocks
+    vector<uint32_t> chunks;    // Stored lengths of all units after the write
+};
+
+// Encodes the result of writing `length` bytes of data at `offset` into
+// fs->inodes[slot], whose first `old_size` bytes are kept (0 replaces the
+// whole content).
+// Only the units the write touches come back in out. The units before and
+// behind them keep their stored form and their blocks; the ones behind
+// start at old file block out.tail_block.
+int compress_encode(FileSystemInstance* fs, uint32_t slot, uint64_t old_size,
+                    uint64_t offset, const char* data, uint64_t length, CompressedTail& out);
+
+// Adds the space compression saves to logical_bytes and refreshes
+// compressed_files in fs->stats from the counters frag_account keeps. Call
+// after dedup_refresh.
+void compress_refresh(FileSystemInstance* fs);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef DEDUP_HPP
+#define DEDUP_HPP
+
+#include "odf_types.hpp"
+#include <unordered_map>
+
+using namespace std;
+
+struct FileSystemInstance;
+
+// Fingerprint index of data blocks stored with dedup on: XXH64 of a block's
+// content -> block number. Entries are only hints. A hit is used after a
+// byte-for-byte compare, so an entry left behind by a block that was later
+// freed or reused cannot cause wrong sharing.
+class DedupIndex
+{
+public:
+    bool find(uint64_t hash, unsigned int& block) const;
+    void insert(uint64_t hash, unsigned int block);
+    void erase(unsigned int block);
+    void clear();
+    bool empty() const;
+    const unordered_map<uint64_t, unsigned int>& entries() const;
+
+private:
+    unordered_map<uint64_t, unsigned int> by_hash_;
+    unordered_map<unsigned int, uint64_t> by_block_;
+};
+
+// Stores the content of the new file fs->inodes[slot] block by block, referencing an existing
+// identical block instead of writing a copy wherever one is found.
+int dedup_store(FileSystemInstance* fs, uint32_t slot, const char* data, size_t size);
+
+// Makes the blocks of fs->inodes[slot] covering [offset, offset + length) private before
+// they are written: shared blocks are copied (copy-on-write) and private
+// ones leave the fingerprint index.
+int dedup_unshare(FileSystemInstance* fs, uint32_t slot, uint64_t offset, uint64_t length);
+
+// Refreshes logical_bytes and physical_bytes in fs->stats.
+void dedup_refresh(FileSystemInstance* fs);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef DEFRAG_HPP
+#define DEFRAG_HPP
+
+#include "odf_types.hpp"
+
+struct FileSystemInstance;
+
+// Fragmentation is the share of block boundaries that are breaks, either
+// between two extents of one file or between two runs of free space. 0%
+// means every file is a single extent and free space is one run; 100% means
+// no two neighbouring blocks belong together. The counters behind it change
+// together with the extent lists, so reading it is O(1).
+
+// Adds (sign > 0) or removes (sign < 0) the extents of fs->inodes[slot]
+// from the counters, along with what its compression saves. Callers bracket
+// every change to a stored file's extents, blocks, size or compression with
+// a -1 and a +1.
+void frag_account(FileSystemInstance* fs, uint32_t slot, int sign);
+
+// Refreshes fragmentation, file_extents and free_extents in fs->stats.
+void frag_refresh(FileSystemInstance* fs);
+
+// Moves at most max_blocks blocks to reduce the extent count of one file:
+// a small file is copied whole into a single free run, a larger one has the
+// head of an extent pulled in behind the extent before it. The blocks left
+// behind are only released by the next checkpoint, since the checkpoint on
+// disk may still point at them. Returns the number of blocks moved.
+unsigned int defrag_step(FileSystemInstance* fs, unsigned int max_blocks);
+
+// One defrag_step on g_fs, throttled by defrag_interval_ms and skipped
+// below defrag_min_percent. Called by the server's background thread under
+// an FSLock.
+int fs_defrag_step();
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef DELTA_VAULT_HPP
+#define DELTA_VAULT_HPP
+
+#include "odf_types.hpp"
+#include "block_store.hpp"
+#include "change_log.hpp"
+#include <string>
+
+using namespace std;
+
+struct FileSystemInstance;
+
+// Ring of version records in the region at OMNIHeader::file_state_storage_offset.
+// Positions are logical byte offsets that only grow; the record at pos lives
+// at pos % capacity. Appending past the end overwrites the oldest records,
+// which from then on count as expired. head/tail are saved with each
+// checkpoint. Records appended after it are synced before the change log
+// record of their operation, which names them, so replay takes them back
+// instead of writing them again.
+class DeltaVault
+{
+public:
+    DeltaVault();
+
+    void open(BlockStore* store, uint64_t offset, uint64_t size, uint64_t head, uint64_t tail);
+    bool isOpen() const;
+
+    // Stores one record and returns its position in pos. Fails only when
+    // the record is larger than the whole region.
+    OFSErrorCodes append(uint32_t inode, uint32_t version, bool keyframe, const string& payload, uint64_t& pos);
+
+    // Reads a record back and checks that it is still the one written.
+    OFSErrorCodes read(const FileVersion& v, uint32_t inode, string& payload) const;
+
+    // Makes the records appended since the last sync durable.
+    OFSErrorCodes sync();
+    // Moves the tail past a record a replayed operation had appended.
+    bool adopt(uint64_t pos, uint32_t length);
+
+    bool expired(uint64_t pos) const;
+    uint64_t head() const;
+    uint64_t tail() const;
+    uint64_t capacity() const;
+
+private:
+    BlockStore* store_;
+    uint64_t offset_;
+    uint64_t size_;
+    uint64_t head_;
+    uint64_t tail_;
+    uint64_t synced_;
+};
+
+// A file's current content is always the newest version, so reading it
+// costs nothing extra. Each older version is one vault record: either a
+// reverse delta holding just the bytes the next write replaced, or a full
+// keyframe every vault_keyframe_interval versions (and whenever the whole
+// content is replaced). Rebuilding version N starts at the nearest newer
+// keyframe, or at the current content, and applies at most one interval of
+// reverse deltas.
+
+// vault_pos of a FileVersion no record was stored for.
+static const uint64_t VAULT_NONE = UINT64_MAX;
+
+// Records the current version of fs->inodes[slot] before
+// [offset, offset + length) is overwritten, then makes `author` the writer
+// of the next version. Pass length = UINT64_MAX when the whole content is
+// about to be replaced. The record stored is returned in saved, for the
+// caller to log with vault_log(). While the log is replayed the content is
+// already overwritten, so the record named by fs->replay_saved is taken
+// back instead.
+void vault_save(FileSystemInstance* fs, uint32_t slot, uint64_t offset, uint64_t length, const char* author,
+                FileVersion& saved);
+
+// Appends saved to, or reads it back from, the operation's log record.
+void vault_log(LogRecord& rec, const FileVersion& saved);
+bool vault_unlog(LogRecord& rec, FileVersion& saved);
+
+// Rebuilds version `version` of fs->inodes[slot] into out.
+int vault_read(FileSystemInstance* fs, uint32_t slot, uint32_t version, string& out);
+
+#endif
@@ -2,39 +2,94 @@
 #define DIR_TREE_HPP
 
 #include "odf_types.hpp"
+#include "inode_table.hpp"
+#include "path_index.hpp"
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
 
 using namespace std;
 
-class DirTree 
+// The namespace over an InodeTable. Every inode records its parent
+// directory and its name; each directory chains its children through the
+// inodes themselves, and a PathIndex finds a child by (directory, name).
+// Resolving a path costs one hash lookup per component, and listing a
+// directory only touches its own children. An entry can only be created
+// inside an existing directory, and a directory can only be unlinked once
+// it is empty. Every call takes the table the slots refer to.
+class DirTree
 {
-private:
-    struct Node 
-    {
-        FileEntry entry;
-        Node* parent;
-        vector<Node*> children;
-        Node(const FileEntry& e) : entry(e), parent(nullptr) {}
-    };
-
-    Node* root_;
-
-    Node* findNode(const string& path) const;
-    Node* createPathNodes(const vector<string>& components, bool createLast, const FileEntry* entry);
-    static vector<string> splitPath(const string& path);
-    void deleteSubtree(Node* node);
 public:
     DirTree();
     ~DirTree();
 
-    OFSErrorCodes createEntry(const string& path, const FileEntry& entry);
-    OFSErrorCodes removeEntry(const string& path);
-    FileEntry* findEntry(const string& path) const;
-    OFSErrorCodes listDirectory(const string& dirpath, vector<FileEntry>& out) const;
-    void printTree() const;
+    // Slot of the entry at path, or NO_INODE. The root is not an entry.
+    uint32_t lookup(const InodeTable& inodes, const char* path) const;
+
+    // SUCCESS if path is well formed (absolute, no empty components, names
+    // under 256 bytes, shorter than FileMetadata::path), does not exist yet
+    // and its parent is an existing directory; otherwise the error creating
+    // it would return.
+    OFSErrorCodes canCreate(const InodeTable& inodes, const char* path) const;
+
+    // Names inodes[slot] after path and links it into its directory.
+    OFSErrorCodes link(InodeTable& inodes, uint32_t slot, const char* path);
+    OFSErrorCodes unlink(InodeTable& inodes, uint32_t slot);
+
+    // Moves inodes[slot], and everything below it, to path.
+    OFSErrorCodes move(InodeTable& inodes, uint32_t slot, const char* path);
+
+    // Slots of the direct children of dirpath, in creation order.
+    OFSErrorCodes listDirectory(const InodeTable& inodes, const char* dirpath, vector<uint32_t>& out) const;
+
+    // Up to limit children of dirpath in the same order, starting at child
+    // `from` (NO_INODE for the first one). next is the child after the last
+    // one returned, NO_INODE once the directory is exhausted. ERROR_NOT_FOUND
+    // if from is no longer a child of dirpath.
+    OFSErrorCodes listPage(const InodeTable& inodes, const char* dirpath, uint32_t from, size_t limit,
+                           vector<uint32_t>& out, uint32_t& next) const;
+
+    // Slots of the entries matching a glob pattern, in no particular order
+    // and possibly repeated. Each component of the pattern is matched with
+    // fnmatch(); a component without wildcards is one PathIndex lookup, and
+    // "**" matches any number of directories ("/logs/**" is everything
+    // below /logs). Only directories on a matching route are visited.
+    void glob(const InodeTable& inodes, const char* pattern, vector<uint32_t>& out) const;
+
+    // Totals of the files below path ("/" for the whole tree), or of the
+    // file itself; kept up to date, so this costs one lookup. Each entry
+    // holds what it adds to the totals of the directories above it, and
+    // linking, unlinking or moving it adds or subtracts that along its
+    // parent chain. sync() folds a file's new size and block count in.
+    OFSErrorCodes usage(const InodeTable& inodes, const char* path, DirUsage& out) const;
+    void sync(const InodeTable& inodes, uint32_t slot);
+
+    // Links every used inode under the parent and name it already records,
+    // after the table was loaded. Fails if they do not form a tree.
+    OFSErrorCodes rebuild(InodeTable& inodes);
+
+    size_t size() const;
+    const PathIndex& index() const { return index_; }
+    void printTree(const InodeTable& inodes) const;
     void clear();
+
+private:
+    PathIndex index_;
+    uint32_t top_;          // First top-level entry, NO_INODE if none
+    vector<DirUsage> usage_;    // Per slot: a file's counted size, a directory's totals
+    DirUsage top_usage_;
+
+    bool resolve(const InodeTable& inodes, const char* path, uint32_t& slot) const;
+    uint32_t findParent(const InodeTable& inodes, const char* path, string_view& leaf, OFSErrorCodes& err) const;
+    uint32_t firstChild(const InodeTable& inodes, uint32_t dir) const;
+    void setFirstChild(InodeTable& inodes, uint32_t dir, uint32_t slot);
+    void attach(InodeTable& inodes, uint32_t slot);
+    void detach(InodeTable& inodes, uint32_t slot);
+    void addUsage(const InodeTable& inodes, uint32_t dir, int64_t bytes, int64_t blocks, int64_t files);
+    void globFrom(const InodeTable& inodes, uint32_t dir, const vector<string>& parts, size_t k,
+                  vector<uint32_t>& out) const;
+    void addDescendants(const InodeTable& inodes, uint32_t dir, vector<uint32_t>& out) const;
 };
 
 #endif
@@ -2,11 +2,29 @@
 #define FREE_BITMAP_HPP
 
 #include "odf_types.hpp"
+#include <cstdint>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
 #include <utility>
 
 using namespace std;
 
+// Two-level allocation map. Each bit of words_ is one block (1 = used); each
+// bit of full_ says whether the matching word of words_ has no free block
+// left, so a search skips 4096 used blocks per summary word. The free count
+// and the number of free runs are kept up to date on every change, and
+// allocation resumes from where the previous one stopped (next-fit).
+//
+// A used block normally has one owner. Deduplicated blocks get extra
+// references through addRef(); freeing such a block only drops a reference
+// until the last one goes. Blocks that lose their last extra reference are
+// remembered until forgetUnshared(), see wasShared().
+//
+// When an allocation needs more blocks than are free, the grow handler (if
+// set) is asked for at least that many more; it extends the container and
+// calls grow() before the allocation goes ahead.
 class FreeBitmap 
 {
 public:
@@ -15,21 +33,91 @@ public:
 
     void init(unsigned int total_blocks);
 
+    // Adds free blocks at the end, up to total_blocks in all.
+    void grow(unsigned int total_blocks);
+    void setGrowHandler(function<bool(unsigned int more)> handler);
+
+    static const unsigned int NO_HINT = ~0u;
+
     pair<OFSErrorCodes, vector<unsigned int>> allocateBlocks(unsigned int n);
 
+    // Allocates n blocks as few contiguous runs as possible. A free run
+    // starting at `hint` (usually just past a file's last extent) is taken
+    // first so the file keeps growing in place; the rest comes from the
+    // first free run big enough to hold it, or failing that from successive
+    // runs in next-fit order.
+    pair<OFSErrorCodes, vector<Extent>> allocateExtent(unsigned int n, unsigned int hint = NO_HINT);
+
     OFSErrorCodes freeBlocks(const vector<unsigned int>& blocks);
+    OFSErrorCodes freeExtents(const vector<Extent>& extents);
+
+    // Marks blocks as allocated when rebuilding the map from saved metadata.
+    // A block that is already used gains a reference instead.
+    OFSErrorCodes markUsed(const vector<unsigned int>& blocks);
+    OFSErrorCodes markUsed(const vector<Extent>& extents);
+
+    OFSErrorCodes addRef(unsigned int block);
+    uint32_t refCount(unsigned int block) const;
+    bool hasShared(const Extent& e) const;
+
+    // True if the block has extra references, or had some since the last
+    // forgetUnshared(); for an extent, if any of its blocks does.
+    bool wasShared(unsigned int block) const;
+    bool wasShared(const Extent& e) const;
+    void forgetUnshared();
+
+    // References beyond the first, summed over all blocks.
+    uint64_t sharedRefs() const;
+
+    bool isUsed(unsigned int block) const;
+
+    // First used block at or after `from`, or totalBlocks() if none.
+    unsigned int nextUsed(unsigned int from) const;
 
     unsigned int freeCount() const;
 
+    // Number of maximal runs of free blocks.
+    unsigned int freeRuns() const;
+
     unsigned int totalBlocks() const;
 
 private:
-    vector<unsigned char> bitmap_;
+    vector<uint64_t> words_;
+    vector<uint64_t> full_;
     unsigned int blocks_; 
+    unsigned int free_;
+    unsigned int runs_;
+    size_t cursor_;         // word index the next search starts at
+    unordered_map<unsigned int, uint32_t> extra_refs_;
+    unordered_set<unsigned int> unshared_;     // Lost their extra references, see wasShared()
+    uint64_t shared_;
+    function<bool(unsigned int)> grow_handler_;
+
+    // True once at least n blocks are free, growing if needed.
+    bool reserve(unsigned int n);
+
+    void release(unsigned int block);
+
+    // Every word update goes through here to keep the counters and the
+    // summary level in step.
+    void storeWord(size_t w, uint64_t v);
+    unsigned int runStarts(size_t w) const;
+
+    void setBit(unsigned int pos);
+    void clearBit(unsigned int pos);
+    bool testBit(unsigned int pos) const;
+    void setRun(unsigned int start, unsigned int len);
+    void clearRun(unsigned int start, unsigned int len);
+
+    // First free / used block at or after `from`, or blocks_ if none.
+    unsigned int findFree(unsigned int from) const;
+    unsigned int findUsed(unsigned int from) const;
+
+    // Start of the first free run of at least n blocks inside [from, to).
+    bool findRun(unsigned int from, unsigned int to, unsigned int n, unsigned int& start) const;
 
-    static void setBit(vector<unsigned char>& bm, unsigned int pos);
-    static void clearBit(vector<unsigned char>& bm, unsigned int pos);
-    static bool testBit(const vector<unsigned char>& bm, unsigned int pos);
+    // First word at or after `from` with a free bit, or words_.size().
+    size_t nextFreeWord(size_t from) const;
 };
 
 #endif
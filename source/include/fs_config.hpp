@@ -0,0 +1,64 @@
+#ifndef FS_CONFIG_HPP
+#define FS_CONFIG_HPP
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Values read from the .uconf file. Keys that are missing keep the defaults
+// set by the constructor, so a missing config file still yields a usable FS.
+struct FSConfig
+{
+    uint64_t total_size;
+    uint64_t block_size;
+    uint32_t max_users;
+    uint64_t mmap_budget;       // Containers up to this size are mapped whole
+    uint64_t change_log_size;   // Bytes reserved for the write-ahead log
+    uint32_t commit_window_us;  // How long a group commit waits for company
+    uint32_t checkpoint_interval;     // Seconds between checkpoints
+    uint32_t checkpoint_log_percent;  // Checkpoint early once the log is this full
+    uint32_t defrag_step_blocks;      // Blocks the defragmenter may move per step, 0 = off
+    uint32_t defrag_interval_ms;      // Minimum time between two defragmenter steps
+    uint32_t defrag_min_percent;      // Only defragment above this fragmentation
+    uint64_t vault_size;              // Bytes reserved for version history, 0 = none
+    uint32_t vault_keyframe_interval; // Every Nth version is kept in full
+    uint32_t dedup;                   // 1 = share identical data blocks between files
+    uint32_t compression;             // 1 = compress new files unless a directory says otherwise
+    uint32_t checksums;               // 1 = format with a CRC32C per data block
+    uint64_t max_size;                // Largest size the container may grow to, 0 = total_size
+    uint64_t grow_step;               // Bytes added each time the container grows
+    uint32_t scrub_step_blocks;       // Blocks the scrubber checks per step, 0 = off
+    uint32_t scrub_interval_ms;       // Minimum time between two scrubber steps
+    uint64_t index_step_bytes;        // File bytes the text index reads per merge, 0 = no text index
+    uint32_t index_interval_ms;       // Minimum time between two text index merges
+
+    FSConfig()
+        : total_size(4ULL * 1024 * 1024)
+        , block_size(4096ULL)
+        , max_users(1024)
+        , mmap_budget(1ULL << 30)
+        , change_log_size(1ULL * 1024 * 1024)
+        , commit_window_us(2000)
+        , checkpoint_interval(300)
+        , checkpoint_log_percent(50)
+        , defrag_step_blocks(64)
+        , defrag_interval_ms(100)
+        , defrag_min_percent(5)
+        , vault_size(1ULL * 1024 * 1024)
+        , vault_keyframe_interval(8)
+        , dedup(0)
+        , compression(0)
+        , checksums(1)
+        , max_size(0)
+        , grow_step(16ULL * 1024 * 1024)
+        , scrub_step_blocks(256)
+        , scrub_interval_ms(1000)
+        , index_step_bytes(1024ULL * 1024)
+        , index_interval_ms(100)
+    {}
+};
+
+int load_config(const char* config_path, FSConfig& out);
+
+#endif
@@ -3,21 +3,100 @@
 
 #include <vector>
 #include <string>
+#include <unordered_map>
+#include <mutex>
 #include "odf_types.hpp"
 #include "fs_user.hpp"
+#include "block_store.hpp"
+#include "fs_config.hpp"
+#include "change_log.hpp"
+#include "delta_vault.hpp"
+#include "dedup.hpp"
+#include "inode_table.hpp"
+#include "dir_tree.hpp"
+#include "meta_index.hpp"
+#include "text_index.hpp"
+#include "quota.hpp"
 
 using namespace std;
 
+// Container layout kept in OMNIHeader::reserved. Everything from data_offset
+// onwards is the data region, split into data_blocks blocks of block_size.
+struct OMNILayout
+{
+    uint64_t data_offset;
+    uint64_t data_blocks;
+    uint64_t change_log_size;   // Region at OMNIHeader::change_log_offset, 0 if absent
+    uint64_t checkpoint_head;   // First block of the checkpoint chain + 1, 0 if none
+    uint64_t checkpoint_bytes;  // Size of the checkpoint image
+    uint64_t checkpoint_lsn;    // Last change log record the checkpoint includes
+    uint64_t vault_size;        // Region at OMNIHeader::file_state_storage_offset, 0 if absent
+    uint64_t vault_head;        // Oldest live vault position as of the checkpoint
+    uint64_t vault_tail;        // Next vault position as of the checkpoint
+    uint64_t checksum_offset;   // CRC32C table of the data blocks, 0 if absent
+    uint32_t header_crc;        // CRC32C of the header with this field zeroed, 0 if absent
+    uint32_t users_crc;         // CRC32C of the user table, 0 if absent
+    uint64_t max_blocks;        // Data blocks the container may grow to, 0 if fixed
+    uint32_t root_compression;  // COMPRESS_* policy of "/" as of the checkpoint
+    uint32_t reserved;
+};
+
+// An open file handle, see file_open(). The generation tells whether the
+// inode at slot is still the one that was opened.
+struct OpenFile
+{
+    SessionInfo* session;
+    uint32_t slot;
+    uint32_t generation;
+    uint32_t mode;              // OPEN_READ | OPEN_WRITE
+};
+
 struct FileSystemInstance
 {
-    vector<FileMetadata> files;
-    vector<string> file_contents;
+    InodeTable inodes;
+    DirTree tree;               // Names and directories over inodes, see find_entry()
+    MetaIndex meta;             // Inodes by owner and by mtime, see touch_entry()
     vector<UserInfo> users;
+    vector<OwnerQuota> quotas;  // Usage and limits per owner id, see quota.hpp
     vector<SessionInfo*> sessions;
+    mutex op_lock;              // See FSLock
+    unordered_map<uint64_t, OpenFile> handles;
+    uint64_t next_handle;
     string omni_path;
     string config_path;
+    FSConfig config;
+    OMNIHeader header;
     FreeBitmap bitmap;
+    BlockStore store;
+    ChangeLog log;
+    DeltaVault vault;
+    DedupIndex dedup;
+    uint32_t root_compression;  // COMPRESS_* policy of "/", which has no inode
+    bool replaying;
+    uint64_t replay_time;
+    FileVersion replay_saved;   // Vault record of the record being replayed, see vault_save()
+    vector<unsigned int> checkpoint_blocks;
+    uint64_t last_checkpoint;
     FSStats stats;
+
+    // Fragmentation counters and defragmenter state, see defrag.hpp.
+    uint64_t file_extents;
+    uint64_t file_blocks;
+    uint64_t data_files;
+    uint64_t compressed_files;
+    uint64_t compress_saved;        // Blocks compressed files do without
+    vector<Extent> deferred_free;
+    size_t defrag_cursor;
+    uint64_t last_defrag_ms;
+
+    // Background scrubber state, see scrub.hpp.
+    unsigned int scrub_cursor;
+    uint64_t last_scrub_ms;
+    uint64_t metadata_corrupt;
+
+    // Full-text index of file contents, see text_index.hpp.
+    TextIndex text;
+    uint64_t last_index_ms;
 };
 
 extern FileSystemInstance* g_fs;
@@ -26,5 +105,65 @@ int fs_init(void** instance, const char* omni_path, const char* config_path);
 int fs_format(const char* omni_path, const char* config_path);
 void fs_shutdown(void* instance);
 
+OMNILayout read_layout(const OMNIHeader& hdr);
+void write_layout(OMNIHeader& hdr, const OMNILayout& layout);
+
+// Writes fs->header back to the start of the container and flushes it.
+int write_header(FileSystemInstance* fs);
+
+// Every path lookup goes through fs->tree, and fs->tree decides where an
+// entry may be created, renamed to or removed from. Entries are added,
+// removed and renamed only through these so the tree and fs->inodes never
+// disagree; check fs->tree.canCreate() before adding. Renaming moves the
+// entry together with everything below it in constant time, and returns
+// why it was refused. Entries are referred to by their slot in fs->inodes,
+// which stays the same until the entry is removed.
+uint32_t find_entry(FileSystemInstance* fs, const char* path);
+uint32_t add_entry(FileSystemInstance* fs, const char* path, EntryType type, const char* owner, uint32_t permissions);
+void remove_entry(FileSystemInstance* fs, uint32_t slot);
+OFSErrorCodes rename_entry(FileSystemInstance* fs, uint32_t slot, const char* new_path);
+
+// Page cursors: 0 for the first page, otherwise the inode number of the
+// next entry with its generation in the high half, so a reused number is
+// not mistaken for it. cursor_entry() gives NO_INODE for 0 and fails if the
+// inode has been freed since.
+uint64_t entry_cursor(FileSystemInstance* fs, uint32_t slot);
+bool cursor_entry(FileSystemInstance* fs, uint64_t cursor, uint32_t& slot);
+
+// Sets the mtime of fs->inodes[slot] to now. Always change mtime through
+// this, so fs->meta keeps its time order. It also hands a changed size or
+// block count to the directory totals in fs->tree.
+void touch_entry(FileSystemInstance* fs, uint32_t slot);
+
+// Persist one UserInfo slot of the on-disk user table and flush it.
+int user_table_store(const UserInfo& user);
+int user_table_erase(const char* username);
+
+// Threads sharing g_fs hold an FSLock on g_fs->op_lock around every call
+// into the API, so one operation runs at a time. While fs_log_commit waits
+// for the change log flush it lets go of the calling thread's FSLock; the
+// next operation runs meanwhile and its record can join the same flush.
+class FSLock
+{
+public:
+    explicit FSLock(bool locked = true);
+    ~FSLock();
+
+    void lock();
+    void unlock();
+    bool held() const;
+
+private:
+    unique_lock<mutex> lk_;
+    FSLock* outer_;
+};
+
+// Append a mutation to the change log and wait for its group commit.
+// A no-op while the log itself is being replayed.
+int fs_log_commit(const LogRecord& rec);
+
+// Current time, or the logged time of the record being replayed.
+uint64_t fs_now();
+
 #endif
 
@@ -8,4 +8,41 @@ int dir_list(void* session, const char* path, FileEntry** entries, int* count);
 int dir_delete(void* session, const char* path);
 int dir_exists(void* session, const char* path);
 
+// One page of dir_list: up to limit entries (at most DIR_PAGE_MAX) starting
+// at cursor, 0 for the first page, each with its size, owner, permissions
+// and times. next_cursor is 0 after the last page. A cursor names the next
+// entry to return and fails with ERROR_NOT_FOUND if that entry has been
+// deleted or moved away since. Free *entries with delete[].
+static const int DIR_PAGE_MAX = 4096;
+int dir_list_plus(void* session, const char* path, uint64_t cursor, int limit, FileEntry** entries, int* count,
+                  uint64_t* next_cursor);
+
+// Moves a directory, with everything below it, to new_path. Only the
+// directory's own inode is relinked, so the cost does not depend on the
+// size of the subtree. new_path must not exist or lie inside old_path.
+int dir_rename(void* session, const char* old_path, const char* new_path);
+
+// Paths matching a glob pattern such as "/logs/2026/**", "/etc/*.cfg" or
+// "/**/*.log", sorted, at most limit of them. Wildcards work per component
+// and "**" spans directories; only the directories a match could lie in are
+// visited. *paths holds one path per line; free it with free_buffer().
+int dir_find(void* session, const char* pattern, int limit, char** paths, size_t* size, int* count);
+
+// Deletes a directory and everything below it in one pass: the data blocks
+// of every file are released in one batch and the whole delete is one
+// change log record, so after a crash it happened completely or not at all.
+int dir_delete_recursive(void* session, const char* path);
+
+// Copies src (a directory with everything below it, or a single file) to
+// dst, which must not exist yet or lie inside src. Copies share the data
+// blocks of the originals; the first write to either side gets its own
+// blocks (copy-on-write), so no file content is read or written here.
+// Logged as one record, like dir_delete_recursive.
+int tree_copy(void* session, const char* src, const char* dst);
+
+// Bytes, blocks and files below path ("/" for everything), or of path
+// itself if it is a file. The totals are kept up to date as files change,
+// so this costs one path lookup however large the subtree is.
+int dir_usage(void* session, const char* path, DirUsage* usage);
+
 #endif
@@ -11,12 +11,63 @@
 
 using namespace std;
 
+// One contiguous piece of a file's content inside the mapped container.
+struct FileSegment
+{
+    const char* data;
+    size_t size;
+};
+
 int file_create(void* session, const char* path, const char* data, size_t size);
 int file_read(void* session, const char* path, char** buffer, size_t* size);
+// Zero-copy read for mmap-backed containers. Segments point into the mapping
+// and stay valid until the file is next modified; free the array with delete[].
+// Returns ERROR_NOT_IMPLEMENTED when the container is in pread/pwrite mode.
+int file_read_segments(void* session, const char* path, FileSegment** segments, int* count, size_t* size);
 int file_edit(void* session, const char* path, const char* data, size_t size, unsigned int index);
 int file_delete(void* session, const char* path);
 int file_truncate(void* session, const char* path);
 int file_exists(void* session, const char* path);
 int file_rename(void* session, const char* old_path, const char* new_path);
 
+// Delta Vault history. file_versions lists the versions still available,
+// oldest first, ending with the current one; free the array with delete[].
+int file_versions(void* session, const char* path, FileVersion** versions, int* count);
+int file_read_version(void* session, const char* path, unsigned int version, char** buffer, size_t* size);
+// Makes an older version current again, as a new version.
+int file_rollback(void* session, const char* path, unsigned int version);
+
+// Handle-based I/O. file_open resolves the path and checks the permission
+// bits once; the handle then names that inode directly, so pread/pwrite do
+// no path lookup. A handle belongs to the session that opened it, is closed
+// by user_logout, and reports ERROR_NOT_FOUND once its file is deleted,
+// even if the inode number has been reused since.
+static const uint32_t OPEN_READ = 1;
+static const uint32_t OPEN_WRITE = 2;
+
+int file_open(void* session, const char* path, uint32_t mode, uint64_t* handle);
+// Reads up to size bytes at offset; *read is 0 at or past the end of file.
+int file_pread(void* session, uint64_t handle, char* buffer, size_t size, uint64_t offset, size_t* read);
+int file_pwrite(void* session, uint64_t handle, const char* data, size_t size, uint64_t offset);
+int file_close(void* session, uint64_t handle);
+void file_close_all(void* session);
+
+// Full-text search over file contents, see text_index.hpp. Finds up to
+// limit files holding every word of query and returns one line per file,
+// "<path>\t<offset>\t<snippet>\n", in *results (free with free_buffer).
+// The snippet is the text around the first occurrence at offset, with
+// control characters shown as spaces. One batch of queued files is merged
+// first, as in a background step; files still queued after it are left out
+// until they are merged, so no result is stale but a file changed moments
+// ago, or every file shortly after start-up, may be missing.
+// ERROR_NOT_IMPLEMENTED if index_step_bytes is 0.
+static const size_t SEARCH_SNIPPET = 80;
+
+int file_search(void* session, const char* query, int limit, char** results, size_t* size, int* count);
+
+// Sets the COMPRESS_* mode of a file, converting its content, or the policy
+// a directory passes on to files created below it. The policy of "/" applies
+// wherever no directory sets one, ahead of the `compression` config key.
+int set_compression(void* session, const char* path, uint32_t mode);
+
 #endif
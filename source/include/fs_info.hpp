@@ -6,6 +6,18 @@
 int get_metadata(void* session, const char* path, FileMetadata* meta);
 int set_permissions(void* session, const char* path, uint32_t permissions);
 int get_stats(void* session, FSStats* stats);
+// Counters of the path index and its Bloom filter, kept apart so FSStats
+// keeps its size.
+int get_lookup_stats(void* session, LookupStats* stats);
+
+// Paths of the entries owned by owner, and of the entries modified at or
+// after `since` (newest first), a page of at most limit at a time. Cursors
+// work as in dir_list_plus(): 0 for the first page, next_cursor is 0 after
+// the last one. *paths holds one path per line; free it with free_buffer().
+int find_by_owner(void* session, const char* owner, uint64_t cursor, int limit, char** paths, size_t* size,
+                  int* count, uint64_t* next_cursor);
+int changed_since(void* session, uint64_t since, uint64_t cursor, int limit, char** paths, size_t* size,
+                  int* count, uint64_t* next_cursor);
 void free_buffer(void* buffer);
 const char* get_error_message(int error_code);
 
@@ -19,4 +19,10 @@ int user_list(void* admin_session, UserInfo** users, int* count);
 
 int get_session_info(void* session, SessionInfo* info);
 
+// Byte and inode quotas, see quota.hpp. Only administrators may set them,
+// 0 meaning no limit; writes that would go over are refused with
+// ERROR_NO_SPACE before any data is written. Users may read their own.
+int user_set_quota(void* admin_session, const char* username, uint64_t max_bytes, uint32_t max_inodes);
+int user_get_quota(void* session, const char* username, QuotaInfo* info);
+
 #endif
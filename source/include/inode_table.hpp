@@ -0,0 +1,133 @@
+#ifndef INODE_TABLE_HPP
+#define INODE_TABLE_HPP
+
+#include "odf_types.hpp"
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+static const uint32_t NO_INODE = ~0u;
+static const uint8_t FREE_INODE = 0xFF;     // Inode::type of an unused slot
+
+// The part of an in-memory inode that lookups, listings and scans read,
+// packed into one cache line. Names live in the table's arena and owners
+// in its owner table, so neither is stored per inode.
+struct Inode
+{
+    uint64_t size;              // Logical size in bytes
+    uint64_t mtime;             // Last modification time
+    uint64_t ctime;             // Creation time
+    uint32_t blocks;            // Data blocks held by the extents
+    uint32_t parent;            // Slot of the parent directory, NO_INODE at the top level
+    uint32_t name;              // Offset of the name in the arena
+    uint32_t owner;             // Owner table index
+    uint32_t permissions;       // UNIX-style permissions
+    uint32_t generation;        // Allocation number, never repeated for a slot
+    uint32_t child;             // First child of a directory, NO_INODE if none
+    uint32_t next;              // Siblings in the parent's circular child list
+    uint32_t prev;
+    uint16_t name_len;
+    uint8_t type;               // EntryType, FREE_INODE when unused
+    uint8_t compression;        // COMPRESS_* codec, or the policy of a directory
+
+    EntryType getType() const { return static_cast<EntryType>(type); }
+};  // Total: 64 bytes
+
+static_assert(sizeof(Inode) == 64, "Inode must fill one cache line");
+
+// The part only touched when content is read or written.
+struct InodeData
+{
+    vector<Extent> extents;     // Data block runs holding the content, in file order
+    uint32_t version;           // Current version number
+    uint32_t author;            // Owner table index of the writer of the current version
+};
+
+// Kept only for inodes that have them: compressed files and files with
+// older versions in the vault.
+struct InodeExtra
+{
+    vector<uint32_t> chunks;    // Stored length of each compression unit, 0 = kept raw
+    vector<FileVersion> history;  // Older versions still in the vault, oldest first
+};
+
+// Struct-of-arrays inode table: Inode records in one array, InodeData in a
+// second one at the same slot, InodeExtra in a side map. A slot keeps its
+// number for the life of the inode and is reused after release, so slots
+// can be stored in the namespace and in indexes. The inode number is the
+// slot + 1; each allocation also takes the next value of a table-wide
+// generation counter, so (inode, generation) never names two different
+// inodes. FileEntry and FileMetadata are only built when an API call
+// returns one.
+class InodeTable
+{
+public:
+    InodeTable();
+
+    // A zeroed inode of the given type with no name, parent or content.
+    uint32_t allocate(EntryType type);
+    void release(uint32_t slot);
+
+    // Claims a particular slot (checkpoint load); grows the table as needed.
+    // Call relinkFree() after the last claim.
+    void claim(uint32_t slot, EntryType type);
+    void relinkFree();
+    void clear();
+
+    static uint32_t inodeNumber(uint32_t slot) { return slot + 1; }
+
+    // Last generation handed out; restored along with the inodes.
+    uint32_t generation() const;
+    void setGeneration(uint32_t generation);
+
+    size_t size() const;            // Inodes in use
+    uint32_t slots() const;         // Slots in use or free; iterate [0, slots())
+    bool used(uint32_t slot) const;
+
+    Inode& operator[](uint32_t slot) { return hot_[slot]; }
+    const Inode& operator[](uint32_t slot) const { return hot_[slot]; }
+    InodeData& data(uint32_t slot) { return data_[slot]; }
+    const InodeData& data(uint32_t slot) const { return data_[slot]; }
+
+    // Empty for inodes without an InodeExtra; extra() creates one.
+    const vector<uint32_t>& chunks(uint32_t slot) const;
+    const vector<FileVersion>& history(uint32_t slot) const;
+    InodeExtra& extra(uint32_t slot);
+
+    string_view name(uint32_t slot) const;
+    void setName(uint32_t slot, string_view name);
+
+    uint32_t internOwner(const char* name);
+    // False if no inode was ever owned by name.
+    bool findOwner(const char* name, uint32_t& id) const;
+    const char* ownerName(uint32_t id) const;
+
+    // Full path, built from the parent chain.
+    string path(uint32_t slot) const;
+
+    // The ABI view of an inode.
+    FileEntry entry(uint32_t slot) const;
+    void metadata(uint32_t slot, FileMetadata& out) const;
+
+    // Bytes of memory held by the table.
+    size_t memoryUsage() const;
+
+private:
+    vector<Inode> hot_;
+    vector<InodeData> data_;
+    unordered_map<uint32_t, InodeExtra> extra_;
+    vector<char> names_;
+    size_t names_dead_;
+    vector<string> owners_;
+    unordered_map<string, uint32_t> owner_ids_;
+    uint32_t free_head_;            // Free slots are chained through Inode::next
+    uint32_t generation_;
+    size_t count_;
+
+    void compactNames();
+};
+
+#endif
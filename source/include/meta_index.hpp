@@ -0,0 +1,64 @@
+#ifndef META_INDEX_HPP
+#define META_INDEX_HPP
+
+#include "inode_table.hpp"
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Secondary indexes over an InodeTable: the inodes of each owner, and all
+// inodes ordered by modification time. Both are doubly linked lists through
+// per-slot links kept here, so adding, removing or touching an inode is
+// O(1) and a page of results costs only the entries it returns. A touched
+// inode moves to the newest end of the time list; the list is sorted once
+// when a checkpoint is loaded. Every call takes the table the slots refer to.
+class MetaIndex
+{
+public:
+    MetaIndex();
+
+    // inodes[slot] was allocated with its owner and mtime set.
+    void add(const InodeTable& inodes, uint32_t slot);
+    // Call before the slot is released.
+    void remove(const InodeTable& inodes, uint32_t slot);
+    // inodes[slot].mtime changed.
+    void touched(const InodeTable& inodes, uint32_t slot);
+
+    // Indexes every used inode, after the table was loaded.
+    void rebuild(const InodeTable& inodes);
+    void clear();
+
+    // Up to limit inodes of owner, starting at `from` (NO_INODE for the
+    // first); next is where the following page starts, NO_INODE at the end.
+    // False if from is no longer one of owner's inodes.
+    bool byOwner(const InodeTable& inodes, uint32_t owner, uint32_t from, size_t limit, vector<uint32_t>& out,
+                 uint32_t& next) const;
+
+    // Up to limit inodes modified at or after since, newest first, paged
+    // like byOwner(). An inode changed again while paging may be listed
+    // twice. False if from is no longer in the range.
+    bool changedSince(const InodeTable& inodes, uint64_t since, uint32_t from, size_t limit, vector<uint32_t>& out,
+                      uint32_t& next) const;
+
+private:
+    struct Links
+    {
+        uint32_t owner_next;    // Circular list of the owner's inodes
+        uint32_t owner_prev;
+        uint32_t newer;         // Time list, NO_INODE at either end
+        uint32_t older;
+    };
+
+    vector<Links> links_;
+    unordered_map<uint32_t, uint32_t> owner_head_;
+    uint32_t oldest_;
+    uint32_t newest_;
+
+    void linkOwner(const InodeTable& inodes, uint32_t slot);
+    void unlinkOwner(const InodeTable& inodes, uint32_t slot);
+    void linkTime(const InodeTable& inodes, uint32_t slot);
+    void unlinkTime(uint32_t slot);
+};
+
+#endif
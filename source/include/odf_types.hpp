@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <string>
 #include <cstring>  // For std::strncpy and std::memset
+#include <vector>
 
 // ============================================================================
 // ENUMERATIONS - DO NOT MODIFY THESE VALUES
@@ -119,14 +120,18 @@ struct UserInfo {
     uint64_t created_time;      // Account creation timestamp (Unix epoch)
     uint64_t last_login;        // Last login timestamp (Unix epoch)
     uint8_t is_active;          // 1 if active, 0 if deleted
-    uint8_t reserved[23];       // Reserved for future use
+    uint8_t padding[3];         // Alignment padding
+    uint32_t quota_inodes;      // Most files and directories the user may own, 0 = no limit
+    uint64_t quota_bytes;       // Most bytes of file content the user may own, 0 = no limit
+    uint8_t reserved[7];        // Reserved for future use
 
     // Default constructor
     UserInfo() = default;
     
     // Constructor
     UserInfo(const std::string& user, const std::string& hash, UserRole r, uint64_t created)
-        : role(r), created_time(created), last_login(0), is_active(1) {
+        : role(r), created_time(created), last_login(0), is_active(1), quota_inodes(0), quota_bytes(0) {
+        std::memset(padding, 0, sizeof(padding));
         std::strncpy(username, user.c_str(), sizeof(username) - 1);
         username[sizeof(username) - 1] = '\0';
         std::strncpy(password_hash, hash.c_str(), sizeof(password_hash) - 1);
@@ -148,7 +153,8 @@ struct FileEntry {
     uint64_t modified_time;     // Last modification timestamp (Unix epoch)
     char owner[32];             // Username of owner
     uint32_t inode;             // Internal file identifier
-    uint8_t reserved[47];       // Reserved for future use
+    uint32_t generation;        // Tells apart inodes that reused the same number
+    uint8_t reserved[43];       // Reserved for future use
 
     // Default constructor
     FileEntry() = default;
@@ -157,7 +163,7 @@ struct FileEntry {
     FileEntry(const std::string& filename, EntryType entry_type, uint64_t file_size, 
               uint32_t perms, const std::string& file_owner, uint32_t file_inode)
         : type(static_cast<uint8_t>(entry_type)), size(file_size), permissions(perms), 
-          created_time(0), modified_time(0), inode(file_inode) {
+          created_time(0), modified_time(0), inode(file_inode), generation(0) {
         std::strncpy(name, filename.c_str(), sizeof(name) - 1);
         name[sizeof(name) - 1] = '\0';
         std::strncpy(owner, file_owner.c_str(), sizeof(owner) - 1);
@@ -172,6 +178,33 @@ struct FileEntry {
     void setType(EntryType entry_type) { type = static_cast<uint8_t>(entry_type); }
 };  // Total: 416 bytes
 
+/**
+ * Extent: a run of physically contiguous data blocks
+ */
+struct Extent {
+    uint32_t start;             // First data block of the run
+    uint32_t length;            // Number of blocks in the run
+};  // Total: 8 bytes
+
+/**
+ * File Version (one entry of a file's Delta Vault history)
+ * Returned by file_versions function
+ */
+struct FileVersion {
+    uint32_t version;           // Version number, 1 = as created
+    uint8_t keyframe;           // 1 if the vault holds this version in full
+    uint8_t padding[3];         // Alignment padding
+    uint64_t size;              // File size at this version
+    uint64_t time;              // When this version was written
+    char author[32];            // User who wrote this version
+    uint64_t vault_pos;         // Position of the vault record restoring it
+    uint32_t vault_length;      // Payload length of that record
+    uint32_t reserved;          // Reserved
+};  // Total: 72 bytes
+
+// Checkpoints store version histories as raw FileVersion arrays.
+static_assert(sizeof(FileVersion) == 72, "FileVersion layout is part of the checkpoint format");
+
 /**
  * File Metadata (Extended information)
  * Returned by get_metadata function
@@ -182,17 +215,24 @@ struct FileMetadata {
     uint64_t blocks_used;       // Number of blocks used
     uint64_t actual_size;       // Actual size on disk (may differ from logical size)
     uint8_t reserved[64];       // Reserved
-    std::string content;
+    std::vector<Extent> extents;  // Data block runs holding the content, in file order
+    uint32_t version;           // Current version number
+    char author[32];            // User who wrote the current version
+    std::vector<FileVersion> history;  // Older versions still in the vault, oldest first
+    uint32_t compression;       // COMPRESS_* codec (files) or policy for new files (directories)
+    std::vector<uint32_t> chunks;  // Stored length of each compression unit, 0 = kept raw
 
     // Default constructor
     FileMetadata() = default;
     
     // Constructor
     FileMetadata(const std::string& file_path, const FileEntry& file_entry)
-        : entry(file_entry), blocks_used(0), actual_size(0),content("") {
+        : entry(file_entry), blocks_used(0), actual_size(0), extents(), version(1), history(),
+          compression(0), chunks() {
         std::strncpy(path, file_path.c_str(), sizeof(path) - 1);
         path[sizeof(path) - 1] = '\0';
         std::memset(reserved, 0, sizeof(reserved));
+        std::memset(author, 0, sizeof(author));
     }
 };
 
@@ -220,6 +260,27 @@ struct SessionInfo {
     }
 };
 
+/**
+ * Directory Usage (totals over everything below a directory)
+ * Returned by dir_usage function
+ */
+struct DirUsage {
+    uint64_t bytes;             // Logical size of the files
+    uint64_t blocks;            // Data blocks held by the files, shared ones counted per file
+    uint64_t files;             // Number of files
+};  // Total: 24 bytes
+
+/**
+ * Quota Information (a user's limits and what counts against them)
+ * Returned by user_get_quota function
+ */
+struct QuotaInfo {
+    uint64_t used_bytes;        // Bytes of content in files the user owns
+    uint64_t max_bytes;         // Limit, 0 = none
+    uint64_t used_inodes;       // Files and directories the user owns
+    uint64_t max_inodes;        // Limit, 0 = none
+};  // Total: 32 bytes
+
 /**
  * File System Statistics
  * Returned by get_stats function
@@ -233,7 +294,17 @@ struct FSStats {
     uint32_t total_users;       // Total number of users
     uint32_t active_sessions;   // Currently active sessions
     double fragmentation;       // Fragmentation percentage (0.0 - 100.0)
-    uint8_t reserved[64];       // Reserved
+    uint32_t file_extents;      // Extents over all files
+    uint32_t free_extents;      // Runs of free blocks
+    uint64_t defrag_moved;      // Blocks relocated by the defragmenter
+    uint64_t logical_bytes;     // File blocks as seen by files, in bytes
+    uint64_t physical_bytes;    // File blocks actually stored, in bytes
+    uint64_t dedup_hits;        // Block writes avoided by deduplication
+    uint32_t compressed_files;  // Files stored compressed
+    uint32_t scrub_passes;      // Full passes of the scrubber over used blocks
+    uint64_t scrubbed_blocks;   // Blocks checked by the scrubber
+    uint32_t corrupt_blocks;    // Blocks and metadata found not matching their checksum
+    uint8_t reserved[4];        // Reserved
 
     // Default constructor
     FSStats() = default;
@@ -242,9 +313,22 @@ struct FSStats {
     FSStats(uint64_t total, uint64_t used, uint64_t free)
         : total_size(total), used_space(used), free_space(free),
           total_files(0), total_directories(0), total_users(0),
-          active_sessions(0), fragmentation(0.0) {
+          active_sessions(0), fragmentation(0.0), file_extents(0),
+          free_extents(0), defrag_moved(0), logical_bytes(0), physical_bytes(0),
+          dedup_hits(0), compressed_files(0), scrub_passes(0), scrubbed_blocks(0),
+          corrupt_blocks(0) {
         std::memset(reserved, 0, sizeof(reserved));
     }
 };
 
+/**
+ * Path Lookup Statistics
+ * Returned by get_lookup_stats function
+ */
+struct LookupStats {
+    uint64_t name_lookups;      // Path components looked up in the index
+    uint64_t bloom_negatives;   // Lookups of absent names answered by the Bloom filter
+    uint64_t bloom_false_positives; // Absent names the filter let through to the index
+};  // Total: 24 bytes
+
 #endif // ODF_TYPES_HPP
\ No newline at end of file
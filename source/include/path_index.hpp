@@ -2,27 +2,64 @@
 #define PATH_INDEX_HPP
 
 #include "odf_types.hpp"
-#include <string>
+#include "inode_table.hpp"
+#include "bloom_filter.hpp"
+#include <string_view>
 #include <vector>
-#include <iostream>
 
 using namespace std;
 
+// Open-addressing hash index from (parent directory slot, name) to the
+// slot of the entry with that name in that directory: one step of a path
+// walk. Buckets hold only the hash and the slot; the parent and name are
+// compared against the inode the slot points to, so the index adds 8 bytes
+// per bucket and never copies names. Linear probing with backward-shift
+// deletion keeps probe runs short without tombstones, and the table
+// doubles before it is half full. A counting Bloom filter over the same
+// hashes sits in front of the table, so most lookups of names that do not
+// exist are answered without probing it. Every call takes the inode table
+// the slots refer to.
 class PathIndex 
 {
 public:
     PathIndex();
     ~PathIndex();
 
-    OFSErrorCodes insert(const string& path, const FileMetadata& meta);
-    OFSErrorCodes remove(const string& path);
-    FileMetadata* find(const string& path);
-    const FileMetadata* find(const string& path) const;
-    vector<string> listPaths() const;
+    // Slot of the entry called name in directory parent (NO_INODE for the
+    // top level), or NO_INODE.
+    uint32_t find(const InodeTable& inodes, uint32_t parent, string_view name) const;
+
+    // Adds inodes[slot] under its own parent and name.
+    OFSErrorCodes insert(const InodeTable& inodes, uint32_t slot);
+    OFSErrorCodes remove(const InodeTable& inodes, uint32_t slot);
+
     void clear();
+    size_t size() const;
+
+    // find() calls, those the Bloom filter answered as misses, and those it
+    // let through that missed anyway (false positives).
+    uint64_t lookups() const { return lookups_; }
+    uint64_t filtered() const { return filtered_; }
+    uint64_t falsePositives() const { return false_positives_; }
 
 private:
-    vector<pair<string, FileMetadata>> index_;
+    struct Bucket
+    {
+        uint32_t hash;
+        uint32_t slot;      // NO_INODE when empty
+    };
+
+    vector<Bucket> buckets_;
+    size_t mask_;
+    size_t count_;
+    BloomFilter filter_;
+    mutable uint64_t lookups_;
+    mutable uint64_t filtered_;
+    mutable uint64_t false_positives_;
+
+    static uint32_t hashName(uint32_t parent, string_view name);
+    size_t locate(const InodeTable& inodes, uint32_t parent, string_view name, uint32_t hash) const;
+    void grow();
 };
 
 #endif
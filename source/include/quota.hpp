@@ -0,0 +1,37 @@
+#ifndef QUOTA_HPP
+#define QUOTA_HPP
+
+#include "odf_types.hpp"
+#include <cstdint>
+
+struct FileSystemInstance;
+
+// Per-user byte and inode quotas. The limits are kept in each UserInfo of
+// the user table; what counts against them is the content size and number
+// of entries of the inodes a user owns. Both are cached per owner id in
+// fs->quotas, the usage kept current wherever fs->stats.used_space and the
+// entry counts change, so checking a write is one array access. Files are
+// charged to their owner, whoever writes them.
+struct OwnerQuota
+{
+    uint64_t bytes;
+    uint64_t inodes;
+    uint64_t max_bytes;         // 0 = no limit
+    uint32_t max_inodes;        // 0 = no limit
+};
+
+// False if giving owner `bytes` more bytes and `inodes` more entries would
+// exceed one of its limits. Always true while the change log is replayed,
+// since those operations were accepted when they were first made.
+bool quota_allows(FileSystemInstance* fs, uint32_t owner, uint64_t bytes, uint64_t inodes);
+
+// Adds to (or with negative amounts, subtracts from) owner's usage.
+void quota_charge(FileSystemInstance* fs, uint32_t owner, int64_t bytes, int64_t inodes);
+
+// Copies the limits of user into the cache.
+void quota_set_limits(FileSystemInstance* fs, const UserInfo& user);
+
+// Copies the limits of every user, after the inodes were loaded.
+void quota_load_limits(FileSystemInstance* fs);
+
+#endif
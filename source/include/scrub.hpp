@@ -0,0 +1,25 @@
+#ifndef SCRUB_HPP
+#define SCRUB_HPP
+
+#include "odf_types.hpp"
+
+struct FileSystemInstance;
+
+// The scrubber walks the used data blocks in order, a few at a time, and
+// re-checks each against its CRC32C even if a read already verified it.
+// It finds damage in blocks nobody reads, such as old versions and rarely
+// opened files, before a reader does. Corrupt blocks are reported through
+// corrupt_blocks in the statistics; the scrubber does not repair them.
+
+// Checks at most max_blocks used blocks from where the last step stopped.
+// Returns the number of blocks checked.
+unsigned int scrub_step(FileSystemInstance* fs, unsigned int max_blocks);
+
+// One scrub_step on g_fs, throttled by scrub_interval_ms. Called by the
+// server's background thread under an FSLock.
+int fs_scrub_step();
+
+// Refreshes corrupt_blocks in fs->stats.
+void scrub_refresh(FileSystemInstance* fs);
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef TEXT_INDEX_HPP
+#define TEXT_INDEX_HPP
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+struct FileSystemInstance;
+
+// Inverted index over file contents: term -> posting list of (slot, byte
+// offset) for every place the term occurs. A term is a run of ASCII letters,
+// digits and '_', lowercased, from TEXT_MIN_TERM to TEXT_MAX_TERM bytes
+// long; longer runs are not indexed. A posting list is kept delta-encoded
+// in one byte string: per file, in slot order, the slot minus the previous
+// slot, the number of offsets, then each offset minus the one before, all
+// as varints.
+//
+// Changed files are only queued. merge() re-indexes a batch of them and
+// rewrites each posting list the batch touches once, however many of the
+// files use the term. A slot is re-read when merged, so a file changed or
+// deleted several times before that costs one merge.
+static const size_t TEXT_MIN_TERM = 2;
+static const size_t TEXT_MAX_TERM = 32;
+static const uint64_t TEXT_READ_CHUNK = 64 * 1024;
+
+class TextIndex
+{
+public:
+    TextIndex();
+
+    // The content of slot changed, or the slot was freed.
+    void changed(uint32_t slot);
+    // Takes the oldest queued slot; false if none are queued.
+    bool nextQueued(uint32_t& slot);
+    bool isQueued(uint32_t slot) const;
+    size_t queued() const;
+
+    // The terms of one file, each with the offsets it occurs at in order.
+    typedef unordered_map<string, vector<uint64_t>> Terms;
+
+    // Replaces the postings of slots[i] with terms[i], moving the offsets
+    // out of it; no terms just drops them. The slots must be distinct.
+    void merge(const vector<uint32_t>& slots, vector<Terms>& terms);
+
+    // Slots holding every term of query, in slot order, each with the
+    // offset of its first occurrence of the least common term. False if the
+    // query has no term that could be indexed.
+    bool search(const string& query, vector<pair<uint32_t, uint64_t>>& hits) const;
+
+    void clear();
+
+    size_t terms() const;
+    size_t memoryUsage() const;
+
+    // Calls f(term, offset) for every term of data.
+    template <typename F>
+    static void tokenize(const char* data, size_t size, F f);
+
+    static bool isTermChar(char c)
+    {
+        return isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+private:
+    struct Postings
+    {
+        string term;
+        string bytes;           // Delta-encoded, see above
+        uint32_t files;
+    };
+
+    // One file's part of a posting list.
+    struct Group
+    {
+        uint32_t slot;
+        vector<uint64_t> offsets;
+    };
+
+    vector<Postings> lists_;
+    vector<uint32_t> free_lists_;
+    unordered_map<string, uint32_t> ids_;
+    unordered_map<uint32_t, vector<uint32_t>> slot_terms_;     // Lists each slot appears in
+    vector<uint32_t> queue_;
+    size_t queue_head_;
+    vector<bool> is_queued_;
+
+    uint32_t termId(const string& term);
+    void rewrite(uint32_t id, const vector<uint32_t>& batch, vector<Group>& added);
+    static void decode(const Postings& p, vector<Group>& out);
+    static void encode(const vector<Group>& groups, Postings& p);
+};
+
+template <typename F>
+void TextIndex::tokenize(const char* data, size_t size, F f)
+{
+    string term;
+    size_t i = 0;
+    while (i < size)
+    {
+        if (!isTermChar(data[i]))
+        {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        while (i < size && isTermChar(data[i]))
+            i++;
+        size_t len = i - start;
+        if (len < TEXT_MIN_TERM || len > TEXT_MAX_TERM)
+            continue;
+        term.assign(data + start, len);
+        for (char& ch : term)
+            ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+        f(term, static_cast<uint64_t>(start));
+    }
+}
+
+// Queues fs->inodes[slot] for re-indexing if the index is enabled. Called
+// whenever a file's content changes and before a file's slot is released.
+void text_changed(FileSystemInstance* fs, uint32_t slot);
+
+// Queues every file, after the inodes were loaded.
+void text_reindex_all(FileSystemInstance* fs);
+
+// Merges queued files until about max_bytes of content were read. Returns
+// the number of files merged. Files are read TEXT_READ_CHUNK bytes at a
+// time, so a large one never has to fit in memory whole.
+size_t text_merge(FileSystemInstance* fs, uint64_t max_bytes);
+
+// One text_merge on g_fs of index_step_bytes, throttled by
+// index_interval_ms. Called by the server's background thread under an
+// FSLock.
+int fs_index_step();
+
+#endif
@@ -2,11 +2,15 @@
 #include <iostream>
 #include <string>
 #include <thread>
+#include <chrono>
 #include <sstream>
 #include <vector>
 #include <algorithm>
 #include <cctype>
 #include <cstring>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 #include <unistd.h>
 #include <arpa/inet.h>
 
@@ -15,6 +19,10 @@
 #include "../include/fs_dir.hpp"
 #include "../include/fs_file.hpp"
 #include "../include/fs_info.hpp"
+#include "../include/defrag.hpp"
+#include "../include/scrub.hpp"
+#include "../include/text_index.hpp"
+#include "../include/compress.hpp"
 #include "../include/odf_types.hpp"
 
 using namespace std;
@@ -22,6 +30,8 @@ using namespace std;
 #define PORT 8080
 #define BACKLOG 10
 #define BUF_SIZE 8192
+#define MAX_PREAD (4 * 1024 * 1024)
+#define BACKGROUND_TICK_MS 10
 
 static string trim(const string &s)
 {
@@ -38,6 +48,18 @@ static void send_msg(int sock, const string &msg)
     (void)n;
 }
 
+// A command's reply, collected while the command runs and sent when it
+// goes out of scope.
+struct Reply
+{
+    int sock;
+    string out;
+
+    explicit Reply(int s) : sock(s) {}
+    ~Reply() { if (!out.empty()) send_msg(sock, out); }
+    void add(const string &msg) { out += msg; }
+};
+
 static bool recv_line(int sock, string &out)
 {
     out.clear();
@@ -80,6 +102,19 @@ static vector<string> tokenize(const string &line)
     return toks;
 }
 
+// Parses a decimal number of at most max. Unlike stoul this rejects signs,
+// trailing junk and overflow instead of throwing or wrapping.
+static bool parse_num(const string &s, uint64_t &out, uint64_t max = UINT64_MAX)
+{
+    if (s.empty() || !isdigit((unsigned char)s[0])) return false;
+    errno = 0;
+    char* end = nullptr;
+    unsigned long long v = strtoull(s.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0' || v > max) return false;
+    out = v;
+    return true;
+}
+
 static string rc_to_msg(int code)
 {
     const char* m = get_error_message(code);
@@ -87,6 +122,23 @@ static string rc_to_msg(int code)
     return string("ERROR_") + to_string(code);
 }
 
+// Compaction, scrubbing and text indexing run in small steps on their own
+// thread, taking turns with client commands and going on while no client
+// sends any. Each step keeps to its own configured interval.
+static void background_loop()
+{
+    while (true)
+    {
+        {
+            FSLock fs_lock;
+            fs_defrag_step();
+            fs_scrub_step();
+            fs_index_step();
+        }
+        this_thread::sleep_for(chrono::milliseconds(BACKGROUND_TICK_MS));
+    }
+}
+
 static void handle_client(int client_sock)
 {
     send_msg(client_sock, "Welcome to OFS server\n");
@@ -105,61 +157,94 @@ static void handle_client(int client_sock)
         string cmd = args[0];
         for (char &c : cmd) c = toupper((unsigned char)c);
 
+        // One command runs at a time. Commands with a body take the lock
+        // once the body has arrived. The reply is sent once the lock is let
+        // go again, so a client slow to read holds up no one else.
+        bool has_body = cmd == "FILE_CREATE" || cmd == "CREATE" || cmd == "FILE_EDIT" || cmd == "EDIT"
+                        || cmd == "FILE_PWRITE" || cmd == "PWRITE";
+        Reply reply(client_sock);
+        FSLock fs_lock(!has_body);
+
         if (cmd == "LOGIN")
         {
-            if (args.size() < 3) { send_msg(client_sock, "ERR USAGE: LOGIN <user> <pass>\n"); continue; }
+            if (args.size() < 3) { reply.add("ERR USAGE: LOGIN <user> <pass>\n"); continue; }
             string user = args[1];
             string pass = args[2];
             void* new_s = nullptr;
             int rc = user_login(&new_s, user.c_str(), pass.c_str());
-            if (rc != 0) { send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
             session = new_s;
-            send_msg(client_sock, "OK SESSION\n");
+            reply.add("OK SESSION\n");
             continue;
         }
 
         if (cmd == "LOGOUT")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); break; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); break; }
             int rc = user_logout(session);
             session = nullptr;
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n");
-            else send_msg(client_sock, "OK\n");
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n");
+            else reply.add("OK\n");
             break;
         }
 
         if (cmd == "CREATE_USER")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 4) { send_msg(client_sock, "ERR USAGE: CREATE_USER <username> <password> <role>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 4) { reply.add("ERR USAGE: CREATE_USER <username> <password> <role>\n"); continue; }
             string uname = args[1];
             string pwd = args[2];
-            int role = stoi(args[3]);
+            uint64_t role = 0;
+            if (!parse_num(args[3], role, INT_MAX)) { reply.add("ERR INVALID_NUMBER\n"); continue; }
             int rc = user_create(session, uname.c_str(), pwd.c_str(), static_cast<UserRole>(role));
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); else send_msg(client_sock, "OK\n");
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
             continue;
         }
 
         if (cmd == "DELETE_USER")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 2) { send_msg(client_sock, "ERR USAGE: DELETE_USER <username>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: DELETE_USER <username>\n"); continue; }
             int rc = user_delete(session, args[1].c_str());
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); else send_msg(client_sock, "OK\n");
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
+            continue;
+        }
+
+        if (cmd == "QUOTA")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() == 3 || args.size() > 4) { reply.add("ERR USAGE: QUOTA [username [max_bytes max_inodes]]\n"); continue; }
+            SessionInfo me;
+            get_session_info(session, &me);
+            string uname = args.size() > 1 ? args[1] : string(me.user.username);
+            if (args.size() == 4)
+            {
+                uint64_t max_bytes = 0;
+                uint64_t max_inodes = 0;
+                if (!parse_num(args[2], max_bytes) || !parse_num(args[3], max_inodes, UINT32_MAX)) { reply.add("ERR INVALID_NUMBER\n"); continue; }
+                int rc = user_set_quota(session, uname.c_str(), max_bytes, static_cast<uint32_t>(max_inodes));
+                if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
+                continue;
+            }
+            QuotaInfo q;
+            int rc = user_get_quota(session, uname.c_str(), &q);
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add("OK bytes=" + to_string(q.used_bytes) + "/" + to_string(q.max_bytes)
+                                  + " inodes=" + to_string(q.used_inodes) + "/" + to_string(q.max_inodes) + "\n");
             continue;
         }
 
         if (cmd == "LIST_USERS")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
             UserInfo* list = nullptr;
             int count = 0;
             int rc = user_list(session, &list, &count);
-            if (rc != 0) { send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
-            send_msg(client_sock, string("OK ") + to_string(count) + "\n");
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add(string("OK ") + to_string(count) + "\n");
             for (int i = 0; i < count; ++i)
             {
-                send_msg(client_sock, string(list[i].username) + " role=" + to_string(static_cast<int>(list[i].role)) + "\n");
+                reply.add(string(list[i].username) + " role=" + to_string(static_cast<int>(list[i].role)) + "\n");
             }
             delete[] list;
             continue;
@@ -167,64 +252,162 @@ static void handle_client(int client_sock)
 
         if (cmd == "GET_SESSION_INFO")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
             SessionInfo info;
             int rc = get_session_info(session, &info);
-            if (rc != 0) { send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
-            send_msg(client_sock, string("OK user=") + info.user.username + " role=" + to_string(static_cast<int>(info.user.role)) + "\n");
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add(string("OK user=") + info.user.username + " role=" + to_string(static_cast<int>(info.user.role)) + "\n");
             continue;
         }
 
         if (cmd == "DIR_CREATE" || cmd == "MKDIR")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 2) { send_msg(client_sock, "ERR USAGE: DIR_CREATE <path>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: DIR_CREATE <path>\n"); continue; }
             string path = args[1];
             int rc = dir_create(session, path.c_str());
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); else send_msg(client_sock, "OK\n");
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
             continue;
         }
 
         if (cmd == "DIR_LIST" || cmd == "LS")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 2) { send_msg(client_sock, "ERR USAGE: DIR_LIST <path>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: DIR_LIST <path>\n"); continue; }
             string path = args[1];
             FileEntry* entries = nullptr;
             int cnt = 0;
             int rc = dir_list(session, path.c_str(), &entries, &cnt);
-            if (rc != 0) { send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
-            send_msg(client_sock, string("OK ") + to_string(cnt) + "\n");
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add(string("OK ") + to_string(cnt) + "\n");
+            for (int i = 0; i < cnt; ++i)
+            {
+                reply.add(string(entries[i].name) + " " + to_string((int)entries[i].type) + "\n");
+            }
+            delete[] entries;
+            continue;
+        }
+
+        if (cmd == "DIR_LIST_PLUS" || cmd == "LSPLUS")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: LSPLUS <path> [cursor] [limit]\n"); continue; }
+            uint64_t cursor = 0;
+            uint64_t limit = 256;
+            if ((args.size() > 2 && !parse_num(args[2], cursor)) || (args.size() > 3 && !parse_num(args[3], limit, INT_MAX))) { reply.add("ERR INVALID_NUMBER\n"); continue; }
+            FileEntry* entries = nullptr;
+            int cnt = 0;
+            uint64_t next = 0;
+            int rc = dir_list_plus(session, args[1].c_str(), cursor, static_cast<int>(limit), &entries, &cnt, &next);
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+
+            // The whole page goes out in one send: OK <count> <next cursor>,
+            // then name type size owner perms mtime per entry.
+            string page = "OK " + to_string(cnt) + " " + to_string(next) + "\n";
             for (int i = 0; i < cnt; ++i)
             {
-                send_msg(client_sock, string(entries[i].name) + " " + to_string((int)entries[i].type) + "\n");
+                const FileEntry& e = entries[i];
+                page += string(e.name) + " " + to_string((int)e.type) + " " + to_string(e.size) + " " + e.owner + " "
+                        + to_string(e.permissions) + " " + to_string(e.modified_time) + "\n";
             }
             delete[] entries;
+            reply.add(page);
+            continue;
+        }
+
+        if (cmd == "FIND")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: FIND <pattern> [limit]\n"); continue; }
+            uint64_t limit = 1000;
+            if (args.size() > 2 && !parse_num(args[2], limit, INT_MAX)) { reply.add("ERR INVALID_NUMBER\n"); continue; }
+            char* paths = nullptr;
+            size_t size = 0;
+            int cnt = 0;
+            int rc = dir_find(session, args[1].c_str(), static_cast<int>(limit), &paths, &size, &cnt);
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add("OK " + to_string(cnt) + "\n" + string(paths, size));
+            free_buffer(paths);
+            continue;
+        }
+
+        if (cmd == "DU")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            string path = args.size() > 1 ? args[1] : "/";
+            DirUsage du;
+            int rc = dir_usage(session, path.c_str(), &du);
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add("OK bytes=" + to_string(du.bytes) + " blocks=" + to_string(du.blocks)
+                                  + " files=" + to_string(du.files) + "\n");
+            continue;
+        }
+
+        if (cmd == "SEARCH" || cmd == "GREP")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: SEARCH <word> [word...]\n"); continue; }
+            string query;
+            for (size_t i = 1; i < args.size(); ++i) query += args[i] + " ";
+            char* results = nullptr;
+            size_t size = 0;
+            int cnt = 0;
+            int rc = file_search(session, query.c_str(), 100, &results, &size, &cnt);
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add("OK " + to_string(cnt) + "\n" + string(results, size));
+            free_buffer(results);
             continue;
         }
 
         if (cmd == "DIR_DELETE" || cmd == "RMDIR")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 2) { send_msg(client_sock, "ERR USAGE: DIR_DELETE <path>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: DIR_DELETE <path>\n"); continue; }
             int rc = dir_delete(session, args[1].c_str());
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); else send_msg(client_sock, "OK\n");
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
             continue;
         }
 
         if (cmd == "DIR_EXISTS" || cmd == "EXISTS_DIR")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 2) { send_msg(client_sock, "ERR USAGE: DIR_EXISTS <path>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: DIR_EXISTS <path>\n"); continue; }
             int rc = dir_exists(session, args[1].c_str());
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); else send_msg(client_sock, "OK\n");
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
+            continue;
+        }
+
+        if (cmd == "DIR_RENAME" || cmd == "MVDIR")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 3) { reply.add("ERR USAGE: MVDIR <old_path> <new_path>\n"); continue; }
+            int rc = dir_rename(session, args[1].c_str(), args[2].c_str());
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
+            continue;
+        }
+
+        if (cmd == "DIR_DELETE_RECURSIVE" || cmd == "RM_R")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: RM_R <path>\n"); continue; }
+            int rc = dir_delete_recursive(session, args[1].c_str());
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
+            continue;
+        }
+
+        if (cmd == "TREE_COPY" || cmd == "CP_R")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 3) { reply.add("ERR USAGE: CP_R <src> <dst>\n"); continue; }
+            int rc = tree_copy(session, args[1].c_str(), args[2].c_str());
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
             continue;
         }
 
         if (cmd == "FILE_CREATE" || cmd == "CREATE")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 2) { send_msg(client_sock, "ERR USAGE: CREATE <path>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: CREATE <path>\n"); continue; }
             string path = args[1];
             send_msg(client_sock, "SEND_DATA <<<EOF>>> on its own line to finish\n");
             string data;
@@ -236,32 +419,54 @@ static void handle_client(int client_sock)
                 data += l;
                 data.push_back('\n');
             }
+            fs_lock.lock();
             int rc = file_create(session, path.c_str(), data.c_str(), data.size());
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); else send_msg(client_sock, "OK\n");
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
             continue;
         }
 
         if (cmd == "FILE_READ" || cmd == "READ")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 2) { send_msg(client_sock, "ERR USAGE: READ <path>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: READ <path>\n"); continue; }
             string path = args[1];
-            char* buf = nullptr;
+
+            FileSegment* segs = nullptr;
+            int seg_count = 0;
             size_t size = 0;
-            int rc = file_read(session, path.c_str(), &buf, &size);
-            if (rc != 0) { send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
-            send_msg(client_sock, string("OK ") + to_string(size) + "\n");
-            if (buf && size > 0) send_msg(client_sock, string(buf, size) + "\n");
+            int rc = file_read_segments(session, path.c_str(), &segs, &seg_count, &size);
+            if (rc == 0)
+            {
+                // One copy straight from the container mapping; the
+                // segments are only valid while the lock is held.
+                reply.add(string("OK ") + to_string(size) + "\n");
+                reply.out.reserve(reply.out.size() + size + 1);
+                for (int i = 0; i < seg_count; ++i)
+                {
+                    reply.out.append(segs[i].data, segs[i].size);
+                }
+                if (size > 0) reply.add("\n");
+                delete[] segs;
+                continue;
+            }
+            if (rc != static_cast<int>(OFSErrorCodes::ERROR_NOT_IMPLEMENTED)) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+
+            char* buf = nullptr;
+            rc = file_read(session, path.c_str(), &buf, &size);
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add(string("OK ") + to_string(size) + "\n");
+            if (buf && size > 0) reply.add(string(buf, size) + "\n");
             free_buffer(buf);
             continue;
         }
 
         if (cmd == "FILE_EDIT" || cmd == "EDIT")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 3) { send_msg(client_sock, "ERR USAGE: EDIT <path> <index>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 3) { reply.add("ERR USAGE: EDIT <path> <index>\n"); continue; }
             string path = args[1];
-            unsigned int index = static_cast<unsigned int>(stoul(args[2]));
+            uint64_t index = 0;
+            if (!parse_num(args[2], index, UINT_MAX)) { reply.add("ERR INVALID_NUMBER\n"); continue; }
             send_msg(client_sock, "SEND_DATA <<<EOF>>> on its own line to finish\n");
             string data;
             while (true)
@@ -272,83 +477,251 @@ static void handle_client(int client_sock)
                 data += l;
                 data.push_back('\n');
             }
-            int rc = file_edit(session, path.c_str(), data.c_str(), data.size(), index);
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); else send_msg(client_sock, "OK\n");
+            fs_lock.lock();
+            int rc = file_edit(session, path.c_str(), data.c_str(), data.size(), static_cast<unsigned int>(index));
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
             continue;
         }
 
         if (cmd == "FILE_DELETE" || cmd == "DELETE")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 2) { send_msg(client_sock, "ERR USAGE: DELETE <path>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: DELETE <path>\n"); continue; }
             int rc = file_delete(session, args[1].c_str());
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); else send_msg(client_sock, "OK\n");
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
             continue;
         }
 
         if (cmd == "FILE_TRUNCATE" || cmd == "TRUNCATE")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 2) { send_msg(client_sock, "ERR USAGE: TRUNCATE <path>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: TRUNCATE <path>\n"); continue; }
             int rc = file_truncate(session, args[1].c_str());
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); else send_msg(client_sock, "OK\n");
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
             continue;
         }
 
         if (cmd == "FILE_EXISTS" || cmd == "EXISTS_FILE")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 2) { send_msg(client_sock, "ERR USAGE: FILE_EXISTS <path>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: FILE_EXISTS <path>\n"); continue; }
             int rc = file_exists(session, args[1].c_str());
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); else send_msg(client_sock, "OK\n");
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
             continue;
         }
 
         if (cmd == "FILE_RENAME" || cmd == "RENAME")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 3) { send_msg(client_sock, "ERR USAGE: RENAME <old> <new>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 3) { reply.add("ERR USAGE: RENAME <old> <new>\n"); continue; }
             int rc = file_rename(session, args[1].c_str(), args[2].c_str());
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); else send_msg(client_sock, "OK\n");
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
             continue;
         }
 
         if (cmd == "GET_METADATA")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 2) { send_msg(client_sock, "ERR USAGE: GET_METADATA <path>\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: GET_METADATA <path>\n"); continue; }
             FileMetadata m;
             int rc = get_metadata(session, args[1].c_str(), &m);
-            if (rc != 0) { send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
-            send_msg(client_sock, string("OK name=") + m.entry.name + " size=" + to_string(m.entry.size) + " owner=" + m.entry.owner + "\n");
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add(string("OK name=") + m.entry.name + " size=" + to_string(m.entry.size) + " owner=" + m.entry.owner + " inode=" + to_string(m.entry.inode) + " generation=" + to_string(m.entry.generation) + "\n");
             continue;
         }
 
         if (cmd == "SET_PERMISSIONS")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
-            if (args.size() < 3) { send_msg(client_sock, "ERR USAGE: SET_PERMISSIONS <path> <perm>\n"); continue; }
-            uint32_t perms = static_cast<uint32_t>(stoul(args[2]));
-            int rc = set_permissions(session, args[1].c_str(), perms);
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n"); else send_msg(client_sock, "OK\n");
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 3) { reply.add("ERR USAGE: SET_PERMISSIONS <path> <perm>\n"); continue; }
+            uint64_t perms = 0;
+            if (!parse_num(args[2], perms, UINT32_MAX)) { reply.add("ERR INVALID_NUMBER\n"); continue; }
+            int rc = set_permissions(session, args[1].c_str(), static_cast<uint32_t>(perms));
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
+            continue;
+        }
+
+        if (cmd == "SET_COMPRESSION" || cmd == "COMPRESS")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 3) { reply.add("ERR USAGE: COMPRESS <path> <on|off|inherit>\n"); continue; }
+            string mode = args[2];
+            for (char &c : mode) c = tolower((unsigned char)c);
+            uint32_t m = mode == "on" ? COMPRESS_LZ : mode == "off" ? COMPRESS_OFF : mode == "inherit" ? COMPRESS_NONE : UINT32_MAX;
+            if (m == UINT32_MAX) { reply.add("ERR USAGE: COMPRESS <path> <on|off|inherit>\n"); continue; }
+            int rc = set_compression(session, args[1].c_str(), m);
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
+            continue;
+        }
+
+        if (cmd == "FILE_VERSIONS" || cmd == "VERSIONS")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: VERSIONS <path>\n"); continue; }
+            FileVersion* versions = nullptr;
+            int cnt = 0;
+            int rc = file_versions(session, args[1].c_str(), &versions, &cnt);
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add(string("OK ") + to_string(cnt) + "\n");
+            for (int i = 0; i < cnt; ++i)
+            {
+                const FileVersion& v = versions[i];
+                const char* kind = (i == cnt - 1) ? "current" : (v.keyframe ? "keyframe" : "delta");
+                reply.add(to_string(v.version) + " " + to_string(v.size) + " " + to_string(v.time) + " "
+                    + (v.author[0] ? v.author : "-") + " " + kind + "\n");
+            }
+            delete[] versions;
+            continue;
+        }
+
+        if (cmd == "FILE_READ_VERSION" || cmd == "READ_VERSION")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 3) { reply.add("ERR USAGE: READ_VERSION <path> <version>\n"); continue; }
+            char* buf = nullptr;
+            size_t size = 0;
+            uint64_t version = 0;
+            if (!parse_num(args[2], version, UINT_MAX)) { reply.add("ERR INVALID_NUMBER\n"); continue; }
+            int rc = file_read_version(session, args[1].c_str(), static_cast<unsigned int>(version), &buf, &size);
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add(string("OK ") + to_string(size) + "\n");
+            if (buf && size > 0) reply.add(string(buf, size) + "\n");
+            free_buffer(buf);
+            continue;
+        }
+
+        if (cmd == "FILE_ROLLBACK" || cmd == "ROLLBACK")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 3) { reply.add("ERR USAGE: ROLLBACK <path> <version>\n"); continue; }
+            uint64_t version = 0;
+            if (!parse_num(args[2], version, UINT_MAX)) { reply.add("ERR INVALID_NUMBER\n"); continue; }
+            int rc = file_rollback(session, args[1].c_str(), static_cast<unsigned int>(version));
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
+            continue;
+        }
+
+        if (cmd == "FILE_OPEN" || cmd == "OPEN")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 3) { reply.add("ERR USAGE: OPEN <path> <r|w|rw>\n"); continue; }
+            uint32_t mode = 0;
+            for (char c : args[2])
+            {
+                if (c == 'r' || c == 'R') mode |= OPEN_READ;
+                else if (c == 'w' || c == 'W') mode |= OPEN_WRITE;
+                else mode = 0xFF;
+            }
+            uint64_t handle = 0;
+            int rc = file_open(session, args[1].c_str(), mode, &handle);
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK " + to_string(handle) + "\n");
+            continue;
+        }
+
+        if (cmd == "FILE_PREAD" || cmd == "PREAD")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 4) { reply.add("ERR USAGE: PREAD <handle> <offset> <length>\n"); continue; }
+            uint64_t handle = 0;
+            uint64_t offset = 0;
+            uint64_t length = 0;
+            if (!parse_num(args[1], handle) || !parse_num(args[2], offset) || !parse_num(args[3], length)) { reply.add("ERR INVALID_NUMBER\n"); continue; }
+            // Longer reads are cut short; the client asks again from offset + n.
+            string buf(min<uint64_t>(length, MAX_PREAD), '\0');
+            size_t n = 0;
+            int rc = file_pread(session, handle, &buf[0], buf.size(), offset, &n);
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add(string("OK ") + to_string(n) + "\n");
+            if (n > 0) reply.add(buf.substr(0, n) + "\n");
+            continue;
+        }
+
+        if (cmd == "FILE_PWRITE" || cmd == "PWRITE")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 3) { reply.add("ERR USAGE: PWRITE <handle> <offset>\n"); continue; }
+            uint64_t handle = 0;
+            uint64_t offset = 0;
+            if (!parse_num(args[1], handle) || !parse_num(args[2], offset)) { reply.add("ERR INVALID_NUMBER\n"); continue; }
+            send_msg(client_sock, "SEND_DATA <<<EOF>>> on its own line to finish\n");
+            string data;
+            while (true)
+            {
+                string l;
+                if (!recv_line(client_sock, l)) { break; }
+                if (l == "<<<EOF>>>") break;
+                data += l;
+                data.push_back('\n');
+            }
+            fs_lock.lock();
+            int rc = file_pwrite(session, handle, data.c_str(), data.size(), offset);
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
+            continue;
+        }
+
+        if (cmd == "FILE_CLOSE" || cmd == "CLOSE")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: CLOSE <handle>\n"); continue; }
+            uint64_t handle = 0;
+            if (!parse_num(args[1], handle)) { reply.add("ERR INVALID_NUMBER\n"); continue; }
+            int rc = file_close(session, handle);
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); else reply.add("OK\n");
+            continue;
+        }
+
+        if (cmd == "FIND_BY_OWNER" || cmd == "CHANGED_SINCE")
+        {
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
+            if (args.size() < 2) { reply.add("ERR USAGE: " + cmd + (cmd == "CHANGED_SINCE" ? " <time>" : " <owner>") + " [cursor] [limit]\n"); continue; }
+            uint64_t since = 0;
+            uint64_t cursor = 0;
+            uint64_t limit = 1000;
+            if ((cmd == "CHANGED_SINCE" && !parse_num(args[1], since)) || (args.size() > 2 && !parse_num(args[2], cursor))
+                || (args.size() > 3 && !parse_num(args[3], limit, INT_MAX))) { reply.add("ERR INVALID_NUMBER\n"); continue; }
+            char* paths = nullptr;
+            size_t size = 0;
+            int cnt = 0;
+            uint64_t next = 0;
+            int rc = cmd == "CHANGED_SINCE" ? changed_since(session, since, cursor, static_cast<int>(limit), &paths, &size, &cnt, &next)
+                                            : find_by_owner(session, args[1].c_str(), cursor, static_cast<int>(limit), &paths, &size, &cnt, &next);
+            if (rc != 0) { reply.add(string("ERR ") + rc_to_msg(rc) + "\n"); continue; }
+            reply.add("OK " + to_string(cnt) + " " + to_string(next) + "\n" + string(paths, size));
+            free_buffer(paths);
             continue;
         }
 
         if (cmd == "GET_STATS")
         {
-            if (!session) { send_msg(client_sock, "ERR NOT_LOGGED_IN\n"); continue; }
+            if (!session) { reply.add("ERR NOT_LOGGED_IN\n"); continue; }
             FSStats st;
+            LookupStats ls;
             int rc = get_stats(session, &st);
-            if (rc != 0) send_msg(client_sock, string("ERR ") + rc_to_msg(rc) + "\n");
-            else send_msg(client_sock, string("OK files=") + to_string(st.total_files) + " used=" + to_string(st.used_space) + " free=" + to_string(st.free_space) + "\n");
+            if (rc == 0) rc = get_lookup_stats(session, &ls);
+            if (rc != 0) reply.add(string("ERR ") + rc_to_msg(rc) + "\n");
+            else
+            {
+                char frag[32];
+                snprintf(frag, sizeof(frag), "%.2f", st.fragmentation);
+                reply.add(string("OK files=") + to_string(st.total_files) + " used=" + to_string(st.used_space) + " free=" + to_string(st.free_space)
+                    + " frag=" + frag + " extents=" + to_string(st.file_extents) + " free_runs=" + to_string(st.free_extents)
+                    + " defrag_moved=" + to_string(st.defrag_moved) + " logical=" + to_string(st.logical_bytes)
+                    + " physical=" + to_string(st.physical_bytes) + " dedup_hits=" + to_string(st.dedup_hits)
+                    + " compressed=" + to_string(st.compressed_files)
+                    + " corrupt=" + to_string(st.corrupt_blocks) + " scrubbed=" + to_string(st.scrubbed_blocks)
+                    + " scrub_passes=" + to_string(st.scrub_passes) + " lookups=" + to_string(ls.name_lookups)
+                    + " bloom_negatives=" + to_string(ls.bloom_negatives)
+                    + " bloom_false_positives=" + to_string(ls.bloom_false_positives) + "\n");
+            }
             continue;
         }
 
-        send_msg(client_sock, "ERR UNKNOWN_COMMAND\n");
+        reply.add("ERR UNKNOWN_COMMAND\n");
     }
 
     if (session)
     {
+        FSLock fs_lock;
         user_logout(session);
         session = nullptr;
     }
@@ -386,6 +759,8 @@ int main()
 
     cout << "OFS server listening on port " << PORT << endl;
 
+    thread(background_loop).detach();
+
     while (true)
     {
         int client = accept(server_fd, nullptr, nullptr);
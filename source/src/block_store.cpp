@@ -0,0 +1,621 @@
+#include "../include/block_store.hpp"
+#include "../include/checksum.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const uint8_t BLOCK_UNCHECKED = 0;
+static const uint8_t BLOCK_OK = 1;
+static const uint8_t BLOCK_BAD = 2;
+
+// Bytes readRange copies before checking them, small enough to stay in cache.
+static const uint64_t VERIFY_PIECE = 64 * 1024;
+
+BlockStore::BlockStore()
+    : fd_(-1), map_(nullptr), map_size_(0), file_size_(0), mmap_budget_(0), map_reserve_(0),
+      data_offset_(0), block_size_(0), total_blocks_(0), sums_offset_(0), corrupt_(0) {}
+
+BlockStore::~BlockStore()
+{
+    close();
+}
+
+OFSErrorCodes BlockStore::open(const string& path, uint64_t mmap_budget)
+{
+    close();
+
+    fd_ = ::open(path.c_str(), O_RDWR);
+    if (fd_ < 0)
+    {
+        return OFSErrorCodes::ERROR_NOT_FOUND;
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0)
+    {
+        close();
+        return OFSErrorCodes::ERROR_IO_ERROR;
+    }
+
+    file_size_ = static_cast<uint64_t>(st.st_size);
+    mmap_budget_ = mmap_budget;
+    return mapContainer();
+}
+
+OFSErrorCodes BlockStore::setLayout(uint64_t data_offset, uint32_t block_size, unsigned int total_blocks,
+                                    unsigned int max_blocks)
+{
+    if (fd_ < 0 || block_size == 0)
+    {
+        return OFSErrorCodes::ERROR_INVALID_CONFIG;
+    }
+
+    data_offset_ = data_offset;
+    block_size_ = block_size;
+    total_blocks_ = total_blocks;
+
+    // Older containers may be shorter than their layout; extend them and
+    // remap so the data region is addressable in place.
+    uint64_t needed = data_offset + static_cast<uint64_t>(total_blocks) * block_size;
+    uint64_t reserve = data_offset + static_cast<uint64_t>(max(total_blocks, max_blocks)) * block_size;
+    if (needed > file_size_ || reserve != map_reserve_)
+    {
+        unmapContainer();
+        if (needed > file_size_ && ftruncate(fd_, static_cast<off_t>(needed)) != 0)
+        {
+            return OFSErrorCodes::ERROR_IO_ERROR;
+        }
+        file_size_ = max(file_size_, needed);
+        map_reserve_ = reserve;
+        return mapContainer();
+    }
+    return OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes BlockStore::grow(unsigned int total_blocks)
+{
+    if (fd_ < 0 || total_blocks <= total_blocks_)
+    {
+        return OFSErrorCodes::ERROR_INVALID_OPERATION;
+    }
+
+    uint64_t needed = data_offset_ + static_cast<uint64_t>(total_blocks) * block_size_;
+    if (map_ && needed > map_size_)
+    {
+        return OFSErrorCodes::ERROR_NO_SPACE;
+    }
+    if (needed > file_size_)
+    {
+        // Reserve real disk space up front; fall back to a sparse extension
+        // where the file system cannot preallocate.
+        int rc = posix_fallocate(fd_, static_cast<off_t>(file_size_), static_cast<off_t>(needed - file_size_));
+        if (rc != 0 && ftruncate(fd_, static_cast<off_t>(needed)) != 0)
+        {
+            return OFSErrorCodes::ERROR_IO_ERROR;
+        }
+        file_size_ = needed;
+    }
+
+    unsigned int old = total_blocks_;
+    total_blocks_ = total_blocks;
+    if (sums_.empty())
+    {
+        return OFSErrorCodes::SUCCESS;
+    }
+
+    // New blocks read as zeros.
+    vector<char> zero(block_size_, 0);
+    sums_.resize(total_blocks, crc32c(zero.data(), zero.size()));
+    checked_.resize(total_blocks, BLOCK_OK);
+    return writeAt(sums_offset_ + static_cast<uint64_t>(old) * sizeof(uint32_t), &sums_[old],
+                   static_cast<size_t>(total_blocks - old) * sizeof(uint32_t));
+}
+
+OFSErrorCodes BlockStore::mapContainer()
+{
+    // A growable container maps its largest size up front; the part past
+    // the end of the file is never touched until grow() extends the file.
+    uint64_t size = max(file_size_, map_reserve_);
+    if (file_size_ == 0 || size > mmap_budget_)
+    {
+        return OFSErrorCodes::SUCCESS;
+    }
+
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED)
+    {
+        // Not fatal: pread/pwrite still work.
+        return OFSErrorCodes::SUCCESS;
+    }
+    map_ = static_cast<char*>(p);
+    map_size_ = size;
+    return OFSErrorCodes::SUCCESS;
+}
+
+void BlockStore::unmapContainer()
+{
+    if (map_)
+    {
+        msync(map_, min(map_size_, file_size_), MS_SYNC);
+        munmap(map_, map_size_);
+        map_ = nullptr;
+        map_size_ = 0;
+    }
+}
+
+void BlockStore::close()
+{
+    sums_.clear();
+    checked_.clear();
+    sums_offset_ = 0;
+    corrupt_ = 0;
+    unmapContainer();
+    map_reserve_ = 0;
+    if (fd_ >= 0)
+    {
+        fdatasync(fd_);
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool BlockStore::isOpen() const
+{
+    return fd_ >= 0;
+}
+
+bool BlockStore::isMapped() const
+{
+    return map_ != nullptr;
+}
+
+uint32_t BlockStore::blockSize() const
+{
+    return block_size_;
+}
+
+unsigned int BlockStore::totalBlocks() const
+{
+    return total_blocks_;
+}
+
+uint64_t BlockStore::blockOffset(unsigned int block) const
+{
+    return data_offset_ + static_cast<uint64_t>(block) * block_size_;
+}
+
+char* BlockStore::mappedAt(uint64_t offset) const
+{
+    if (!map_ || offset >= min(map_size_, file_size_))
+    {
+        return nullptr;
+    }
+    return map_ + offset;
+}
+
+OFSErrorCodes BlockStore::readAt(uint64_t offset, void* out, size_t size) const
+{
+    if (fd_ < 0 || offset + size > file_size_)
+    {
+        return OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    if (map_)
+    {
+        memcpy(out, map_ + offset, size);
+        return OFSErrorCodes::SUCCESS;
+    }
+
+    char* dst = static_cast<char*>(out);
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pread(fd_, dst + done, size - done, static_cast<off_t>(offset + done));
+        if (n <= 0)
+        {
+            return OFSErrorCodes::ERROR_IO_ERROR;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes BlockStore::writeAt(uint64_t offset, const void* data, size_t size)
+{
+    if (fd_ < 0 || offset + size > file_size_)
+    {
+        return OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    if (map_)
+    {
+        memcpy(map_ + offset, data, size);
+        return OFSErrorCodes::SUCCESS;
+    }
+
+    const char* src = static_cast<const char*>(data);
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pwrite(fd_, src + done, size - done, static_cast<off_t>(offset + done));
+        if (n <= 0)
+        {
+            return OFSErrorCodes::ERROR_IO_ERROR;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return OFSErrorCodes::SUCCESS;
+}
+
+const char* BlockStore::blockData(unsigned int block) const
+{
+    if (block >= total_blocks_)
+    {
+        return nullptr;
+    }
+    return mappedAt(blockOffset(block));
+}
+
+OFSErrorCodes BlockStore::readBlock(unsigned int block, char* out) const
+{
+    if (block >= total_blocks_)
+    {
+        return OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    OFSErrorCodes rc = readAt(blockOffset(block), out, block_size_);
+    if (rc != OFSErrorCodes::SUCCESS || sums_.empty() || checked_[block] == BLOCK_OK)
+    {
+        return rc;
+    }
+    bool ok = crc32c(out, block_size_) == sums_[block];
+    setChecked(block, ok ? BLOCK_OK : BLOCK_BAD);
+    return ok ? OFSErrorCodes::SUCCESS : OFSErrorCodes::ERROR_IO_ERROR;
+}
+
+OFSErrorCodes BlockStore::writeBlock(unsigned int block, const char* data, size_t len)
+{
+    if (block >= total_blocks_ || len > block_size_)
+    {
+        return OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    OFSErrorCodes rc = writeAt(blockOffset(block), data, len);
+    if (rc == OFSErrorCodes::SUCCESS && len < block_size_)
+    {
+        vector<char> zeros(block_size_ - len, 0);
+        rc = writeAt(blockOffset(block) + len, zeros.data(), zeros.size());
+    }
+    if (rc != OFSErrorCodes::SUCCESS)
+    {
+        return rc;
+    }
+    return updateSums(blockOffset(block), block_size_, len == block_size_ ? data : nullptr);
+}
+
+bool BlockStore::locate(const vector<Extent>& extents, uint64_t pos, uint64_t& phys, uint64_t& run) const
+{
+    uint64_t block = pos / block_size_;
+    for (const Extent& e : extents)
+    {
+        if (block < e.length)
+        {
+            if (static_cast<uint64_t>(e.start) + e.length > total_blocks_)
+            {
+                return false;
+            }
+            uint64_t in_run = block * block_size_ + pos % block_size_;
+            phys = blockOffset(e.start) + in_run;
+            run = static_cast<uint64_t>(e.length) * block_size_ - in_run;
+            return true;
+        }
+        block -= e.length;
+    }
+    return false;
+}
+
+OFSErrorCodes BlockStore::readRange(const vector<Extent>& extents, uint64_t offset, char* out, size_t size) const
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        uint64_t phys, run;
+        if (!locate(extents, offset + done, phys, run))
+        {
+            return OFSErrorCodes::ERROR_IO_ERROR;
+        }
+        size_t chunk = static_cast<size_t>(min<uint64_t>(size - done, run));
+
+        OFSErrorCodes rc = readVerified(phys, out + done, chunk);
+        if (rc != OFSErrorCodes::SUCCESS)
+        {
+            return rc;
+        }
+        done += chunk;
+    }
+    return OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes BlockStore::writeRange(const vector<Extent>& extents, uint64_t offset, const char* data, size_t size)
+{
+    vector<char> zeros;
+    if (!data)
+    {
+        zeros.assign(min<size_t>(size, block_size_), 0);
+    }
+
+    size_t done = 0;
+    while (done < size)
+    {
+        uint64_t phys, run;
+        if (!locate(extents, offset + done, phys, run))
+        {
+            return OFSErrorCodes::ERROR_IO_ERROR;
+        }
+        size_t chunk = static_cast<size_t>(min<uint64_t>(size - done, run));
+        if (!data)
+        {
+            chunk = min(chunk, zeros.size());
+        }
+
+        OFSErrorCodes rc = writeAt(phys, data ? data + done : zeros.data(), chunk);
+        if (rc == OFSErrorCodes::SUCCESS)
+        {
+            rc = updateSums(phys, chunk, data ? data + done : nullptr);
+        }
+        if (rc != OFSErrorCodes::SUCCESS)
+        {
+            return rc;
+        }
+        done += chunk;
+    }
+    return OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes BlockStore::zeroRange(const vector<Extent>& extents, uint64_t offset, size_t size)
+{
+    return writeRange(extents, offset, nullptr, size);
+}
+
+OFSErrorCodes BlockStore::enableChecksums(uint64_t table_offset)
+{
+    if (fd_ < 0 || total_blocks_ == 0)
+    {
+        return OFSErrorCodes::ERROR_INVALID_CONFIG;
+    }
+
+    vector<uint32_t> sums(total_blocks_);
+    OFSErrorCodes rc = readAt(table_offset, sums.data(), sums.size() * sizeof(uint32_t));
+    if (rc != OFSErrorCodes::SUCCESS)
+    {
+        return rc;
+    }
+    sums_.swap(sums);
+    sums_offset_ = table_offset;
+    checked_.assign(total_blocks_, BLOCK_UNCHECKED);
+    corrupt_ = 0;
+    return OFSErrorCodes::SUCCESS;
+}
+
+bool BlockStore::checksumsEnabled() const
+{
+    return !sums_.empty();
+}
+
+uint64_t BlockStore::corruptBlocks() const
+{
+    return corrupt_;
+}
+
+void BlockStore::setChecked(unsigned int block, uint8_t state) const
+{
+    if (checked_[block] == BLOCK_BAD && state != BLOCK_BAD)
+    {
+        corrupt_--;
+    }
+    else if (checked_[block] != BLOCK_BAD && state == BLOCK_BAD)
+    {
+        corrupt_++;
+    }
+    checked_[block] = state;
+}
+
+uint32_t BlockStore::blockSum(unsigned int block, vector<char>& scratch) const
+{
+    const char* p = blockData(block);
+    if (!p)
+    {
+        scratch.resize(block_size_);
+        if (readAt(blockOffset(block), scratch.data(), block_size_) != OFSErrorCodes::SUCCESS)
+        {
+            // Cannot match: an unreadable block counts as corrupt.
+            return ~sums_[block];
+        }
+        p = scratch.data();
+    }
+    return crc32c(p, block_size_);
+}
+
+bool BlockStore::verifySpan(uint64_t phys, size_t size) const
+{
+    if (sums_.empty() || size == 0)
+    {
+        return true;
+    }
+
+    unsigned int first = static_cast<unsigned int>((phys - data_offset_) / block_size_);
+    unsigned int last = static_cast<unsigned int>((phys + size - 1 - data_offset_) / block_size_);
+    vector<char> scratch;
+    for (unsigned int b = first; b <= last; ++b)
+    {
+        if (checked_[b] == BLOCK_OK)
+        {
+            continue;
+        }
+        bool ok = blockSum(b, scratch) == sums_[b];
+        setChecked(b, ok ? BLOCK_OK : BLOCK_BAD);
+        if (!ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+OFSErrorCodes BlockStore::readVerified(uint64_t phys, char* out, size_t size) const
+{
+    if (sums_.empty())
+    {
+        return readAt(phys, out, size);
+    }
+
+    // Copy a piece at a time and check whole blocks on the copy while it is
+    // still in cache, so verifying does not read the source a second time.
+    uint64_t end = phys + size;
+    vector<char> scratch;
+    while (phys < end)
+    {
+        uint64_t piece_end = min<uint64_t>(end, phys + VERIFY_PIECE);
+        if (piece_end < end)
+        {
+            piece_end -= (piece_end - data_offset_) % block_size_;
+        }
+        if (piece_end <= phys)
+        {
+            piece_end = end;
+        }
+
+        OFSErrorCodes rc = readAt(phys, out, piece_end - phys);
+        if (rc != OFSErrorCodes::SUCCESS)
+        {
+            return rc;
+        }
+
+        unsigned int first = static_cast<unsigned int>((phys - data_offset_) / block_size_);
+        unsigned int last = static_cast<unsigned int>((piece_end - 1 - data_offset_) / block_size_);
+        for (unsigned int b = first; b <= last; ++b)
+        {
+            if (checked_[b] == BLOCK_OK)
+            {
+                continue;
+            }
+            uint64_t at = blockOffset(b);
+            bool whole = at >= phys && at + block_size_ <= piece_end;
+            uint32_t sum = whole ? crc32c(out + (at - phys), block_size_) : blockSum(b, scratch);
+            setChecked(b, sum == sums_[b] ? BLOCK_OK : BLOCK_BAD);
+            if (sum != sums_[b])
+            {
+                return OFSErrorCodes::ERROR_IO_ERROR;
+            }
+        }
+        out += piece_end - phys;
+        phys = piece_end;
+    }
+    return OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes BlockStore::updateSums(uint64_t phys, size_t size, const char* data)
+{
+    if (sums_.empty() || size == 0)
+    {
+        return OFSErrorCodes::SUCCESS;
+    }
+
+    // Blocks the write covers whole are summed from the caller's buffer;
+    // partly written ones are summed from the container.
+    unsigned int first = static_cast<unsigned int>((phys - data_offset_) / block_size_);
+    unsigned int last = static_cast<unsigned int>((phys + size - 1 - data_offset_) / block_size_);
+    vector<char> scratch;
+    for (unsigned int b = first; b <= last; ++b)
+    {
+        uint64_t at = blockOffset(b);
+        if (data && at >= phys && at + block_size_ <= phys + size)
+        {
+            sums_[b] = crc32c(data + (at - phys), block_size_);
+        }
+        else
+        {
+            sums_[b] = blockSum(b, scratch);
+        }
+        setChecked(b, BLOCK_OK);
+    }
+    return writeAt(sums_offset_ + static_cast<uint64_t>(first) * sizeof(uint32_t), &sums_[first],
+                   static_cast<size_t>(last - first + 1) * sizeof(uint32_t));
+}
+
+bool BlockStore::verifyBlock(unsigned int block) const
+{
+    if (sums_.empty())
+    {
+        return true;
+    }
+    return block < total_blocks_ && verifySpan(blockOffset(block), block_size_);
+}
+
+bool BlockStore::verifyRange(const vector<Extent>& extents, uint64_t offset, size_t size) const
+{
+    size_t done = 0;
+    while (done < size && !sums_.empty())
+    {
+        uint64_t phys, run;
+        if (!locate(extents, offset + done, phys, run))
+        {
+            return false;
+        }
+        size_t chunk = static_cast<size_t>(min<uint64_t>(size - done, run));
+        if (!verifySpan(phys, chunk))
+        {
+            return false;
+        }
+        done += chunk;
+    }
+    return true;
+}
+
+bool BlockStore::scrubBlock(unsigned int block)
+{
+    if (sums_.empty() || block >= total_blocks_)
+    {
+        return true;
+    }
+    if (checked_[block] == BLOCK_OK)
+    {
+        checked_[block] = BLOCK_UNCHECKED;
+    }
+    return verifySpan(blockOffset(block), block_size_);
+}
+
+OFSErrorCodes BlockStore::flush()
+{
+    if (fd_ < 0)
+    {
+        return OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    if (map_ && msync(map_, min(map_size_, file_size_), MS_SYNC) != 0)
+    {
+        return OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    return fdatasync(fd_) == 0 ? OFSErrorCodes::SUCCESS : OFSErrorCodes::ERROR_IO_ERROR;
+}
+
+OFSErrorCodes BlockStore::flushRange(uint64_t offset, size_t size)
+{
+    if (fd_ < 0)
+    {
+        return OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    if (!map_)
+    {
+        return fdatasync(fd_) == 0 ? OFSErrorCodes::SUCCESS : OFSErrorCodes::ERROR_IO_ERROR;
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset / page * page;
+    uint64_t end = min<uint64_t>(offset + size, min(map_size_, file_size_));
+    if (start >= end)
+    {
+        return OFSErrorCodes::SUCCESS;
+    }
+    return msync(map_ + start, end - start, MS_SYNC) == 0 ? OFSErrorCodes::SUCCESS : OFSErrorCodes::ERROR_IO_ERROR;
+}
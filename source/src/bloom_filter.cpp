@@ -0,0 +1,93 @@
+#include "../include/bloom_filter.hpp"
+
+using namespace std;
+
+static const size_t WORDS_PER_BLOCK = 8;        // 64 bytes, 128 counters
+static const int PROBES = 4;
+static const uint64_t COUNTER_MAX = 15;
+
+// The 32-bit hash spread over 64 bits: the low bits pick the block, the
+// top 28 bits the four counters inside it.
+static uint64_t mix(uint32_t hash)
+{
+    uint64_t x = hash + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+BloomFilter::BloomFilter()
+{
+    reset(0);
+}
+
+void BloomFilter::reset(size_t keys)
+{
+    // About 8 counters (4 bytes) per key.
+    size_t blocks = 1;
+    while (blocks * 128 < keys * 8)
+    {
+        blocks *= 2;
+    }
+    words_.assign(blocks * WORDS_PER_BLOCK, 0);
+    block_mask_ = blocks - 1;
+}
+
+void BloomFilter::counter(uint64_t mixed, int i, size_t& word, unsigned& shift) const
+{
+    unsigned pos = static_cast<unsigned>(mixed >> (36 + 7 * i)) & 127;
+    word = (mixed & block_mask_) * WORDS_PER_BLOCK + pos / 16;
+    shift = (pos % 16) * 4;
+}
+
+void BloomFilter::add(uint32_t hash)
+{
+    uint64_t mixed = mix(hash);
+    for (int i = 0; i < PROBES; ++i)
+    {
+        size_t w;
+        unsigned shift;
+        counter(mixed, i, w, shift);
+        if (((words_[w] >> shift) & COUNTER_MAX) != COUNTER_MAX)
+        {
+            words_[w] += 1ULL << shift;
+        }
+    }
+}
+
+void BloomFilter::remove(uint32_t hash)
+{
+    uint64_t mixed = mix(hash);
+    for (int i = 0; i < PROBES; ++i)
+    {
+        size_t w;
+        unsigned shift;
+        counter(mixed, i, w, shift);
+        uint64_t c = (words_[w] >> shift) & COUNTER_MAX;
+        if (c != 0 && c != COUNTER_MAX)
+        {
+            words_[w] -= 1ULL << shift;
+        }
+    }
+}
+
+bool BloomFilter::mayContain(uint32_t hash) const
+{
+    uint64_t mixed = mix(hash);
+    for (int i = 0; i < PROBES; ++i)
+    {
+        size_t w;
+        unsigned shift;
+        counter(mixed, i, w, shift);
+        if (((words_[w] >> shift) & COUNTER_MAX) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t BloomFilter::memoryUsage() const
+{
+    return words_.capacity() * sizeof(uint64_t);
+}
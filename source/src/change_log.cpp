@@ -0,0 +1,340 @@
+#include "../include/change_log.hpp"
+#include "../include/checksum.hpp"
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <thread>
+
+using namespace std;
+
+static const char LOG_MAGIC[8] = {'O', 'M', 'N', 'I', 'L', 'O', 'G', '1'};
+static const uint32_t RECORD_MAGIC = 0x4F4C5247;
+
+struct LogRegionHeader
+{
+    char magic[8];
+    uint32_t epoch;
+    uint32_t reserved;
+    uint64_t base_lsn;
+    uint8_t pad[40];
+};  // 64 bytes
+
+struct LogRecordHeader
+{
+    uint32_t magic;
+    uint32_t epoch;
+    uint64_t lsn;
+    uint64_t time;
+    uint32_t op;
+    uint32_t length;
+    uint32_t checksum;
+    uint32_t reserved;
+};  // 40 bytes
+
+static uint64_t align8(uint64_t v)
+{
+    return (v + 7) & ~7ULL;
+}
+
+static uint32_t record_checksum(const LogRecordHeader& h, const char* payload, size_t len)
+{
+    uint32_t c = fnv1a32(&h.lsn, sizeof(h.lsn));
+    c = fnv1a32(&h.time, sizeof(h.time), c);
+    c = fnv1a32(&h.op, sizeof(h.op), c);
+    return fnv1a32(payload, len, c);
+}
+
+// ---------------------------------------------------------------------------
+// LogRecord
+// ---------------------------------------------------------------------------
+
+LogRecord::LogRecord(LogOp op, const SessionInfo* actor)
+    : op_(op), time_(static_cast<uint64_t>(::time(nullptr))), payload_(), pos_(0)
+{
+    putString(actor ? actor->user.username : "");
+    putU32(actor ? static_cast<uint32_t>(actor->user.role) : 0);
+}
+
+LogRecord::LogRecord(LogOp op, uint64_t time, string payload)
+    : op_(op), time_(time), payload_(std::move(payload)), pos_(0) {}
+
+void LogRecord::putU32(uint32_t v)
+{
+    payload_.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void LogRecord::putU64(uint64_t v)
+{
+    payload_.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void LogRecord::putString(const string& s)
+{
+    putBytes(s.data(), s.size());
+}
+
+void LogRecord::putBytes(const char* data, size_t size)
+{
+    putU64(size);
+    payload_.append(data, size);
+}
+
+bool LogRecord::getU32(uint32_t& v)
+{
+    if (pos_ + sizeof(v) > payload_.size()) return false;
+    memcpy(&v, payload_.data() + pos_, sizeof(v));
+    pos_ += sizeof(v);
+    return true;
+}
+
+bool LogRecord::getU64(uint64_t& v)
+{
+    if (pos_ + sizeof(v) > payload_.size()) return false;
+    memcpy(&v, payload_.data() + pos_, sizeof(v));
+    pos_ += sizeof(v);
+    return true;
+}
+
+bool LogRecord::getString(string& s)
+{
+    uint64_t n = 0;
+    if (!getU64(n) || pos_ + n > payload_.size()) return false;
+    s.assign(payload_.data() + pos_, n);
+    pos_ += n;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// ChangeLog
+// ---------------------------------------------------------------------------
+
+ChangeLog::ChangeLog()
+    : store_(nullptr), offset_(0), size_(0), window_us_(0), epoch_(0), next_lsn_(1),
+      tail_(sizeof(LogRegionHeader)), synced_tail_(sizeof(LogRegionHeader)), durable_lsn_(0), flushing_(false),
+      committers_(0) {}
+
+OFSErrorCodes ChangeLog::open(BlockStore* store, uint64_t offset, uint64_t size, uint32_t commit_window_us)
+{
+    if (!store || size <= sizeof(LogRegionHeader) + sizeof(LogRecordHeader))
+    {
+        return OFSErrorCodes::ERROR_INVALID_CONFIG;
+    }
+
+    store_ = store;
+    offset_ = offset;
+    size_ = size;
+    window_us_ = commit_window_us;
+
+    LogRegionHeader h;
+    if (store_->readAt(offset_, &h, sizeof(h)) != OFSErrorCodes::SUCCESS)
+    {
+        store_ = nullptr;
+        return OFSErrorCodes::ERROR_IO_ERROR;
+    }
+
+    if (memcmp(h.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0)
+    {
+        epoch_ = 1;
+        next_lsn_ = 1;
+        OFSErrorCodes rc = writeRegionHeader();
+        if (rc != OFSErrorCodes::SUCCESS)
+        {
+            store_ = nullptr;
+            return rc;
+        }
+    }
+    else
+    {
+        epoch_ = h.epoch;
+    }
+
+    // Position the tail after the last valid record.
+    replay(nullptr);
+    synced_tail_ = tail_;
+    durable_lsn_ = next_lsn_ - 1;
+    return OFSErrorCodes::SUCCESS;
+}
+
+bool ChangeLog::isOpen() const
+{
+    return store_ != nullptr;
+}
+
+OFSErrorCodes ChangeLog::writeRegionHeader()
+{
+    LogRegionHeader h = {};
+    memcpy(h.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+    h.epoch = epoch_;
+    h.base_lsn = next_lsn_;
+
+    OFSErrorCodes rc = store_->writeAt(offset_, &h, sizeof(h));
+    if (rc != OFSErrorCodes::SUCCESS)
+    {
+        return rc;
+    }
+    return store_->flushRange(offset_, sizeof(h));
+}
+
+size_t ChangeLog::replay(const function<void(LogRecord&)>& fn, uint64_t after_lsn)
+{
+    lock_guard<mutex> lk(mu_);
+    if (!store_) return 0;
+
+    LogRegionHeader rh;
+    if (store_->readAt(offset_, &rh, sizeof(rh)) != OFSErrorCodes::SUCCESS)
+    {
+        return 0;
+    }
+
+    uint64_t pos = sizeof(LogRegionHeader);
+    uint64_t lsn = rh.base_lsn;
+    size_t applied = 0;
+    string payload;
+
+    while (pos + sizeof(LogRecordHeader) <= size_)
+    {
+        LogRecordHeader h;
+        if (store_->readAt(offset_ + pos, &h, sizeof(h)) != OFSErrorCodes::SUCCESS)
+            break;
+        if (h.magic != RECORD_MAGIC || h.epoch != epoch_ || h.lsn != lsn)
+            break;
+        if (pos + sizeof(h) + h.length > size_)
+            break;
+
+        payload.resize(h.length);
+        if (h.length > 0 && store_->readAt(offset_ + pos + sizeof(h), &payload[0], h.length) != OFSErrorCodes::SUCCESS)
+            break;
+        if (record_checksum(h, payload.data(), payload.size()) != h.checksum)
+            break;
+
+        if (fn && h.lsn > after_lsn)
+        {
+            LogRecord rec(static_cast<LogOp>(h.op), h.time, payload);
+            fn(rec);
+            ++applied;
+        }
+        ++lsn;
+        pos += align8(sizeof(h) + h.length);
+    }
+
+    tail_ = pos;
+    next_lsn_ = lsn;
+    return applied;
+}
+
+uint64_t ChangeLog::append(const LogRecord& rec)
+{
+    lock_guard<mutex> lk(mu_);
+    if (!store_) return 0;
+
+    const string& payload = rec.payload();
+    uint64_t total = align8(sizeof(LogRecordHeader) + payload.size());
+    if (tail_ + total > size_)
+    {
+        return 0;
+    }
+
+    LogRecordHeader h = {};
+    h.magic = RECORD_MAGIC;
+    h.epoch = epoch_;
+    h.lsn = next_lsn_;
+    h.time = rec.time();
+    h.op = static_cast<uint32_t>(rec.op());
+    h.length = static_cast<uint32_t>(payload.size());
+    h.checksum = record_checksum(h, payload.data(), payload.size());
+
+    if (store_->writeAt(offset_ + tail_, &h, sizeof(h)) != OFSErrorCodes::SUCCESS)
+        return 0;
+    if (!payload.empty() && store_->writeAt(offset_ + tail_ + sizeof(h), payload.data(), payload.size()) != OFSErrorCodes::SUCCESS)
+        return 0;
+
+    tail_ += total;
+    return next_lsn_++;
+}
+
+OFSErrorCodes ChangeLog::commit(uint64_t lsn)
+{
+    if (lsn == 0)
+    {
+        return OFSErrorCodes::ERROR_NO_SPACE;
+    }
+
+    unique_lock<mutex> lk(mu_);
+    ++committers_;
+    OFSErrorCodes rc = OFSErrorCodes::SUCCESS;
+    while (durable_lsn_ < lsn)
+    {
+        if (flushing_)
+        {
+            cv_.wait(lk);
+            continue;
+        }
+
+        // Become the leader for this group. When other clients are
+        // committing too, give them the commit window to append; a lone
+        // committer flushes straight away.
+        flushing_ = true;
+        if (window_us_ > 0 && committers_ > 1)
+        {
+            lk.unlock();
+            this_thread::sleep_for(chrono::microseconds(window_us_));
+            lk.lock();
+        }
+
+        uint32_t epoch = epoch_;
+        uint64_t target = next_lsn_ - 1;
+        uint64_t from = synced_tail_;
+        uint64_t to = tail_;
+        lk.unlock();
+        rc = store_->flushRange(offset_ + from, to - from);
+        lk.lock();
+
+        // A reset() meanwhile has made everything durable already.
+        flushing_ = false;
+        if (rc == OFSErrorCodes::SUCCESS && epoch == epoch_)
+        {
+            durable_lsn_ = target;
+            synced_tail_ = to;
+        }
+        cv_.notify_all();
+        if (rc != OFSErrorCodes::SUCCESS)
+        {
+            break;
+        }
+    }
+    --committers_;
+    return rc;
+}
+
+OFSErrorCodes ChangeLog::reset()
+{
+    lock_guard<mutex> lk(mu_);
+    if (!store_) return OFSErrorCodes::ERROR_INVALID_OPERATION;
+
+    ++epoch_;
+    OFSErrorCodes rc = writeRegionHeader();
+    if (rc == OFSErrorCodes::SUCCESS)
+    {
+        tail_ = sizeof(LogRegionHeader);
+        synced_tail_ = tail_;
+        durable_lsn_ = next_lsn_ - 1;
+    }
+    return rc;
+}
+
+uint64_t ChangeLog::usedBytes() const
+{
+    lock_guard<mutex> lk(mu_);
+    return tail_;
+}
+
+uint64_t ChangeLog::capacity() const
+{
+    return size_;
+}
+
+uint64_t ChangeLog::lastLsn() const
+{
+    lock_guard<mutex> lk(mu_);
+    return next_lsn_ - 1;
+}
@@ -0,0 +1,408 @@
+#include "../include/checkpoint.hpp"
+#include "../include/fs_core.hpp"
+#include "../include/checksum.hpp"
+#include "../include/defrag.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+using namespace std;
+
+static const char CKPT_MAGIC[8] = {'O', 'M', 'N', 'I', 'C', 'K', 'P', '1'};
+static const uint32_t CKPT_VERSION = 8;
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t checksum;      // crc32c over everything after this header
+    uint64_t entries;
+    uint64_t lsn;
+    uint64_t generation;    // InodeTable::generation()
+};  // 40 bytes
+
+template <typename T>
+static void put(string& out, T v)
+{
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+static void put_str(string& out, string_view s)
+{
+    put(out, static_cast<uint16_t>(s.size()));
+    out.append(s.data(), s.size());
+}
+
+template <typename T>
+static bool get(const char*& p, const char* end, T& v)
+{
+    if (static_cast<size_t>(end - p) < sizeof(v)) return false;
+    memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    return true;
+}
+
+static bool get_str(const char*& p, const char* end, char* dst, size_t cap)
+{
+    uint16_t n = 0;
+    if (!get(p, end, n) || static_cast<size_t>(end - p) < n) return false;
+    size_t keep = n < cap - 1 ? n : cap - 1;
+    memcpy(dst, p, keep);
+    dst[keep] = '\0';
+    p += n;
+    return true;
+}
+
+static void serialize(const FileSystemInstance* fs, uint64_t lsn, string& out)
+{
+    const InodeTable& inodes = fs->inodes;
+    out.assign(sizeof(CheckpointHeader), '\0');
+    out.reserve(sizeof(CheckpointHeader) + inodes.size() * 96);
+
+    // Each inode under its slot, with its parent slot and leaf name; the
+    // tree is linked up again from those.
+    for (uint32_t s = 0; s < inodes.slots(); ++s)
+    {
+        if (!inodes.used(s))
+            continue;
+        const Inode& i = inodes[s];
+        const InodeData& d = inodes.data(s);
+        const vector<FileVersion>& history = inodes.history(s);
+        const vector<uint32_t>& chunks = inodes.chunks(s);
+        put(out, s);
+        put(out, i.parent);
+        put_str(out, inodes.name(s));
+        put_str(out, inodes.ownerName(i.owner));
+        put(out, i.type);
+        put(out, i.permissions);
+        put(out, i.size);
+        put(out, i.ctime);
+        put(out, i.mtime);
+        put(out, i.generation);
+        put(out, static_cast<uint32_t>(d.extents.size()));
+        out.append(reinterpret_cast<const char*>(d.extents.data()), d.extents.size() * sizeof(Extent));
+        put(out, d.version);
+        put_str(out, inodes.ownerName(d.author));
+        put(out, static_cast<uint32_t>(history.size()));
+        out.append(reinterpret_cast<const char*>(history.data()), history.size() * sizeof(FileVersion));
+        put(out, i.compression);
+        put(out, static_cast<uint32_t>(chunks.size()));
+        out.append(reinterpret_cast<const char*>(chunks.data()), chunks.size() * sizeof(uint32_t));
+    }
+
+    // Dedup fingerprints follow the entries. Shared blocks need no record of
+    // their own: they show up in several extent lists and markUsed() turns
+    // the repeats back into references.
+    put(out, static_cast<uint64_t>(fs->dedup.entries().size()));
+    for (const auto& d : fs->dedup.entries())
+    {
+        put(out, d.first);
+        put(out, static_cast<uint32_t>(d.second));
+    }
+
+    CheckpointHeader h = {};
+    memcpy(h.magic, CKPT_MAGIC, sizeof(CKPT_MAGIC));
+    h.version = CKPT_VERSION;
+    h.entries = fs->inodes.size();
+    h.lsn = lsn;
+    h.generation = fs->inodes.generation();
+    h.checksum = crc32c(out.data() + sizeof(h), out.size() - sizeof(h));
+    memcpy(&out[0], &h, sizeof(h));
+}
+
+static int deserialize(FileSystemInstance* fs, const string& in, uint64_t* lsn)
+{
+    if (in.size() < sizeof(CheckpointHeader))
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+    CheckpointHeader h;
+    memcpy(&h, in.data(), sizeof(h));
+    if (memcmp(h.magic, CKPT_MAGIC, sizeof(CKPT_MAGIC)) != 0 || h.version != CKPT_VERSION)
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    if (crc32c(in.data() + sizeof(h), in.size() - sizeof(h)) != h.checksum)
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+    const char* p = in.data() + sizeof(h);
+    const char* end = in.data() + in.size();
+
+    InodeTable& inodes = fs->inodes;
+    inodes.clear();
+    fs->tree.clear();
+    fs->meta.clear();
+    fs->quotas.clear();
+    for (uint64_t n = 0; n < h.entries; ++n)
+    {
+        uint32_t s = 0, parent = 0, nextents = 0;
+        char name[sizeof(FileEntry::name)];
+        char owner[sizeof(FileEntry::owner)];
+        uint8_t type = 0;
+        bool ok = get(p, end, s)
+               && get(p, end, parent)
+               && get_str(p, end, name, sizeof(name))
+               && get_str(p, end, owner, sizeof(owner))
+               && get(p, end, type);
+        if (!ok || s == NO_INODE || inodes.used(s) || type == FREE_INODE)
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+        inodes.claim(s, static_cast<EntryType>(type));
+        Inode& i = inodes[s];
+        InodeData& d = inodes.data(s);
+        i.parent = parent;
+        i.owner = inodes.internOwner(owner);
+        inodes.setName(s, name);
+        ok = get(p, end, i.permissions)
+          && get(p, end, i.size)
+          && get(p, end, i.ctime)
+          && get(p, end, i.mtime)
+          && get(p, end, i.generation)
+          && get(p, end, nextents);
+        if (!ok || static_cast<size_t>(end - p) < nextents * sizeof(Extent))
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+        if (nextents > 0)
+        {
+            d.extents.resize(nextents);
+            memcpy(d.extents.data(), p, nextents * sizeof(Extent));
+        }
+        p += nextents * sizeof(Extent);
+
+        char author[sizeof(FileMetadata::author)];
+        uint32_t nversions = 0;
+        if (!get(p, end, d.version) || !get_str(p, end, author, sizeof(author)) || !get(p, end, nversions)
+            || static_cast<size_t>(end - p) < nversions * sizeof(FileVersion))
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        d.author = inodes.internOwner(author);
+        if (nversions > 0)
+        {
+            vector<FileVersion>& history = inodes.extra(s).history;
+            history.resize(nversions);
+            memcpy(history.data(), p, nversions * sizeof(FileVersion));
+        }
+        p += nversions * sizeof(FileVersion);
+
+        uint32_t nchunks = 0;
+        if (!get(p, end, i.compression) || !get(p, end, nchunks)
+            || static_cast<size_t>(end - p) < nchunks * sizeof(uint32_t))
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        if (nchunks > 0)
+        {
+            vector<uint32_t>& chunks = inodes.extra(s).chunks;
+            chunks.resize(nchunks);
+            memcpy(chunks.data(), p, nchunks * sizeof(uint32_t));
+        }
+        p += nchunks * sizeof(uint32_t);
+
+        if (fs->bitmap.markUsed(d.extents) != OFSErrorCodes::SUCCESS)
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+        i.blocks = 0;
+        for (const Extent& x : d.extents)
+            i.blocks += x.length;
+        frag_account(fs, s, +1);
+
+        quota_charge(fs, i.owner, static_cast<int64_t>(i.getType() == EntryType::DIRECTORY ? 0 : i.size), 1);
+        if (i.getType() == EntryType::DIRECTORY)
+        {
+            fs->stats.total_directories++;
+        }
+        else
+        {
+            fs->stats.total_files++;
+            fs->stats.used_space += i.size;
+            fs->stats.free_space -= i.size;
+        }
+    }
+    inodes.relinkFree();
+    inodes.setGeneration(static_cast<uint32_t>(h.generation));
+    if (fs->tree.rebuild(inodes) != OFSErrorCodes::SUCCESS)
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    fs->meta.rebuild(inodes);
+
+    uint64_t nfingerprints = 0;
+    if (!get(p, end, nfingerprints))
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    fs->dedup.clear();
+    for (uint64_t i = 0; i < nfingerprints; ++i)
+    {
+        uint64_t hash = 0;
+        uint32_t block = 0;
+        if (!get(p, end, hash) || !get(p, end, block))
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        fs->dedup.insert(hash, block);
+    }
+
+    *lsn = h.lsn;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int checkpoint_write(FileSystemInstance* fs)
+{
+    if (!fs || !fs->log.isOpen())
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+
+    uint64_t lsn = fs->log.lastLsn();
+    string image;
+    serialize(fs, lsn, image);
+
+    uint32_t bs = fs->store.blockSize();
+    uint32_t per_block = bs - sizeof(uint32_t);
+    unsigned int n = static_cast<unsigned int>((image.size() + per_block - 1) / per_block);
+
+    // Contiguous when possible so loading it is one sequential read.
+    auto alloc = fs->bitmap.allocateExtent(n);
+    if (alloc.first != OFSErrorCodes::SUCCESS)
+    {
+        cerr << "[checkpoint] No room for a " << image.size() << " byte checkpoint.\n";
+        return static_cast<int>(alloc.first);
+    }
+    vector<unsigned int> chain;
+    chain.reserve(n);
+    for (const Extent& e : alloc.second)
+        for (uint32_t b = 0; b < e.length; ++b)
+            chain.push_back(e.start + b);
+
+    vector<char> buf(bs);
+    for (unsigned int i = 0; i < n; ++i)
+    {
+        uint32_t next = (i + 1 < n) ? chain[i + 1] + 1 : 0;
+        size_t off = static_cast<size_t>(i) * per_block;
+        size_t len = min<size_t>(per_block, image.size() - off);
+        memcpy(buf.data(), &next, sizeof(next));
+        memcpy(buf.data() + sizeof(next), image.data() + off, len);
+        if (fs->store.writeBlock(chain[i], buf.data(), sizeof(next) + len) != OFSErrorCodes::SUCCESS)
+        {
+            fs->bitmap.freeBlocks(chain);
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+    }
+
+    // The image references file blocks whose contents so far only the log
+    // guarantees, so everything must be durable before the header moves.
+    if (fs->store.flush() != OFSErrorCodes::SUCCESS)
+    {
+        fs->bitmap.freeBlocks(chain);
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+
+    OMNILayout layout = read_layout(fs->header);
+    layout.checkpoint_head = chain[0] + 1ULL;
+    layout.checkpoint_bytes = image.size();
+    layout.checkpoint_lsn = lsn;
+    layout.vault_head = fs->vault.head();
+    layout.vault_tail = fs->vault.tail();
+    layout.root_compression = fs->root_compression;
+    write_layout(fs->header, layout);
+    int rc = write_header(fs);
+    if (rc != static_cast<int>(OFSErrorCodes::SUCCESS))
+        return rc;
+
+    // Neither the old chain nor blocks the defragmenter moved away from are
+    // referenced by the new checkpoint.
+    fs->bitmap.freeBlocks(fs->checkpoint_blocks);
+    fs->checkpoint_blocks = chain;
+    fs->bitmap.freeExtents(fs->deferred_free);
+    fs->deferred_free.clear();
+    fs->bitmap.forgetUnshared();
+    fs->last_checkpoint = static_cast<uint64_t>(time(nullptr));
+
+    return static_cast<int>(fs->log.reset());
+}
+
+bool checkpoint_reclaim(FileSystemInstance* fs)
+{
+    if (fs->deferred_free.empty() || fs->replaying || !fs->log.isOpen())
+        return false;
+    return checkpoint_write(fs) == static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+void checkpoint_release(FileSystemInstance* fs, const vector<Extent>& extents)
+{
+    vector<Extent> now;
+    for (const Extent& e : extents)
+    {
+        if (!fs->log.isOpen() || !fs->bitmap.wasShared(e))
+        {
+            now.push_back(e);
+            continue;
+        }
+        // One block at a time, as extents of several files may share one.
+        for (uint32_t i = 0; i < e.length; ++i)
+        {
+            unsigned int b = e.start + i;
+            if (fs->bitmap.refCount(b) > 1 || !fs->bitmap.wasShared(b))
+            {
+                fs->bitmap.freeBlocks({b});
+            }
+            else if (!fs->deferred_free.empty() && fs->deferred_free.back().start + fs->deferred_free.back().length == b)
+            {
+                fs->deferred_free.back().length++;
+            }
+            else
+            {
+                fs->deferred_free.push_back({b, 1});
+            }
+        }
+    }
+    fs->bitmap.freeExtents(now);
+}
+
+int checkpoint_load(FileSystemInstance* fs, uint64_t* lsn)
+{
+    *lsn = 0;
+    OMNILayout layout = read_layout(fs->header);
+    if (layout.checkpoint_head == 0)
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+
+    uint32_t bs = fs->store.blockSize();
+    uint32_t per_block = bs - sizeof(uint32_t);
+    unsigned int expected = static_cast<unsigned int>((layout.checkpoint_bytes + per_block - 1) / per_block);
+
+    string image;
+    image.reserve(layout.checkpoint_bytes);
+    vector<unsigned int> chain;
+    chain.reserve(expected);
+    vector<char> buf(bs);
+
+    uint64_t next = layout.checkpoint_head;
+    while (next != 0 && image.size() < layout.checkpoint_bytes)
+    {
+        unsigned int block = static_cast<unsigned int>(next - 1);
+        if (chain.size() >= expected)
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+        // Straight out of the mapping when there is one.
+        if (!fs->store.verifyBlock(block))
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        const char* src = fs->store.blockData(block);
+        if (!src)
+        {
+            if (fs->store.readBlock(block, buf.data()) != OFSErrorCodes::SUCCESS)
+                return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+            src = buf.data();
+        }
+
+        uint32_t link;
+        memcpy(&link, src, sizeof(link));
+        size_t len = min<size_t>(per_block, layout.checkpoint_bytes - image.size());
+        image.append(src + sizeof(link), len);
+        chain.push_back(block);
+        next = link;
+    }
+    if (image.size() != layout.checkpoint_bytes)
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+    int rc = deserialize(fs, image, lsn);
+    if (rc != static_cast<int>(OFSErrorCodes::SUCCESS))
+        return rc;
+
+    fs->bitmap.markUsed(chain);
+    fs->checkpoint_blocks = chain;
+    fs->last_checkpoint = static_cast<uint64_t>(time(nullptr));
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int fs_checkpoint()
+{
+    return checkpoint_write(g_fs);
+}
@@ -0,0 +1,253 @@
+#include "../include/checksum.hpp"
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define OFS_CRC32C_X86 1
+#endif
+
+uint32_t fnv1a32(const void* data, size_t size, uint32_t seed)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint32_t c = seed;
+    for (size_t i = 0; i < size; ++i)
+    {
+        c ^= p[i];
+        c *= 16777619u;
+    }
+    return c;
+}
+
+static const uint64_t P1 = 11400714785074694791ULL;
+static const uint64_t P2 = 14029467366897019727ULL;
+static const uint64_t P3 = 1609587929392839161ULL;
+static const uint64_t P4 = 9650029242287828579ULL;
+static const uint64_t P5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t load64(const unsigned char* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t load32(const unsigned char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * P2;
+    acc = rotl64(acc, 31);
+    return acc * P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * P1 + P4;
+}
+
+uint64_t xxhash64(const void* data, size_t size, uint64_t seed)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    uint64_t h;
+
+    if (size >= 32)
+    {
+        uint64_t v1 = seed + P1 + P2;
+        uint64_t v2 = seed + P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - P1;
+        const unsigned char* limit = end - 32;
+        do
+        {
+            v1 = xxh_round(v1, load64(p));
+            v2 = xxh_round(v2, load64(p + 8));
+            v3 = xxh_round(v3, load64(p + 16));
+            v4 = xxh_round(v4, load64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    }
+    else
+    {
+        h = seed + P5;
+    }
+
+    h += static_cast<uint64_t>(size);
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= xxh_round(0, load64(p));
+        h = rotl64(h, 27) * P1 + P4;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= static_cast<uint64_t>(load32(p)) * P1;
+        h = rotl64(h, 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+    {
+        h ^= (*p) * P5;
+        h = rotl64(h, 11) * P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Slice-by-8: table[k][b] is the CRC of byte b followed by k zero bytes, so
+// eight input bytes fold in with eight lookups and no loop-carried shifts.
+struct Crc32cTables
+{
+    uint32_t t[8][256];
+
+    Crc32cTables()
+    {
+        for (uint32_t b = 0; b < 256; ++b)
+        {
+            uint32_t c = b;
+            for (int k = 0; k < 8; ++k)
+                c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+            t[0][b] = c;
+        }
+        for (uint32_t b = 0; b < 256; ++b)
+            for (int k = 1; k < 8; ++k)
+                t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xFF];
+    }
+};
+
+static const Crc32cTables crc_tables;
+
+uint32_t crc32c_slice8(const void* data, size_t size, uint32_t seed)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const uint32_t (*t)[256] = crc_tables.t;
+    uint32_t c = ~seed;
+
+    for (; size >= 8; p += 8, size -= 8)
+    {
+        uint32_t lo = load32(p) ^ c;
+        uint32_t hi = load32(p + 4);
+        c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+          ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+    for (; size > 0; --size)
+        c = (c >> 8) ^ t[0][(c ^ *p++) & 0xFF];
+    return ~c;
+}
+
+#ifdef OFS_CRC32C_X86
+// The crc32 instruction has a latency of three cycles but can start one per
+// cycle, so three independent streams over neighbouring lanes run about
+// three times as fast as one. Lane results are joined by advancing the
+// earlier one over `len` zero bytes, which is linear in the CRC state and
+// so is four table lookups.
+struct Crc32cShift
+{
+    size_t len;
+    uint32_t t[4][256];
+
+    explicit Crc32cShift(size_t n) : len(n)
+    {
+        uint32_t bit[32];
+        for (int i = 0; i < 32; ++i)
+        {
+            uint32_t c = 1u << i;
+            for (size_t k = 0; k < n; ++k)
+                c = (c >> 8) ^ crc_tables.t[0][c & 0xFF];
+            bit[i] = c;
+        }
+        for (int k = 0; k < 4; ++k)
+            for (uint32_t b = 0; b < 256; ++b)
+            {
+                uint32_t c = 0;
+                for (int i = 0; i < 8; ++i)
+                    if (b & (1u << i))
+                        c ^= bit[k * 8 + i];
+                t[k][b] = c;
+            }
+    }
+
+    uint32_t operator()(uint32_t c) const
+    {
+        return t[0][c & 0xFF] ^ t[1][(c >> 8) & 0xFF] ^ t[2][(c >> 16) & 0xFF] ^ t[3][c >> 24];
+    }
+};
+
+// Lanes for 4 KB blocks (3 x 1360 + 16) and for 512-byte ones (3 x 168 + 8).
+static const Crc32cShift crc_shift_long(1360);
+static const Crc32cShift crc_shift_short(168);
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(const void* data, size_t size, uint32_t seed)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint32_t c = ~seed;
+#if defined(__x86_64__)
+    uint64_t c64 = c;
+    static const Crc32cShift* const shifts[] = {&crc_shift_long, &crc_shift_short};
+    for (const Crc32cShift* sh : shifts)
+    {
+        size_t lane = sh->len;
+        for (; size >= 3 * lane; p += 3 * lane, size -= 3 * lane)
+        {
+            uint64_t a = c64, b = 0, d = 0;
+            for (size_t i = 0; i < lane; i += 8)
+            {
+                a = _mm_crc32_u64(a, load64(p + i));
+                b = _mm_crc32_u64(b, load64(p + lane + i));
+                d = _mm_crc32_u64(d, load64(p + 2 * lane + i));
+            }
+            uint32_t ab = (*sh)(static_cast<uint32_t>(a)) ^ static_cast<uint32_t>(b);
+            c64 = (*sh)(ab) ^ static_cast<uint32_t>(d);
+        }
+    }
+    for (; size >= 8; p += 8, size -= 8)
+        c64 = _mm_crc32_u64(c64, load64(p));
+    c = static_cast<uint32_t>(c64);
+#endif
+    for (; size >= 4; p += 4, size -= 4)
+        c = _mm_crc32_u32(c, load32(p));
+    for (; size > 0; --size)
+        c = _mm_crc32_u8(c, *p++);
+    return ~c;
+}
+#endif
+
+bool crc32c_hardware()
+{
+#ifdef OFS_CRC32C_X86
+    static const bool has = __builtin_cpu_supports("sse4.2");
+    return has;
+#else
+    return false;
+#endif
+}
+
+uint32_t crc32c(const void* data, size_t size, uint32_t seed)
+{
+#ifdef OFS_CRC32C_X86
+    if (crc32c_hardware())
+        return crc32c_sse42(data, size, seed);
+#endif
+    return crc32c_slice8(data, size, seed);
+}
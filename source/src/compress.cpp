@@ -0,0 +1,325 @@
+#include "../include/compress.hpp"
+#include "../include/fs_core.hpp"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+// ---------------------------------------------------------------------------
+// Codec
+// ---------------------------------------------------------------------------
+
+static const size_t LZ_MIN_MATCH = 4;
+static const size_t LZ_MAX_OFFSET = 0xFFFF;
+static const int LZ_HASH_BITS = 12;
+
+static uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Lengths of 15 and up continue in extra bytes of 255 ending with one below.
+static bool put_length(uint8_t*& op, const uint8_t* end, size_t n)
+{
+    for (; n >= 255; n -= 255)
+    {
+        if (op == end) return false;
+        *op++ = 255;
+    }
+    if (op == end) return false;
+    *op++ = static_cast<uint8_t>(n);
+    return true;
+}
+
+static bool get_length(const uint8_t*& ip, const uint8_t* end, size_t& n)
+{
+    uint8_t b;
+    do
+    {
+        if (ip == end) return false;
+        b = *ip++;
+        n += b;
+    } while (b == 255);
+    return true;
+}
+
+// One sequence: literals, then a match unless it is the last sequence
+// (match_len == 0).
+static bool put_sequence(uint8_t*& op, const uint8_t* end, const uint8_t* lit, size_t lit_len, size_t offset, size_t match_len)
+{
+    if (op == end) return false;
+    uint8_t* token = op++;
+    size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+    *token = static_cast<uint8_t>((min<size_t>(lit_len, 15) << 4) | min<size_t>(ml, 15));
+
+    if (lit_len >= 15 && !put_length(op, end, lit_len - 15)) return false;
+    if (static_cast<size_t>(end - op) < lit_len) return false;
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len == 0) return true;
+    if (end - op < 2) return false;
+    *op++ = static_cast<uint8_t>(offset & 0xFF);
+    *op++ = static_cast<uint8_t>(offset >> 8);
+    return ml < 15 || put_length(op, end, ml - 15);
+}
+
+size_t lz_compress(const char* src, size_t size, char* dst, size_t capacity)
+{
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+    uint8_t* op = reinterpret_cast<uint8_t*>(dst);
+    const uint8_t* end = op + capacity;
+    uint32_t table[1u << LZ_HASH_BITS] = {};
+
+    size_t anchor = 0;
+    size_t i = 0;
+    while (size >= LZ_MIN_MATCH && i <= size - LZ_MIN_MATCH)
+    {
+        uint32_t seq = read32(in + i);
+        uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t cand = table[h];
+        table[h] = static_cast<uint32_t>(i);
+
+        if (cand < i && i - cand <= LZ_MAX_OFFSET && read32(in + cand) == seq)
+        {
+            size_t len = LZ_MIN_MATCH;
+            while (i + len < size && in[cand + len] == in[i + len])
+                ++len;
+            if (!put_sequence(op, end, in + anchor, i - anchor, i - cand, len))
+                return 0;
+            i += len;
+            anchor = i;
+        }
+        else
+        {
+            // Take longer strides the longer nothing matched, so data that
+            // does not compress passes through quickly.
+            i += 1 + ((i - anchor) >> 6);
+        }
+    }
+
+    if (!put_sequence(op, end, in + anchor, size - anchor, 0, 0))
+        return 0;
+    return static_cast<size_t>(op - reinterpret_cast<uint8_t*>(dst));
+}
+
+bool lz_decompress(const char* src, size_t size, char* dst, size_t raw_size)
+{
+    const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* iend = ip + size;
+    uint8_t* const ostart = reinterpret_cast<uint8_t*>(dst);
+    uint8_t* op = ostart;
+    uint8_t* const oend = ostart + raw_size;
+
+    while (ip < iend)
+    {
+        uint8_t token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15 && !get_length(ip, iend, lit)) return false;
+        if (static_cast<size_t>(iend - ip) < lit || static_cast<size_t>(oend - op) < lit) return false;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return false;
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        size_t ml = token & 15;
+        if (ml == 15 && !get_length(ip, iend, ml)) return false;
+        ml += LZ_MIN_MATCH;
+        if (offset == 0 || offset > static_cast<size_t>(op - ostart) || static_cast<size_t>(oend - op) < ml)
+            return false;
+
+        // Overlapping matches repeat the bytes just written.
+        const uint8_t* m = op - offset;
+        if (offset >= ml)
+        {
+            memcpy(op, m, ml);
+            op += ml;
+        }
+        else
+        {
+            while (ml--) *op++ = *m++;
+        }
+    }
+    return op == oend;
+}
+
+// ---------------------------------------------------------------------------
+// Compressed files
+// ---------------------------------------------------------------------------
+
+static uint64_t unit_bytes(FileSystemInstance* fs)
+{
+    return static_cast<uint64_t>(COMPRESS_UNIT_BLOCKS) * fs->store.blockSize();
+}
+
+static uint64_t unit_raw(uint64_t unit, uint64_t size, size_t i)
+{
+    return min<uint64_t>(unit, size - i * unit);
+}
+
+static uint64_t stored_blocks(FileSystemInstance* fs, const vector<uint32_t>& chunks, size_t i, uint64_t size)
+{
+    uint64_t bs = fs->store.blockSize();
+    uint64_t len = chunks[i] ? chunks[i] : unit_raw(unit_bytes(fs), size, i);
+    return (len + bs - 1) / bs;
+}
+
+// Decodes unit i, stored from file block `block` on, into dst.
+static bool read_unit(FileSystemInstance* fs, const vector<Extent>& extents, const vector<uint32_t>& chunks,
+                      size_t i, uint64_t block, uint64_t raw, char* dst, string& scratch)
+{
+    uint64_t pos = block * fs->store.blockSize();
+    if (chunks[i] == 0)
+        return fs->store.readRange(extents, pos, dst, raw) == OFSErrorCodes::SUCCESS;
+
+    scratch.resize(chunks[i]);
+    return fs->store.readRange(extents, pos, &scratch[0], chunks[i]) == OFSErrorCodes::SUCCESS
+        && lz_decompress(scratch.data(), chunks[i], dst, raw);
+}
+
+uint32_t compress_policy(FileSystemInstance* fs, uint32_t slot)
+{
+    const InodeTable& inodes = fs->inodes;
+    for (uint32_t d = inodes[slot].parent; d != NO_INODE; d = inodes[d].parent)
+    {
+        if (inodes[d].compression == COMPRESS_LZ) return COMPRESS_LZ;
+        if (inodes[d].compression == COMPRESS_OFF) return COMPRESS_NONE;
+    }
+    if (fs->root_compression == COMPRESS_LZ) return COMPRESS_LZ;
+    if (fs->root_compression == COMPRESS_OFF) return COMPRESS_NONE;
+    return fs->config.compression ? COMPRESS_LZ : COMPRESS_NONE;
+}
+
+int content_read(FileSystemInstance* fs, uint32_t slot, uint64_t offset, uint64_t length, char* dst)
+{
+    const InodeTable& inodes = fs->inodes;
+    const vector<Extent>& extents = inodes.data(slot).extents;
+    if (length == 0)
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+    if (inodes[slot].compression != COMPRESS_LZ)
+        return static_cast<int>(fs->store.readRange(extents, offset, dst, length));
+
+    const vector<uint32_t>& chunks = inodes.chunks(slot);
+    uint64_t size = inodes[slot].size;
+    uint64_t unit = unit_bytes(fs);
+    uint64_t bs = fs->store.blockSize();
+    uint64_t end = offset + length;
+    if (end > size)
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+    string scratch, tmp;
+    uint64_t block = 0;
+    for (size_t i = 0; i < chunks.size() && i * unit < end; ++i)
+    {
+        uint64_t start = i * unit;
+        uint64_t raw = unit_raw(unit, size, i);
+        if (start + raw > offset)
+        {
+            uint64_t lo = max(offset, start);
+            uint64_t hi = min(end, start + raw);
+            char* out = dst + (lo - offset);
+            bool ok;
+            if (lo == start && hi == start + raw)
+            {
+                // Whole unit: decode straight into the caller's buffer.
+                ok = read_unit(fs, extents, chunks, i, block, raw, out, scratch);
+            }
+            else if (chunks[i] == 0)
+            {
+                ok = fs->store.readRange(extents, block * bs + (lo - start), out, hi - lo) == OFSErrorCodes::SUCCESS;
+            }
+            else
+            {
+                tmp.resize(raw);
+                ok = read_unit(fs, extents, chunks, i, block, raw, &tmp[0], scratch);
+                if (ok)
+                    memcpy(out, tmp.data() + (lo - start), hi - lo);
+            }
+            if (!ok)
+                return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+        block += stored_blocks(fs, chunks, i, size);
+    }
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Appends one unit to out, compressed when that saves at least one block.
+static void encode_unit(FileSystemInstance* fs, const char* src, uint64_t raw, CompressedTail& out)
+{
+    uint64_t bs = fs->store.blockSize();
+    uint64_t raw_blocks = (raw + bs - 1) / bs;
+    size_t base = out.bytes.size();
+    out.bytes.resize(base + raw_blocks * bs, '\0');
+
+    size_t c = raw_blocks > 1 ? lz_compress(src, raw, &out.bytes[base], (raw_blocks - 1) * bs) : 0;
+    if (c > 0)
+    {
+        out.bytes.resize(base + (c + bs - 1) / bs * bs);
+        out.chunks.push_back(static_cast<uint32_t>(c));
+    }
+    else
+    {
+        memcpy(&out.bytes[base], src, raw);
+        out.chunks.push_back(0);
+    }
+}
+
+int compress_encode(FileSystemInstance* fs, uint32_t slot, uint64_t old_size,
+                    uint64_t offset, const char* data, uint64_t length, CompressedTail& out)
+{
+    const InodeTable& inodes = fs->inodes;
+    const vector<Extent>& extents = inodes.data(slot).extents;
+    const vector<uint32_t>& chunks = inodes.chunks(slot);
+    uint64_t unit = unit_bytes(fs);
+    uint64_t end = offset + length;
+    uint64_t new_size = max(old_size, end);
+    size_t old_units = static_cast<size_t>((old_size + unit - 1) / unit);
+    if (old_size > 0 && chunks.size() != old_units)
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+    // Bytes between the old end of file and the write read back as zeros,
+    // so re-encoding starts at whichever comes first.
+    size_t first = static_cast<size_t>(min(offset, old_size) / unit);
+    size_t last = max(first, static_cast<size_t>((end + unit - 1) / unit));
+
+    out.first_block = 0;
+    for (size_t i = 0; i < first; ++i)
+        out.first_block += stored_blocks(fs, chunks, i, old_size);
+    out.chunks.assign(chunks.begin(), chunks.begin() + first);
+    out.bytes.clear();
+
+    uint64_t lo = first * unit;
+    uint64_t hi = min(new_size, last * unit);
+    string raw(hi - lo, '\0');
+    string scratch;
+    uint64_t block = out.first_block;
+    size_t i = first;
+    for (; i < last && i < old_units; ++i)
+    {
+        if (!read_unit(fs, extents, chunks, i, block, unit_raw(unit, old_size, i), &raw[i * unit - lo], scratch))
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        block += stored_blocks(fs, chunks, i, old_size);
+    }
+    if (length > 0)
+        memcpy(&raw[offset - lo], data, length);
+
+    for (size_t u = first; u < last; ++u)
+        encode_unit(fs, raw.data() + (u * unit - lo), unit_raw(unit, new_size, u), out);
+
+    // A write that ends before the last unit leaves the size, and so every
+    // unit behind it, as it was.
+    out.tail_block = i < old_units ? block : inodes[slot].blocks;
+    out.chunks.insert(out.chunks.end(), chunks.begin() + i, chunks.begin() + old_units);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+void compress_refresh(FileSystemInstance* fs)
+{
+    fs->stats.compressed_files = static_cast<uint32_t>(fs->compressed_files);
+    fs->stats.logical_bytes += fs->compress_saved * fs->store.blockSize();
+}
@@ -0,0 +1,190 @@
+#include "../include/dedup.hpp"
+#include "../include/fs_core.hpp"
+#include "../include/defrag.hpp"
+#include "../include/checksum.hpp"
+#include <cstring>
+
+using namespace std;
+
+bool DedupIndex::find(uint64_t hash, unsigned int& block) const
+{
+    auto it = by_hash_.find(hash);
+    if (it == by_hash_.end())
+        return false;
+    block = it->second;
+    return true;
+}
+
+void DedupIndex::insert(uint64_t hash, unsigned int block)
+{
+    auto old = by_hash_.find(hash);
+    if (old != by_hash_.end())
+        by_block_.erase(old->second);
+    erase(block);
+    by_hash_[hash] = block;
+    by_block_[block] = hash;
+}
+
+void DedupIndex::erase(unsigned int block)
+{
+    auto it = by_block_.find(block);
+    if (it == by_block_.end())
+        return;
+    by_hash_.erase(it->second);
+    by_block_.erase(it);
+}
+
+void DedupIndex::clear()
+{
+    by_hash_.clear();
+    by_block_.clear();
+}
+
+bool DedupIndex::empty() const
+{
+    return by_hash_.empty();
+}
+
+const unordered_map<uint64_t, unsigned int>& DedupIndex::entries() const
+{
+    return by_hash_;
+}
+
+static void append_block(vector<Extent>& extents, unsigned int block)
+{
+    if (!extents.empty() && extents.back().start + extents.back().length == block)
+        extents.back().length++;
+    else
+        extents.push_back({block, 1});
+}
+
+static bool same_content(FileSystemInstance* fs, unsigned int block, const char* data, vector<char>& scratch)
+{
+    // A damaged block must not be shared with new writes.
+    if (!fs->store.verifyBlock(block))
+        return false;
+    const char* p = fs->store.blockData(block);
+    if (!p)
+    {
+        if (fs->store.readBlock(block, scratch.data()) != OFSErrorCodes::SUCCESS)
+            return false;
+        p = scratch.data();
+    }
+    return memcmp(p, data, fs->store.blockSize()) == 0;
+}
+
+int dedup_store(FileSystemInstance* fs, uint32_t slot, const char* data, size_t size)
+{
+    vector<Extent>& extents = fs->inodes.data(slot).extents;
+    uint32_t bs = fs->store.blockSize();
+    vector<char> chunk(bs), scratch(bs);
+
+    for (size_t off = 0; off < size; off += bs)
+    {
+        size_t len = size - off < bs ? size - off : bs;
+        memcpy(chunk.data(), data + off, len);
+        memset(chunk.data() + len, 0, bs - len);
+        uint64_t hash = xxhash64(chunk.data(), bs);
+
+        unsigned int block;
+        if (fs->dedup.find(hash, block) && fs->bitmap.isUsed(block) && same_content(fs, block, chunk.data(), scratch))
+        {
+            fs->bitmap.addRef(block);
+            fs->stats.dedup_hits++;
+        }
+        else
+        {
+            unsigned int hint = extents.empty() ? FreeBitmap::NO_HINT : extents.back().start + extents.back().length;
+            auto res = fs->bitmap.allocateExtent(1, hint);
+            if (res.first != OFSErrorCodes::SUCCESS
+                || fs->store.writeBlock(res.second[0].start, chunk.data(), bs) != OFSErrorCodes::SUCCESS)
+            {
+                if (res.first == OFSErrorCodes::SUCCESS)
+                    fs->bitmap.freeExtents(res.second);
+                fs->bitmap.freeExtents(extents);
+                extents.clear();
+                return static_cast<int>(res.first != OFSErrorCodes::SUCCESS ? res.first : OFSErrorCodes::ERROR_IO_ERROR);
+            }
+            block = res.second[0].start;
+            fs->dedup.insert(hash, block);
+        }
+        append_block(extents, block);
+    }
+
+    fs->inodes[slot].blocks = static_cast<uint32_t>((size + bs - 1) / bs);
+    frag_account(fs, slot, +1);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int dedup_unshare(FileSystemInstance* fs, uint32_t slot, uint64_t offset, uint64_t length)
+{
+    if (length == 0 || (fs->bitmap.sharedRefs() == 0 && fs->dedup.empty()))
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+
+    uint32_t bs = fs->store.blockSize();
+    uint64_t first = offset / bs;
+    uint64_t last = (offset + length + bs - 1) / bs;
+
+    // Logical block -> physical block for the whole file; only rebuilt
+    // into extents when something was actually copied.
+    vector<Extent>& extents = fs->inodes.data(slot).extents;
+    vector<unsigned int> map;
+    map.reserve(fs->inodes[slot].blocks);
+    for (const Extent& e : extents)
+        for (uint32_t i = 0; i < e.length; ++i)
+            map.push_back(e.start + i);
+    if (last > map.size())
+        last = map.size();
+
+    int rc = static_cast<int>(OFSErrorCodes::SUCCESS);
+    bool copied = false;
+    vector<char> buf(bs);
+    for (uint64_t i = first; i < last; ++i)
+    {
+        unsigned int old = map[i];
+        if (fs->bitmap.refCount(old) <= 1)
+        {
+            fs->dedup.erase(old);
+            continue;
+        }
+
+        unsigned int hint = i > 0 ? map[i - 1] + 1 : FreeBitmap::NO_HINT;
+        auto res = fs->bitmap.allocateExtent(1, hint);
+        if (res.first != OFSErrorCodes::SUCCESS)
+        {
+            rc = static_cast<int>(res.first);
+            break;
+        }
+        unsigned int fresh = res.second[0].start;
+        if (fs->store.readBlock(old, buf.data()) != OFSErrorCodes::SUCCESS
+            || fs->store.writeBlock(fresh, buf.data(), bs) != OFSErrorCodes::SUCCESS)
+        {
+            fs->bitmap.freeExtents(res.second);
+            rc = static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+            break;
+        }
+        // old keeps its other owners. Replaying this write copies it again,
+        // so once they let go of it, checkpoint_release() holds it back
+        // until the next checkpoint.
+        fs->bitmap.freeBlocks({old});
+        map[i] = fresh;
+        copied = true;
+    }
+
+    if (copied)
+    {
+        frag_account(fs, slot, -1);
+        extents.clear();
+        for (unsigned int b : map)
+            append_block(extents, b);
+        frag_account(fs, slot, +1);
+    }
+    return rc;
+}
+
+void dedup_refresh(FileSystemInstance* fs)
+{
+    uint64_t bs = fs->store.blockSize();
+    fs->stats.logical_bytes = fs->file_blocks * bs;
+    fs->stats.physical_bytes = (fs->file_blocks - fs->bitmap.sharedRefs()) * bs;
+}
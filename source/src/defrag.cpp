@@ -0,0 +1,217 @@
+#include "../include/defrag.hpp"
+#include "../include/fs_core.hpp"
+#include "../include/compress.hpp"
+#include "../include/checkpoint.hpp"
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+// Files looked at per step before giving up until the next one.
+static const size_t DEFRAG_SCAN = 256;
+
+void frag_account(FileSystemInstance* fs, uint32_t slot, int sign)
+{
+    const vector<Extent>& extents = fs->inodes.data(slot).extents;
+    if (extents.empty())
+        return;
+
+    const Inode& f = fs->inodes[slot];
+    uint64_t saved = 0;
+    bool compressed = f.compression == COMPRESS_LZ && f.getType() == EntryType::FILE;
+    if (compressed)
+    {
+        uint64_t bs = fs->store.blockSize();
+        uint64_t plain = (f.size + bs - 1) / bs;
+        saved = plain > f.blocks ? plain - f.blocks : 0;
+    }
+
+    if (sign > 0)
+    {
+        fs->file_extents += extents.size();
+        fs->file_blocks += f.blocks;
+        fs->data_files++;
+        fs->compressed_files += compressed;
+        fs->compress_saved += saved;
+    }
+    else
+    {
+        fs->file_extents -= extents.size();
+        fs->file_blocks -= f.blocks;
+        fs->data_files--;
+        fs->compressed_files -= compressed;
+        fs->compress_saved -= saved;
+    }
+}
+
+void frag_refresh(FileSystemInstance* fs)
+{
+    uint64_t free_blocks = fs->bitmap.freeCount();
+    uint64_t free_runs = fs->bitmap.freeRuns();
+
+    uint64_t breaks = (fs->file_extents - fs->data_files) + (free_runs > 0 ? free_runs - 1 : 0);
+    uint64_t worst = (fs->file_blocks - fs->data_files) + (free_blocks > 0 ? free_blocks - 1 : 0);
+
+    fs->stats.fragmentation = worst ? 100.0 * static_cast<double>(breaks) / static_cast<double>(worst) : 0.0;
+    fs->stats.file_extents = static_cast<uint32_t>(fs->file_extents);
+    fs->stats.free_extents = static_cast<uint32_t>(free_runs);
+}
+
+static bool copy_blocks(FileSystemInstance* fs, const Extent& from, const Extent& to)
+{
+    size_t bytes = static_cast<size_t>(from.length) * fs->store.blockSize();
+    vector<char> buf(bytes);
+    return fs->store.readRange({from}, 0, buf.data(), bytes) == OFSErrorCodes::SUCCESS
+        && fs->store.writeRange({to}, 0, buf.data(), bytes) == OFSErrorCodes::SUCCESS;
+}
+
+// Copies the whole file into one free run.
+static unsigned int relocate_file(FileSystemInstance* fs, uint32_t slot)
+{
+    vector<Extent>& extents = fs->inodes.data(slot).extents;
+    unsigned int n = fs->inodes[slot].blocks;
+    auto res = fs->bitmap.allocateExtent(n);
+    if (res.first != OFSErrorCodes::SUCCESS && checkpoint_reclaim(fs))
+        res = fs->bitmap.allocateExtent(n);
+    if (res.first != OFSErrorCodes::SUCCESS)
+        return 0;
+    if (res.second.size() != 1)
+    {
+        fs->bitmap.freeExtents(res.second);
+        return 0;
+    }
+
+    Extent dst = res.second[0];
+    for (const Extent& e : extents)
+    {
+        if (!copy_blocks(fs, e, {dst.start + (dst.length - n), e.length}))
+        {
+            fs->bitmap.freeExtents(res.second);
+            return 0;
+        }
+        n -= e.length;
+    }
+
+    frag_account(fs, slot, -1);
+    fs->deferred_free.insert(fs->deferred_free.end(), extents.begin(), extents.end());
+    extents = res.second;
+    frag_account(fs, slot, +1);
+    return dst.length;
+}
+
+static bool is_deferred(const FileSystemInstance* fs, unsigned int block)
+{
+    for (const Extent& e : fs->deferred_free)
+        if (block >= e.start && block < e.start + e.length)
+            return true;
+    return false;
+}
+
+// Pulls up to max_blocks blocks of some extent in right behind the extent
+// before it, when those blocks are free.
+static unsigned int merge_next(FileSystemInstance* fs, uint32_t slot, unsigned int max_blocks)
+{
+    vector<Extent>& extents = fs->inodes.data(slot).extents;
+    for (size_t i = 0; i + 1 < extents.size(); ++i)
+    {
+        unsigned int hint = extents[i].start + extents[i].length;
+        if (hint >= fs->bitmap.totalBlocks())
+            continue;
+        // Often the blocks behind an extent are ones this file was just
+        // moved away from, waiting for a checkpoint to free them.
+        if (fs->bitmap.isUsed(hint) && is_deferred(fs, hint))
+            checkpoint_reclaim(fs);
+        if (fs->bitmap.isUsed(hint))
+            continue;
+
+        Extent next = extents[i + 1];
+        auto res = fs->bitmap.allocateExtent(min(next.length, max_blocks), hint);
+        if (res.first != OFSErrorCodes::SUCCESS)
+            return 0;
+
+        // Only the run that landed at the hint is useful.
+        Extent got = res.second[0];
+        fs->bitmap.freeExtents(vector<Extent>(res.second.begin() + 1, res.second.end()));
+        if (!copy_blocks(fs, {next.start, got.length}, got))
+        {
+            fs->bitmap.freeExtents({got});
+            return 0;
+        }
+
+        frag_account(fs, slot, -1);
+        fs->deferred_free.push_back({next.start, got.length});
+        extents[i].length += got.length;
+        extents[i + 1].start += got.length;
+        extents[i + 1].length -= got.length;
+        if (extents[i + 1].length == 0)
+        {
+            extents.erase(extents.begin() + i + 1);
+            // The extent after it may now follow on directly.
+            if (i + 1 < extents.size() && extents[i].start + extents[i].length == extents[i + 1].start)
+            {
+                extents[i].length += extents[i + 1].length;
+                extents.erase(extents.begin() + i + 1);
+            }
+        }
+        frag_account(fs, slot, +1);
+        return got.length;
+    }
+    return 0;
+}
+
+// Deduplicated blocks stay where they are; moving them would unshare them.
+static bool has_shared(const FileSystemInstance* fs, uint32_t slot)
+{
+    for (const Extent& e : fs->inodes.data(slot).extents)
+        if (fs->bitmap.hasShared(e))
+            return true;
+    return false;
+}
+
+unsigned int defrag_step(FileSystemInstance* fs, unsigned int max_blocks)
+{
+    size_t n = fs->inodes.slots();
+    if (n == 0 || max_blocks == 0)
+        return 0;
+
+    for (size_t seen = 0; seen < min(n, DEFRAG_SCAN); ++seen)
+    {
+        if (fs->defrag_cursor >= n)
+            fs->defrag_cursor = 0;
+
+        uint32_t slot = static_cast<uint32_t>(fs->defrag_cursor);
+        if (fs->inodes.used(slot) && fs->inodes.data(slot).extents.size() > 1 && !has_shared(fs, slot))
+        {
+            unsigned int moved = fs->inodes[slot].blocks <= max_blocks ? relocate_file(fs, slot) : 0;
+            if (moved == 0)
+                moved = merge_next(fs, slot, max_blocks);
+            if (moved > 0)
+            {
+                // Stay on this file; the next step may merge it further.
+                fs->stats.defrag_moved += moved;
+                return moved;
+            }
+        }
+        fs->defrag_cursor++;
+    }
+    return 0;
+}
+
+int fs_defrag_step()
+{
+    FileSystemInstance* fs = g_fs;
+    if (!fs || fs->replaying || fs->config.defrag_step_blocks == 0)
+        return 0;
+
+    uint64_t now = static_cast<uint64_t>(chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count());
+    if (now - fs->last_defrag_ms < fs->config.defrag_interval_ms)
+        return 0;
+    fs->last_defrag_ms = now;
+
+    frag_refresh(fs);
+    if (fs->stats.fragmentation < fs->config.defrag_min_percent)
+        return 0;
+
+    return static_cast<int>(defrag_step(fs, fs->config.defrag_step_blocks));
+}
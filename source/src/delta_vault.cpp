@@ -0,0 +1,371 @@
+#include "../include/delta_vault.hpp"
+#include "../include/fs_core.hpp"
+#include "../include/checksum.hpp"
+#include "../include/compress.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+using namespace std;
+
+static const uint32_t VAULT_MAGIC = 0x4F56544C;
+static const uint32_t KIND_DELTA = 0;
+static const uint32_t KIND_KEYFRAME = 1;
+
+struct VaultRecordHeader
+{
+    uint32_t magic;
+    uint32_t checksum;      // fnv1a32 over the fields below and the payload
+    uint64_t pos;
+    uint32_t inode;
+    uint32_t version;
+    uint32_t kind;
+    uint32_t length;
+};  // 32 bytes
+
+static uint32_t record_checksum(const VaultRecordHeader& h, const char* payload, size_t len)
+{
+    uint32_t c = fnv1a32(&h.pos, sizeof(h) - offsetof(VaultRecordHeader, pos));
+    return fnv1a32(payload, len, c);
+}
+
+DeltaVault::DeltaVault() : store_(nullptr), offset_(0), size_(0), head_(0), tail_(0), synced_(0) {}
+
+void DeltaVault::open(BlockStore* store, uint64_t offset, uint64_t size, uint64_t head, uint64_t tail)
+{
+    store_ = store;
+    offset_ = offset;
+    size_ = size;
+    head_ = head;
+    tail_ = tail < head ? head : tail;
+    synced_ = tail_;
+}
+
+bool DeltaVault::isOpen() const
+{
+    return store_ && size_ > sizeof(VaultRecordHeader);
+}
+
+OFSErrorCodes DeltaVault::append(uint32_t inode, uint32_t version, bool keyframe, const string& payload, uint64_t& pos)
+{
+    uint64_t len = sizeof(VaultRecordHeader) + payload.size();
+    if (!isOpen() || len > size_)
+    {
+        return OFSErrorCodes::ERROR_NO_SPACE;
+    }
+
+    // Records never wrap: skip to the start of the region instead.
+    uint64_t at = tail_ % size_;
+    if (at + len > size_)
+    {
+        tail_ += size_ - at;
+        at = 0;
+    }
+    pos = tail_;
+    tail_ += len;
+    if (tail_ - head_ > size_)
+    {
+        head_ = tail_ - size_;
+    }
+
+    VaultRecordHeader h = {};
+    h.magic = VAULT_MAGIC;
+    h.pos = pos;
+    h.inode = inode;
+    h.version = version;
+    h.kind = keyframe ? KIND_KEYFRAME : KIND_DELTA;
+    h.length = static_cast<uint32_t>(payload.size());
+    h.checksum = record_checksum(h, payload.data(), payload.size());
+
+    OFSErrorCodes rc = store_->writeAt(offset_ + at, &h, sizeof(h));
+    if (rc == OFSErrorCodes::SUCCESS && !payload.empty())
+    {
+        rc = store_->writeAt(offset_ + at + sizeof(h), payload.data(), payload.size());
+    }
+    return rc;
+}
+
+OFSErrorCodes DeltaVault::read(const FileVersion& v, uint32_t inode, string& payload) const
+{
+    if (!isOpen() || expired(v.vault_pos))
+    {
+        return OFSErrorCodes::ERROR_NOT_FOUND;
+    }
+
+    uint64_t at = v.vault_pos % size_;
+    VaultRecordHeader h;
+    if (store_->readAt(offset_ + at, &h, sizeof(h)) != OFSErrorCodes::SUCCESS)
+    {
+        return OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    // A record written by an operation that never reached the change log
+    // may have replaced it before a crash.
+    if (h.magic != VAULT_MAGIC || h.pos != v.vault_pos || h.inode != inode || h.version != v.version
+        || h.length != v.vault_length || h.kind != (v.keyframe ? KIND_KEYFRAME : KIND_DELTA))
+    {
+        return OFSErrorCodes::ERROR_NOT_FOUND;
+    }
+
+    payload.resize(h.length);
+    if (h.length > 0 && store_->readAt(offset_ + at + sizeof(h), &payload[0], h.length) != OFSErrorCodes::SUCCESS)
+    {
+        return OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    if (record_checksum(h, payload.data(), payload.size()) != h.checksum)
+    {
+        return OFSErrorCodes::ERROR_NOT_FOUND;
+    }
+    return OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes DeltaVault::sync()
+{
+    uint64_t from = max(synced_, head_);
+    synced_ = tail_;
+    // Without a mapping the log's own fdatasync covers these writes too.
+    if (!isOpen() || from >= tail_ || !store_->isMapped())
+    {
+        return OFSErrorCodes::SUCCESS;
+    }
+
+    uint64_t at = from % size_;
+    uint64_t len = tail_ - from;
+    if (len >= size_)
+    {
+        return store_->flushRange(offset_, size_);
+    }
+    if (at + len <= size_)
+    {
+        return store_->flushRange(offset_ + at, len);
+    }
+    OFSErrorCodes rc = store_->flushRange(offset_ + at, size_ - at);
+    if (rc == OFSErrorCodes::SUCCESS)
+    {
+        rc = store_->flushRange(offset_, at + len - size_);
+    }
+    return rc;
+}
+
+bool DeltaVault::adopt(uint64_t pos, uint32_t length)
+{
+    uint64_t len = sizeof(VaultRecordHeader) + length;
+    if (!isOpen() || len > size_ || pos % size_ + len > size_)
+    {
+        return false;
+    }
+
+    if (pos + len > tail_)
+    {
+        tail_ = pos + len;
+    }
+    if (tail_ - head_ > size_)
+    {
+        head_ = tail_ - size_;
+    }
+    synced_ = tail_;
+    return true;
+}
+
+bool DeltaVault::expired(uint64_t pos) const
+{
+    return pos < head_;
+}
+
+uint64_t DeltaVault::head() const
+{
+    return head_;
+}
+
+uint64_t DeltaVault::tail() const
+{
+    return tail_;
+}
+
+uint64_t DeltaVault::capacity() const
+{
+    return size_;
+}
+
+// ---------------------------------------------------------------------------
+// Version history
+// ---------------------------------------------------------------------------
+
+template <typename T>
+static void put(string& out, T v)
+{
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template <typename T>
+static bool get(const string& in, size_t& p, T& v)
+{
+    if (in.size() - p < sizeof(v)) return false;
+    memcpy(&v, in.data() + p, sizeof(v));
+    p += sizeof(v);
+    return true;
+}
+
+static bool read_current(FileSystemInstance* fs, uint32_t slot, uint64_t offset, uint64_t length, string& out)
+{
+    out.resize(length);
+    return length == 0 || content_read(fs, slot, offset, length, &out[0]) == static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+static void prune_expired(FileSystemInstance* fs, vector<FileVersion>& history)
+{
+    size_t n = 0;
+    while (n < history.size() && fs->vault.expired(history[n].vault_pos))
+        ++n;
+    if (n > 0)
+        history.erase(history.begin(), history.begin() + n);
+}
+
+void vault_save(FileSystemInstance* fs, uint32_t slot, uint64_t offset, uint64_t length, const char* author,
+                FileVersion& saved)
+{
+    Inode& i = fs->inodes[slot];
+    InodeData& d = fs->inodes.data(slot);
+    FileVersion v{};
+    v.version = d.version;
+    v.size = i.size;
+    v.time = i.mtime;
+    strncpy(v.author, fs->inodes.ownerName(d.author), sizeof(v.author) - 1);
+    v.vault_pos = VAULT_NONE;
+    saved = v;
+
+    d.version++;
+    d.author = fs->inodes.internOwner(author ? author : "");
+
+    if (!fs->vault.isOpen())
+        return;
+    vector<FileVersion>& history = fs->inodes.extra(slot).history;
+    prune_expired(fs, history);
+
+    if (fs->replaying)
+    {
+        const FileVersion& r = fs->replay_saved;
+        if (r.vault_pos == VAULT_NONE || !fs->vault.adopt(r.vault_pos, r.vault_length))
+        {
+            history.clear();
+            return;
+        }
+        v.keyframe = r.keyframe;
+        v.vault_pos = r.vault_pos;
+        v.vault_length = r.vault_length;
+        history.push_back(v);
+        prune_expired(fs, history);
+        return;
+    }
+
+    uint32_t interval = fs->config.vault_keyframe_interval;
+    bool keyframe = length == UINT64_MAX || (interval > 0 && v.version % interval == 0);
+
+    string payload;
+    bool ok;
+    if (keyframe)
+    {
+        ok = read_current(fs, slot, 0, v.size, payload);
+    }
+    else
+    {
+        // Only the bytes about to be overwritten, plus the size to cut back to.
+        uint64_t end = min(v.size, offset + length);
+        string old;
+        ok = read_current(fs, slot, offset, offset < end ? end - offset : 0, old);
+        put(payload, v.size);
+        if (!old.empty())
+        {
+            put(payload, offset);
+            put(payload, static_cast<uint64_t>(old.size()));
+            payload += old;
+        }
+    }
+
+    uint64_t pos = 0;
+    if (!ok || fs->vault.append(InodeTable::inodeNumber(slot), v.version, keyframe, payload, pos) != OFSErrorCodes::SUCCESS)
+    {
+        // Older deltas are useless without this one.
+        history.clear();
+        return;
+    }
+
+    v.keyframe = keyframe ? 1 : 0;
+    v.vault_pos = pos;
+    v.vault_length = static_cast<uint32_t>(payload.size());
+    saved = v;
+    history.push_back(v);
+    prune_expired(fs, history);
+}
+
+void vault_log(LogRecord& rec, const FileVersion& saved)
+{
+    rec.putU64(saved.vault_pos);
+    rec.putU32(saved.vault_length);
+    rec.putU32(saved.keyframe);
+}
+
+bool vault_unlog(LogRecord& rec, FileVersion& saved)
+{
+    uint32_t keyframe = 0;
+    saved = FileVersion{};
+    if (!rec.getU64(saved.vault_pos) || !rec.getU32(saved.vault_length) || !rec.getU32(keyframe))
+    {
+        saved.vault_pos = VAULT_NONE;
+        return false;
+    }
+    saved.keyframe = keyframe ? 1 : 0;
+    return true;
+}
+
+int vault_read(FileSystemInstance* fs, uint32_t slot, uint32_t version, string& out)
+{
+    const Inode& i = fs->inodes[slot];
+    const vector<FileVersion>& history = fs->inodes.history(slot);
+    if (version == fs->inodes.data(slot).version)
+        return read_current(fs, slot, 0, i.size, out) ? static_cast<int>(OFSErrorCodes::SUCCESS)
+                                                      : static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+    auto it = lower_bound(history.begin(), history.end(), version,
+                          [](const FileVersion& v, uint32_t n) { return v.version < n; });
+    if (it == history.end() || it->version != version || fs->vault.expired(it->vault_pos))
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    size_t want = static_cast<size_t>(it - history.begin());
+
+    // Start from the nearest keyframe at or after the wanted version.
+    size_t k = want;
+    while (k < history.size() && !history[k].keyframe)
+        ++k;
+
+    string payload;
+    if (k < history.size())
+    {
+        OFSErrorCodes rc = fs->vault.read(history[k], InodeTable::inodeNumber(slot), out);
+        if (rc != OFSErrorCodes::SUCCESS)
+            return static_cast<int>(rc);
+    }
+    else if (!read_current(fs, slot, 0, i.size, out))
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+
+    for (size_t n = k; n-- > want;)
+    {
+        OFSErrorCodes rc = fs->vault.read(history[n], InodeTable::inodeNumber(slot), payload);
+        if (rc != OFSErrorCodes::SUCCESS)
+            return static_cast<int>(rc);
+
+        size_t p = 0;
+        uint64_t size = 0, off = 0, len = 0;
+        if (!get(payload, p, size))
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        out.resize(size);
+        while (p < payload.size())
+        {
+            if (!get(payload, p, off) || !get(payload, p, len) || payload.size() - p < len || off + len > size)
+                return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+            memcpy(&out[off], payload.data() + p, len);
+            p += len;
+        }
+    }
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
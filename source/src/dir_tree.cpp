@@ -1,239 +1,540 @@
 #include "../include/dir_tree.hpp"
+#include <cstring>
+#include <fnmatch.h>
 
 using namespace std;
 
-DirTree::DirTree() 
+static const uint8_t DIR_TYPE = static_cast<uint8_t>(EntryType::DIRECTORY);
+
+// Splits off the next component of a path, skipping repeated slashes.
+static bool next_component(const char*& p, string_view& part)
+{
+    while (*p == '/') ++p;
+    if (!*p) return false;
+    const char* start = p;
+    while (*p && *p != '/') ++p;
+    part = string_view(start, p - start);
+    return true;
+}
+
+DirTree::DirTree()
+{
+    top_ = NO_INODE;
+    top_usage_ = DirUsage{};
+}
+
+DirTree::~DirTree() = default;
+
+void DirTree::clear() {
+    index_.clear();
+    top_ = NO_INODE;
+    usage_.clear();
+    top_usage_ = DirUsage{};
+}
+
+uint32_t DirTree::firstChild(const InodeTable& inodes, uint32_t dir) const
 {
-    FileEntry rootEntry("/", EntryType::DIRECTORY, 0, static_cast<uint32_t>(FilePermissions::OWNER_READ), "root", 0);
-    root_ = new Node(rootEntry);
+    return dir == NO_INODE ? top_ : inodes[dir].child;
 }
 
-DirTree::~DirTree() 
+void DirTree::setFirstChild(InodeTable& inodes, uint32_t dir, uint32_t slot)
 {
-    deleteSubtree(root_);
+    if (dir == NO_INODE)
+        top_ = slot;
+    else
+        inodes[dir].child = slot;
 }
 
-void DirTree::deleteSubtree(Node* node) 
+void DirTree::attach(InodeTable& inodes, uint32_t slot)
 {
-    if (!node) return;
-    for (auto child : node->children) 
+    // Appended at the tail of the circular list, which is head->prev.
+    Inode& node = inodes[slot];
+    uint32_t head = firstChild(inodes, node.parent);
+    if (head == NO_INODE)
     {
-        deleteSubtree(child);
+        node.next = node.prev = slot;
+        setFirstChild(inodes, node.parent, slot);
     }
-    delete node;
+    else
+    {
+        uint32_t tail = inodes[head].prev;
+        node.next = head;
+        node.prev = tail;
+        inodes[tail].next = slot;
+        inodes[head].prev = slot;
+    }
+    index_.insert(inodes, slot);
 }
 
-void DirTree::clear() {
-    deleteSubtree(root_);
-    FileEntry rootEntry("/", EntryType::DIRECTORY, 0, static_cast<uint32_t>(FilePermissions::OWNER_READ), "root", 0);
-    root_ = new Node(rootEntry);
+void DirTree::detach(InodeTable& inodes, uint32_t slot)
+{
+    index_.remove(inodes, slot);
+    Inode& node = inodes[slot];
+    if (node.next == slot)
+    {
+        setFirstChild(inodes, node.parent, NO_INODE);
+    }
+    else
+    {
+        inodes[node.prev].next = node.next;
+        inodes[node.next].prev = node.prev;
+        if (firstChild(inodes, node.parent) == slot)
+            setFirstChild(inodes, node.parent, node.next);
+    }
+    node.next = node.prev = NO_INODE;
 }
 
-vector<string> DirTree::splitPath(const string& path) {
-    vector<string> parts;
-    string temp;
-    for (char c : path) 
+// Adds to the totals of dir and every directory above it; negative amounts
+// subtract, relying on unsigned wrap-around.
+void DirTree::addUsage(const InodeTable& inodes, uint32_t dir, int64_t bytes, int64_t blocks, int64_t files)
+{
+    for (uint32_t up = dir; up != NO_INODE; up = inodes[up].parent)
     {
-        if (c == '/') 
-        {
-            if (!temp.empty()) 
-            {
-                parts.push_back(temp);
-                temp.clear();
-            }
-        } 
-        else 
-        {
-            temp.push_back(c);
-        }
+        DirUsage& u = usage_[up];
+        u.bytes += static_cast<uint64_t>(bytes);
+        u.blocks += static_cast<uint64_t>(blocks);
+        u.files += static_cast<uint64_t>(files);
     }
-    if (!temp.empty()) 
+    top_usage_.bytes += static_cast<uint64_t>(bytes);
+    top_usage_.blocks += static_cast<uint64_t>(blocks);
+    top_usage_.files += static_cast<uint64_t>(files);
+}
+
+bool DirTree::resolve(const InodeTable& inodes, const char* path, uint32_t& slot) const
+{
+    slot = NO_INODE;
+    string_view part;
+    while (next_component(path, part))
     {
-        parts.push_back(temp);
+        if (slot != NO_INODE && inodes[slot].type != DIR_TYPE)
+            return false;
+        slot = index_.find(inodes, slot, part);
+        if (slot == NO_INODE)
+            return false;
     }
-    return parts;
+    return true;
 }
 
-DirTree::Node* DirTree::findNode(const string& path) const 
+uint32_t DirTree::lookup(const InodeTable& inodes, const char* path) const
 {
-    if (path == "/" || path.empty()) 
+    uint32_t slot;
+    return resolve(inodes, path, slot) ? slot : NO_INODE;
+}
+
+uint32_t DirTree::findParent(const InodeTable& inodes, const char* path, string_view& leaf, OFSErrorCodes& err) const
+{
+    err = OFSErrorCodes::ERROR_INVALID_PATH;
+    size_t len = strlen(path);
+    if (path[0] != '/' || len < 2 || len >= sizeof(FileMetadata::path) || path[len - 1] == '/'
+        || strstr(path, "//"))
     {
-        return root_;
+        return NO_INODE;
     }
-    vector<string> parts = splitPath(path);
-    Node* cur = root_;
-    for (auto& part : parts) 
+
+    const char* slash = strrchr(path, '/');
+    leaf = string_view(slash + 1);
+    if (leaf.size() >= sizeof(FileEntry::name))
     {
-        bool found = false;
-        for (auto child : cur->children) 
-        {
-            if (child->entry.name == part) 
-            {
-                cur = child;
-                found = true;
-                break;
-            }
-        }
-        if (!found) 
-        {
-            return nullptr;
-        }
+        return NO_INODE;
     }
-    return cur;
-}
 
-DirTree::Node* DirTree::createPathNodes(const vector<string>& components, bool createLast, const FileEntry* entry) {
-    Node* cur = root_;
-    for (size_t i = 0; i < components.size(); ++i) 
+    uint32_t dir = NO_INODE;
+    string_view part;
+    const char* p = path;
+    while (p < slash && next_component(p, part))
     {
-        const string& part = components[i];
-        Node* found = nullptr;
-        for (auto child : cur->children) 
+        if (part.size() >= sizeof(FileEntry::name))
         {
-            if (child->entry.name == part) 
-            {
-                found = child;
-                break;
-            }
+            return NO_INODE;
         }
-
-        if (!found) 
+        if (dir != NO_INODE && inodes[dir].type != DIR_TYPE)
         {
-            if (i == components.size() - 1 && !createLast) 
-            {
-                return nullptr;
-            }
-            FileEntry fe = (i == components.size() - 1 && entry)? *entry : FileEntry(part, EntryType::DIRECTORY, 0, 0755, "root", 0);
-            Node* newNode = new Node(fe);
-            newNode->parent = cur;
-            cur->children.push_back(newNode);
-            cur = newNode;
-        } 
-        else 
+            err = OFSErrorCodes::ERROR_INVALID_OPERATION;
+            return NO_INODE;
+        }
+        dir = index_.find(inodes, dir, part);
+        if (dir == NO_INODE)
         {
-            cur = found;
+            err = OFSErrorCodes::ERROR_NOT_FOUND;
+            return NO_INODE;
         }
     }
-    return cur;
+    if (dir != NO_INODE && inodes[dir].type != DIR_TYPE)
+    {
+        err = OFSErrorCodes::ERROR_INVALID_OPERATION;
+        return NO_INODE;
+    }
+    err = OFSErrorCodes::SUCCESS;
+    return dir;
 }
 
-OFSErrorCodes DirTree::createEntry(const string& path, const FileEntry& entry) 
+OFSErrorCodes DirTree::canCreate(const InodeTable& inodes, const char* path) const
 {
-    if (path.empty() || path[0] != '/') 
+    string_view leaf;
+    OFSErrorCodes err;
+    uint32_t parent = findParent(inodes, path, leaf, err);
+    if (err != OFSErrorCodes::SUCCESS)
     {
-        return OFSErrorCodes::ERROR_INVALID_PATH;
+        return err;
     }
-    vector<string> parts = splitPath(path);
-    if (parts.empty()) 
+    return index_.find(inodes, parent, leaf) != NO_INODE ? OFSErrorCodes::ERROR_FILE_EXISTS : OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes DirTree::link(InodeTable& inodes, uint32_t slot, const char* path)
+{
+    OFSErrorCodes err = canCreate(inodes, path);
+    if (err != OFSErrorCodes::SUCCESS)
     {
-        return OFSErrorCodes::ERROR_INVALID_OPERATION;
+        return err;
     }
 
-    vector<string> parent_parts(parts.begin(), parts.end() - 1);
-    Node* parent = root_;
-    if (!parent_parts.empty()) 
+    string_view leaf;
+    inodes[slot].parent = findParent(inodes, path, leaf, err);
+    inodes.setName(slot, leaf);
+    attach(inodes, slot);
+
+    if (usage_.size() < inodes.slots())
     {
-        parent = createPathNodes(parent_parts, false, nullptr);
-        if (!parent) 
-        {
-            return OFSErrorCodes::ERROR_INVALID_PATH;
-        }
-        if (parent->entry.getType() != EntryType::DIRECTORY)
+        usage_.resize(inodes.slots());
+    }
+    DirUsage& u = usage_[slot];
+    u = DirUsage{};
+    if (inodes[slot].getType() == EntryType::FILE)
+    {
+        u = DirUsage{inodes[slot].size, inodes[slot].blocks, 1};
+    }
+    addUsage(inodes, inodes[slot].parent, static_cast<int64_t>(u.bytes), static_cast<int64_t>(u.blocks),
+             static_cast<int64_t>(u.files));
+    return OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes DirTree::unlink(InodeTable& inodes, uint32_t slot)
+{
+    if (inodes[slot].child != NO_INODE)
+    {
+        return OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY;
+    }
+    detach(inodes, slot);
+
+    DirUsage& u = usage_[slot];
+    addUsage(inodes, inodes[slot].parent, -static_cast<int64_t>(u.bytes), -static_cast<int64_t>(u.blocks),
+             -static_cast<int64_t>(u.files));
+    u = DirUsage{};
+    return OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes DirTree::move(InodeTable& inodes, uint32_t slot, const char* path)
+{
+    string_view leaf;
+    OFSErrorCodes err;
+    uint32_t parent = findParent(inodes, path, leaf, err);
+    if (err != OFSErrorCodes::SUCCESS)
+    {
+        return err;
+    }
+    uint32_t existing = index_.find(inodes, parent, leaf);
+    if (existing == slot)
+    {
+        return OFSErrorCodes::SUCCESS;
+    }
+    if (existing != NO_INODE)
+    {
+        return OFSErrorCodes::ERROR_FILE_EXISTS;
+    }
+    for (uint32_t up = parent; up != NO_INODE; up = inodes[up].parent)
+    {
+        if (up == slot)
         {
             return OFSErrorCodes::ERROR_INVALID_OPERATION;
         }
     }
 
-    string name = parts.back();
-    for (auto child : parent->children) 
+    const DirUsage& u = usage_[slot];
+    addUsage(inodes, inodes[slot].parent, -static_cast<int64_t>(u.bytes), -static_cast<int64_t>(u.blocks),
+             -static_cast<int64_t>(u.files));
+    detach(inodes, slot);
+    inodes[slot].parent = parent;
+    inodes.setName(slot, leaf);
+    attach(inodes, slot);
+    addUsage(inodes, parent, static_cast<int64_t>(u.bytes), static_cast<int64_t>(u.blocks),
+             static_cast<int64_t>(u.files));
+    return OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes DirTree::usage(const InodeTable& inodes, const char* path, DirUsage& out) const
+{
+    uint32_t slot;
+    if (!resolve(inodes, path, slot))
     {
-        if (child->entry.name == name)
-        {
-            return OFSErrorCodes::ERROR_FILE_EXISTS;
-        }
+        return OFSErrorCodes::ERROR_NOT_FOUND;
+    }
+    out = slot == NO_INODE ? top_usage_ : usage_[slot];
+    return OFSErrorCodes::SUCCESS;
+}
+
+void DirTree::sync(const InodeTable& inodes, uint32_t slot)
+{
+    if (inodes[slot].getType() != EntryType::FILE)
+    {
+        return;
+    }
+    DirUsage& u = usage_[slot];
+    int64_t bytes = static_cast<int64_t>(inodes[slot].size - u.bytes);
+    int64_t blocks = static_cast<int64_t>(inodes[slot].blocks - u.blocks);
+    if (bytes == 0 && blocks == 0)
+    {
+        return;
+    }
+    u.bytes = inodes[slot].size;
+    u.blocks = inodes[slot].blocks;
+    addUsage(inodes, inodes[slot].parent, bytes, blocks, 0);
+}
+
+OFSErrorCodes DirTree::listDirectory(const InodeTable& inodes, const char* dirpath, vector<uint32_t>& out) const
+{
+    uint32_t dir;
+    if (!resolve(inodes, dirpath, dir)) return OFSErrorCodes::ERROR_NOT_FOUND;
+    if (dir != NO_INODE && inodes[dir].type != DIR_TYPE)
+    {
+        return OFSErrorCodes::ERROR_INVALID_OPERATION;
     }
 
-    Node* newNode = new Node(entry);
-    newNode->parent = parent;
-    parent->children.push_back(newNode);
+    uint32_t head = firstChild(inodes, dir);
+    if (head == NO_INODE)
+    {
+        return OFSErrorCodes::SUCCESS;
+    }
+    uint32_t s = head;
+    do
+    {
+        out.push_back(s);
+        s = inodes[s].next;
+    } while (s != head);
     return OFSErrorCodes::SUCCESS;
 }
 
-OFSErrorCodes DirTree::removeEntry(const string& path) 
+OFSErrorCodes DirTree::listPage(const InodeTable& inodes, const char* dirpath, uint32_t from, size_t limit,
+                                vector<uint32_t>& out, uint32_t& next) const
 {
-    if (path.empty() || path == "/") 
+    next = NO_INODE;
+    uint32_t dir;
+    if (!resolve(inodes, dirpath, dir)) return OFSErrorCodes::ERROR_NOT_FOUND;
+    if (dir != NO_INODE && inodes[dir].type != DIR_TYPE)
     {
         return OFSErrorCodes::ERROR_INVALID_OPERATION;
     }
-    Node* node = findNode(path);
-    if (!node) 
+
+    uint32_t head = firstChild(inodes, dir);
+    if (from == NO_INODE)
+    {
+        from = head;
+    }
+    else if (from >= inodes.slots() || !inodes.used(from) || inodes[from].parent != dir)
     {
         return OFSErrorCodes::ERROR_NOT_FOUND;
     }
-    if (!node->children.empty()) 
+    if (from == NO_INODE)
     {
-        return OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY;
+        return OFSErrorCodes::SUCCESS;
     }
 
-    Node* parent = node->parent;
-    if (!parent) 
+    uint32_t s = from;
+    while (out.size() < limit)
     {
-        return OFSErrorCodes::ERROR_INVALID_OPERATION;
+        out.push_back(s);
+        s = inodes[s].next;
+        if (s == head)
+        {
+            return OFSErrorCodes::SUCCESS;
+        }
     }
+    next = s;
+    return OFSErrorCodes::SUCCESS;
+}
 
-    for (auto it = parent->children.begin(); it != parent->children.end(); ++it) 
+void DirTree::glob(const InodeTable& inodes, const char* pattern, vector<uint32_t>& out) const
+{
+    vector<string> parts;
+    string_view part;
+    while (next_component(pattern, part))
+    {
+        parts.emplace_back(part);
+    }
+    if (!parts.empty())
     {
-        if (*it == node) 
+        globFrom(inodes, NO_INODE, parts, 0, out);
+    }
+}
+
+// dir (NO_INODE for the root) has matched parts[0, k).
+void DirTree::globFrom(const InodeTable& inodes, uint32_t dir, const vector<string>& parts, size_t k,
+                       vector<uint32_t>& out) const
+{
+    if (k == parts.size())
+    {
+        out.push_back(dir);
+        return;
+    }
+    if (dir != NO_INODE && inodes[dir].type != DIR_TYPE)
+    {
+        return;
+    }
+
+    const string& part = parts[k];
+    if (part == "**")
+    {
+        if (k + 1 == parts.size())
         {
-            parent->children.erase(it);
-            delete node;
-            return OFSErrorCodes::SUCCESS;
+            addDescendants(inodes, dir, out);
+            return;
+        }
+        globFrom(inodes, dir, parts, k + 1, out);
+    }
+    else if (part.find_first_of("*?[\\") == string::npos)
+    {
+        uint32_t child = index_.find(inodes, dir, part);
+        if (child != NO_INODE)
+        {
+            globFrom(inodes, child, parts, k + 1, out);
         }
+        return;
+    }
+
+    uint32_t head = firstChild(inodes, dir);
+    if (head == NO_INODE)
+    {
+        return;
     }
-    return OFSErrorCodes::ERROR_NOT_FOUND;
+    uint32_t s = head;
+    do
+    {
+        if (part == "**")
+        {
+            if (inodes[s].type == DIR_TYPE)
+            {
+                globFrom(inodes, s, parts, k, out);
+            }
+        }
+        else if (fnmatch(part.c_str(), string(inodes.name(s)).c_str(), 0) == 0)
+        {
+            globFrom(inodes, s, parts, k + 1, out);
+        }
+        s = inodes[s].next;
+    } while (s != head);
 }
 
-FileEntry* DirTree::findEntry(const string& path) const 
+void DirTree::addDescendants(const InodeTable& inodes, uint32_t dir, vector<uint32_t>& out) const
 {
-    Node* node = findNode(path);
-    return node ? &node->entry : nullptr;
+    size_t from = out.size();
+    uint32_t head = firstChild(inodes, dir);
+    for (;;)
+    {
+        if (head != NO_INODE)
+        {
+            uint32_t s = head;
+            do
+            {
+                out.push_back(s);
+                s = inodes[s].next;
+            } while (s != head);
+        }
+        // Every entry added since `from` is expanded once, in order.
+        while (from < out.size() && inodes[out[from]].child == NO_INODE)
+        {
+            from++;
+        }
+        if (from == out.size())
+        {
+            return;
+        }
+        head = inodes[out[from++]].child;
+    }
 }
 
-OFSErrorCodes DirTree::listDirectory(const string& dirpath, vector<FileEntry>& out) const 
+OFSErrorCodes DirTree::rebuild(InodeTable& inodes)
 {
-    Node* n = findNode(dirpath);
-    if (!n) return OFSErrorCodes::ERROR_NOT_FOUND;
-    if (n->entry.getType() != EntryType::DIRECTORY)
+    clear();
+    for (uint32_t s = 0; s < inodes.slots(); ++s)
     {
-        return OFSErrorCodes::ERROR_INVALID_OPERATION;
+        if (inodes.used(s))
+            inodes[s].child = NO_INODE;
     }
 
-    for (auto child : n->children)
+    for (uint32_t s = 0; s < inodes.slots(); ++s)
     {
-        out.push_back(child->entry);
+        if (!inodes.used(s))
+            continue;
+        uint32_t parent = inodes[s].parent;
+        if (parent != NO_INODE && (!inodes.used(parent) || inodes[parent].type != DIR_TYPE || parent == s))
+        {
+            return OFSErrorCodes::ERROR_INVALID_PATH;
+        }
+        if (inodes[s].name_len == 0 || index_.find(inodes, parent, inodes.name(s)) != NO_INODE)
+        {
+            return OFSErrorCodes::ERROR_FILE_EXISTS;
+        }
+        attach(inodes, s);
+    }
+
+    // Totals: each file adds itself to every directory above it.
+    usage_.assign(inodes.slots(), DirUsage{});
+    for (uint32_t s = 0; s < inodes.slots(); ++s)
+    {
+        if (!inodes.used(s) || inodes[s].getType() != EntryType::FILE)
+            continue;
+        usage_[s] = DirUsage{inodes[s].size, inodes[s].blocks, 1};
+        size_t depth = 0;
+        for (uint32_t up = inodes[s].parent; up != NO_INODE; up = inodes[up].parent)
+        {
+            if (++depth > inodes.slots())
+            {
+                return OFSErrorCodes::ERROR_INVALID_PATH;
+            }
+        }
+        addUsage(inodes, inodes[s].parent, static_cast<int64_t>(inodes[s].size), inodes[s].blocks, 1);
     }
     return OFSErrorCodes::SUCCESS;
 }
 
-void DirTree::printTree() const 
+size_t DirTree::size() const
+{
+    return index_.size();
+}
+
+void DirTree::printTree(const InodeTable& inodes) const
 {
-    vector<pair<Node*, int>> stack = {{root_, 0}};
-    while (!stack.empty()) 
+    cout << "/\n";
+    vector<pair<uint32_t, int>> stack;
+    vector<uint32_t> kids;
+    listDirectory(inodes, "/", kids);
+    for (auto it = kids.rbegin(); it != kids.rend(); ++it)
     {
-        auto [node, level] = stack.back();
+        stack.push_back({*it, 1});
+    }
+
+    while (!stack.empty())
+    {
+        auto [slot, level] = stack.back();
         stack.pop_back();
 
         for (int i = 0; i < level; ++i) cout << "  ";
-        cout << node->entry.name;
-        if (node->entry.getType() == EntryType::DIRECTORY)
+        cout << inodes.name(slot);
+        if (inodes[slot].type == DIR_TYPE)
         {
             cout << "/";
         }
         cout << "\n";
 
-        for (auto it = node->children.rbegin(); it != node->children.rend(); ++it) 
+        uint32_t head = inodes[slot].child;
+        if (head == NO_INODE)
         {
-            stack.push_back({*it, level + 1});
+            continue;
         }
+        uint32_t s = inodes[head].prev;
+        do
+        {
+            stack.push_back({s, level + 1});
+            s = inodes[s].prev;
+        } while (s != inodes[head].prev);
     }
 }
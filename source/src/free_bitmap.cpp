@@ -1,8 +1,20 @@
 #include "../include/free_bitmap.hpp"
-#include <cstring>
+#include <algorithm>
 using namespace std;
 
-FreeBitmap::FreeBitmap() : bitmap_(), blocks_(0) {}
+static const uint64_t ALL_USED = ~0ULL;
+
+static inline unsigned int ctz64(uint64_t v)
+{
+    return static_cast<unsigned int>(__builtin_ctzll(v));
+}
+
+static inline unsigned int popcount64(uint64_t v)
+{
+    return static_cast<unsigned int>(__builtin_popcountll(v));
+}
+
+FreeBitmap::FreeBitmap() : words_(), full_(), blocks_(0), free_(0), runs_(0), cursor_(0), extra_refs_(), unshared_(), shared_(0) {}
 
 FreeBitmap::FreeBitmap(unsigned int total_blocks) 
 {
@@ -12,33 +24,149 @@ FreeBitmap::FreeBitmap(unsigned int total_blocks)
 void FreeBitmap::init(unsigned int total_blocks) 
 {
     blocks_ = total_blocks;
-    unsigned int bytes = (total_blocks + 7) / 8;
-    bitmap_.assign(bytes, 0);
+    free_ = total_blocks;
+    cursor_ = 0;
+    extra_refs_.clear();
+    unshared_.clear();
+    shared_ = 0;
+
+    size_t nwords = (static_cast<size_t>(total_blocks) + 63) / 64;
+    words_.assign(nwords, 0);
+    full_.assign((nwords + 63) / 64, 0);
+
+    // Bits past the last block are permanently "used" so they are never
+    // handed out and never counted.
+    unsigned int tail = total_blocks % 64;
+    if (tail != 0)
+    {
+        words_.back() = ALL_USED << tail;
+    }
+
+    runs_ = 0;
+    for (size_t w = 0; w < nwords; ++w)
+    {
+        runs_ += runStarts(w);
+    }
+}
+
+void FreeBitmap::grow(unsigned int total_blocks)
+{
+    if (total_blocks <= blocks_)
+    {
+        return;
+    }
+
+    // New words start out used, then the new blocks (and the padding bits
+    // of the old last word) are freed through storeWord so the counters and
+    // the summary stay in step.
+    size_t nwords = (static_cast<size_t>(total_blocks) + 63) / 64;
+    size_t old_words = words_.size();
+    words_.resize(nwords, ALL_USED);
+    full_.resize((nwords + 63) / 64, 0);
+    for (size_t w = old_words; w < nwords; ++w)
+    {
+        full_[w / 64] |= 1ULL << (w % 64);
+    }
+
+    unsigned int old = blocks_;
+    blocks_ = total_blocks;
+    clearRun(old, total_blocks - old);
+}
+
+void FreeBitmap::setGrowHandler(function<bool(unsigned int more)> handler)
+{
+    grow_handler_ = handler;
 }
 
-void FreeBitmap::setBit(vector<unsigned char>& bm, unsigned int pos) 
+bool FreeBitmap::reserve(unsigned int n)
 {
-    if (pos / 8 < bm.size())
+    if (n <= free_)
     {
-        bm[pos / 8] |= (1u << (pos % 8));
+        return true;
     }
+    return grow_handler_ && grow_handler_(n - free_) && n <= free_;
 }
 
-void FreeBitmap::clearBit(vector<unsigned char>& bm, unsigned int pos) 
+unsigned int FreeBitmap::runStarts(size_t w) const
 {
-    if (pos / 8 < bm.size())
+    uint64_t f = ~words_[w];
+    uint64_t carry = (w > 0) ? (~words_[w - 1] >> 63) : 0;
+    return popcount64(f & ~((f << 1) | carry));
+}
+
+void FreeBitmap::storeWord(size_t w, uint64_t v)
+{
+    // A word change can only start or end runs in this word and the first
+    // bit of the next one.
+    bool has_next = w + 1 < words_.size();
+    runs_ -= runStarts(w) + (has_next ? runStarts(w + 1) : 0);
+
+    free_ += popcount64(words_[w]);
+    free_ -= popcount64(v);
+    words_[w] = v;
+
+    runs_ += runStarts(w) + (has_next ? runStarts(w + 1) : 0);
+    if (v == ALL_USED)
+    {
+        full_[w / 64] |= 1ULL << (w % 64);
+    }
+    else
     {
-        bm[pos / 8] &= static_cast<unsigned char>(~(1u << (pos % 8)));
+        full_[w / 64] &= ~(1ULL << (w % 64));
     }
 }
 
-bool FreeBitmap::testBit(const vector<unsigned char>& bm, unsigned int pos) 
+void FreeBitmap::setBit(unsigned int pos) 
 {
-    if (pos / 8 >= bm.size()) 
+    size_t w = pos / 64;
+    uint64_t mask = 1ULL << (pos % 64);
+    if (!(words_[w] & mask))
+    {
+        storeWord(w, words_[w] | mask);
+    }
+}
+
+void FreeBitmap::clearBit(unsigned int pos) 
+{
+    size_t w = pos / 64;
+    uint64_t mask = 1ULL << (pos % 64);
+    if (words_[w] & mask)
+    {
+        storeWord(w, words_[w] & ~mask);
+    }
+}
+
+bool FreeBitmap::testBit(unsigned int pos) const 
+{
+    if (pos >= blocks_) 
     {
         return false;
     }
-    return (bm[pos / 8] & (1u << (pos % 8))) != 0;
+    return (words_[pos / 64] >> (pos % 64)) & 1ULL;
+}
+
+size_t FreeBitmap::nextFreeWord(size_t from) const
+{
+    size_t nwords = words_.size();
+    size_t s = from / 64;
+    if (s >= full_.size())
+    {
+        return nwords;
+    }
+
+    // Ignore summary bits below `from` in the first summary word.
+    uint64_t open = ~full_[s] & (ALL_USED << (from % 64));
+    while (open == 0)
+    {
+        if (++s >= full_.size())
+        {
+            return nwords;
+        }
+        open = ~full_[s];
+    }
+
+    size_t w = s * 64 + ctz64(open);
+    return w < nwords ? w : nwords;
 }
 
 pair<OFSErrorCodes, vector<unsigned int>> FreeBitmap::allocateBlocks(unsigned int n) 
@@ -47,16 +175,57 @@ pair<OFSErrorCodes, vector<unsigned int>> FreeBitmap::allocateBlocks(unsigned in
     {
         return {OFSErrorCodes::ERROR_INVALID_OPERATION, {}};
     }
+    if (!reserve(n))
+    {
+        return {OFSErrorCodes::ERROR_NO_SPACE, {}};
+    }
 
     vector<unsigned int> allocated;
     allocated.reserve(n);
 
-    for (unsigned int i = 0; i < blocks_ && allocated.size() < n; ++i) 
+    // Next-fit: scan from the cursor to the end, then wrap around once.
+    // free_ >= n guarantees the two passes find enough bits.
+    size_t nwords = words_.size();
+    size_t w = cursor_ < nwords ? cursor_ : 0;
+    bool wrapped = false;
+    while (allocated.size() < n)
     {
-        if (!testBit(bitmap_, i)) 
+        w = nextFreeWord(w);
+        if (w >= nwords)
+        {
+            if (wrapped)
+            {
+                break;
+            }
+            wrapped = true;
+            w = 0;
+            continue;
+        }
+
+        uint64_t avail = ~words_[w];
+        unsigned int want = n - static_cast<unsigned int>(allocated.size());
+        if (popcount64(avail) <= want)
         {
-            setBit(bitmap_, i);
-            allocated.push_back(i);
+            // Take the whole word in one go.
+            storeWord(w, ALL_USED);
+            for (; avail != 0; avail &= avail - 1)
+            {
+                allocated.push_back(static_cast<unsigned int>(w * 64 + ctz64(avail)));
+            }
+            ++w;
+            continue;
+        }
+        while (avail != 0 && allocated.size() < n)
+        {
+            unsigned int bit = ctz64(avail);
+            avail &= avail - 1;
+            unsigned int pos = static_cast<unsigned int>(w * 64 + bit);
+            setBit(pos);
+            allocated.push_back(pos);
+        }
+        if (avail == 0)
+        {
+            ++w;
         }
     }
 
@@ -64,38 +233,347 @@ pair<OFSErrorCodes, vector<unsigned int>> FreeBitmap::allocateBlocks(unsigned in
     {
         for (unsigned int b : allocated)
         {
-            clearBit(bitmap_, b);
+            clearBit(b);
         }
 
         return {OFSErrorCodes::ERROR_NO_SPACE, {}};
     }
 
+    cursor_ = w;
     return {OFSErrorCodes::SUCCESS, allocated};
 }
 
+void FreeBitmap::setRun(unsigned int start, unsigned int len)
+{
+    unsigned int end = start + len;
+    while (start < end)
+    {
+        size_t w = start / 64;
+        unsigned int lo = start % 64;
+        unsigned int n = min(64 - lo, end - start);
+        uint64_t mask = (n == 64 ? ALL_USED : ((1ULL << n) - 1)) << lo;
+        storeWord(w, words_[w] | mask);
+        start += n;
+    }
+}
+
+void FreeBitmap::clearRun(unsigned int start, unsigned int len)
+{
+    unsigned int end = start + len;
+    while (start < end)
+    {
+        size_t w = start / 64;
+        unsigned int lo = start % 64;
+        unsigned int n = min(64 - lo, end - start);
+        uint64_t mask = (n == 64 ? ALL_USED : ((1ULL << n) - 1)) << lo;
+        storeWord(w, words_[w] & ~mask);
+        start += n;
+    }
+}
+
+unsigned int FreeBitmap::findFree(unsigned int from) const
+{
+    if (from >= blocks_)
+    {
+        return blocks_;
+    }
+
+    size_t w = from / 64;
+    uint64_t avail = ~words_[w] & (ALL_USED << (from % 64));
+    if (avail == 0)
+    {
+        w = nextFreeWord(w + 1);
+        if (w >= words_.size())
+        {
+            return blocks_;
+        }
+        avail = ~words_[w];
+    }
+    return static_cast<unsigned int>(w * 64 + ctz64(avail));
+}
+
+unsigned int FreeBitmap::nextUsed(unsigned int from) const
+{
+    return findUsed(from);
+}
+
+unsigned int FreeBitmap::findUsed(unsigned int from) const
+{
+    if (from >= blocks_)
+    {
+        return blocks_;
+    }
+
+    size_t w = from / 64;
+    uint64_t used = words_[w] & (ALL_USED << (from % 64));
+    while (used == 0)
+    {
+        if (++w >= words_.size())
+        {
+            return blocks_;
+        }
+        used = words_[w];
+    }
+    size_t pos = w * 64 + ctz64(used);
+    return pos < blocks_ ? static_cast<unsigned int>(pos) : blocks_;
+}
+
+bool FreeBitmap::findRun(unsigned int from, unsigned int to, unsigned int n, unsigned int& start) const
+{
+    unsigned int p = findFree(from);
+    while (p < to)
+    {
+        unsigned int e = findUsed(p);
+        if (e - p >= n)
+        {
+            start = p;
+            return true;
+        }
+        p = findFree(e);
+    }
+    return false;
+}
+
+pair<OFSErrorCodes, vector<Extent>> FreeBitmap::allocateExtent(unsigned int n, unsigned int hint)
+{
+    if (n == 0)
+    {
+        return {OFSErrorCodes::ERROR_INVALID_OPERATION, {}};
+    }
+    if (!reserve(n))
+    {
+        return {OFSErrorCodes::ERROR_NO_SPACE, {}};
+    }
+
+    vector<Extent> out;
+    unsigned int left = n;
+
+    // Grow in place behind the previous extent when possible.
+    if (hint < blocks_ && !testBit(hint))
+    {
+        unsigned int len = min(left, findUsed(hint) - hint);
+        setRun(hint, len);
+        out.push_back({hint, len});
+        left -= len;
+    }
+
+    unsigned int origin = static_cast<unsigned int>(min<size_t>(cursor_ * 64, blocks_));
+    if (left > 0)
+    {
+        unsigned int start;
+        if (findRun(origin, blocks_, left, start) || findRun(0, origin, left, start))
+        {
+            setRun(start, left);
+            out.push_back({start, left});
+            left = 0;
+        }
+    }
+
+    // No single run is big enough: take whatever runs come next. free_ >= n
+    // guarantees this terminates within one lap.
+    unsigned int p = origin;
+    while (left > 0)
+    {
+        p = findFree(p);
+        if (p >= blocks_)
+        {
+            p = findFree(0);
+        }
+        unsigned int len = min(left, findUsed(p) - p);
+        setRun(p, len);
+        out.push_back({p, len});
+        left -= len;
+        p += len;
+    }
+
+    const Extent& last = out.back();
+    cursor_ = (static_cast<size_t>(last.start) + last.length) / 64;
+    return {OFSErrorCodes::SUCCESS, out};
+}
+
+void FreeBitmap::release(unsigned int block)
+{
+    auto it = extra_refs_.find(block);
+    if (it == extra_refs_.end())
+    {
+        clearBit(block);
+        unshared_.erase(block);
+        return;
+    }
+    --shared_;
+    if (--it->second == 0)
+    {
+        extra_refs_.erase(it);
+        unshared_.insert(block);
+    }
+}
+
 OFSErrorCodes FreeBitmap::freeBlocks(const vector<unsigned int>& blocks) 
 {
     for (unsigned int b : blocks) 
     {
         if (b < blocks_) 
         {
-            clearBit(bitmap_, b);
+            release(b);
         }
     }
     return OFSErrorCodes::SUCCESS;
 }
 
-unsigned int FreeBitmap::freeCount() const 
+OFSErrorCodes FreeBitmap::freeExtents(const vector<Extent>& extents)
+{
+    for (const Extent& e : extents)
+    {
+        if (e.start >= blocks_ || e.length > blocks_ - e.start)
+        {
+            continue;
+        }
+        if (!hasShared(e))
+        {
+            clearRun(e.start, e.length);
+            for (uint32_t i = 0; !unshared_.empty() && i < e.length; ++i)
+            {
+                unshared_.erase(e.start + i);
+            }
+            continue;
+        }
+        for (uint32_t i = 0; i < e.length; ++i)
+        {
+            release(e.start + i);
+        }
+    }
+    return OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes FreeBitmap::markUsed(const vector<unsigned int>& blocks) 
+{
+    for (unsigned int b : blocks) 
+    {
+        if (b >= blocks_) 
+        {
+            return OFSErrorCodes::ERROR_INVALID_OPERATION;
+        }
+        if (testBit(b))
+        {
+            addRef(b);
+        }
+        else
+        {
+            setBit(b);
+        }
+    }
+    return OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes FreeBitmap::markUsed(const vector<Extent>& extents)
 {
-    unsigned int count = 0;
-    for (unsigned int i = 0; i < blocks_; ++i) 
+    for (const Extent& e : extents)
     {
-        if (!testBit(bitmap_, i))
+        if (e.start >= blocks_ || e.length > blocks_ - e.start)
         {
-            ++count;
+            return OFSErrorCodes::ERROR_INVALID_OPERATION;
         }
+        if (findUsed(e.start) >= e.start + e.length)
+        {
+            setRun(e.start, e.length);
+            continue;
+        }
+        for (uint32_t i = 0; i < e.length; ++i)
+        {
+            if (testBit(e.start + i))
+            {
+                addRef(e.start + i);
+            }
+            else
+            {
+                setBit(e.start + i);
+            }
+        }
+    }
+    return OFSErrorCodes::SUCCESS;
+}
+
+OFSErrorCodes FreeBitmap::addRef(unsigned int block)
+{
+    if (!testBit(block))
+    {
+        return OFSErrorCodes::ERROR_INVALID_OPERATION;
+    }
+    ++extra_refs_[block];
+    ++shared_;
+    return OFSErrorCodes::SUCCESS;
+}
+
+uint32_t FreeBitmap::refCount(unsigned int block) const
+{
+    if (!testBit(block))
+    {
+        return 0;
+    }
+    auto it = extra_refs_.find(block);
+    return it == extra_refs_.end() ? 1 : 1 + it->second;
+}
+
+bool FreeBitmap::hasShared(const Extent& e) const
+{
+    if (extra_refs_.empty())
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < e.length; ++i)
+    {
+        if (extra_refs_.count(e.start + i))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FreeBitmap::wasShared(unsigned int block) const
+{
+    return extra_refs_.count(block) || unshared_.count(block);
+}
+
+bool FreeBitmap::wasShared(const Extent& e) const
+{
+    if (unshared_.empty())
+    {
+        return hasShared(e);
     }
-    return count;
+    for (uint32_t i = 0; i < e.length; ++i)
+    {
+        if (wasShared(e.start + i))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FreeBitmap::forgetUnshared()
+{
+    unshared_.clear();
+}
+
+uint64_t FreeBitmap::sharedRefs() const
+{
+    return shared_;
+}
+
+bool FreeBitmap::isUsed(unsigned int block) const
+{
+    return testBit(block);
+}
+
+unsigned int FreeBitmap::freeCount() const 
+{
+    return free_;
+}
+
+unsigned int FreeBitmap::freeRuns() const
+{
+    return runs_;
 }
 
 unsigned int FreeBitmap::totalBlocks() const 
@@ -0,0 +1,85 @@
+#include "../include/fs_config.hpp"
+#include "../include/odf_types.hpp"
+#include <fstream>
+#include <cctype>
+
+using namespace std;
+
+static string trim_value(const string& s)
+{
+    size_t a = 0;
+    while (a < s.size() && isspace((unsigned char)s[a])) ++a;
+    size_t b = s.size();
+    while (b > a && isspace((unsigned char)s[b - 1])) --b;
+    string v = s.substr(a, b - a);
+    if (v.size() >= 2 && v.front() == '"' && v.back() == '"')
+        v = v.substr(1, v.size() - 2);
+    return v;
+}
+
+static bool parse_u64(const string& v, uint64_t& out)
+{
+    if (v.empty()) return false;
+    uint64_t n = 0;
+    for (char c : v)
+    {
+        if (!isdigit((unsigned char)c)) return false;
+        n = n * 10 + static_cast<uint64_t>(c - '0');
+    }
+    out = n;
+    return true;
+}
+
+int load_config(const char* config_path, FSConfig& out)
+{
+    if (!config_path)
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+
+    ifstream ifs(config_path);
+    if (!ifs)
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+
+    string line;
+    while (getline(ifs, line))
+    {
+        size_t hash = line.find('#');
+        if (hash != string::npos) line.erase(hash);
+        line = trim_value(line);
+        if (line.empty() || line[0] == '[') continue;
+
+        size_t eq = line.find('=');
+        if (eq == string::npos) continue;
+
+        string key = trim_value(line.substr(0, eq));
+        uint64_t n = 0;
+        if (!parse_u64(trim_value(line.substr(eq + 1)), n)) continue;
+
+        if (key == "total_size") out.total_size = n;
+        else if (key == "block_size") out.block_size = n;
+        else if (key == "max_users") out.max_users = static_cast<uint32_t>(n);
+        else if (key == "mmap_budget") out.mmap_budget = n;
+        else if (key == "change_log_size") out.change_log_size = n;
+        else if (key == "commit_window_us") out.commit_window_us = static_cast<uint32_t>(n);
+        else if (key == "checkpoint_interval") out.checkpoint_interval = static_cast<uint32_t>(n);
+        else if (key == "checkpoint_log_percent") out.checkpoint_log_percent = static_cast<uint32_t>(n);
+        else if (key == "defrag_step_blocks") out.defrag_step_blocks = static_cast<uint32_t>(n);
+        else if (key == "defrag_interval_ms") out.defrag_interval_ms = static_cast<uint32_t>(n);
+        else if (key == "defrag_min_percent") out.defrag_min_percent = static_cast<uint32_t>(n);
+        else if (key == "vault_size") out.vault_size = n;
+        else if (key == "vault_keyframe_interval") out.vault_keyframe_interval = static_cast<uint32_t>(n);
+        else if (key == "dedup") out.dedup = static_cast<uint32_t>(n);
+        else if (key == "compression") out.compression = static_cast<uint32_t>(n);
+        else if (key == "checksums") out.checksums = static_cast<uint32_t>(n);
+        else if (key == "max_size") out.max_size = n;
+        else if (key == "grow_step") out.grow_step = n;
+        else if (key == "scrub_step_blocks") out.scrub_step_blocks = static_cast<uint32_t>(n);
+        else if (key == "scrub_interval_ms") out.scrub_interval_ms = static_cast<uint32_t>(n);
+        else if (key == "index_step_bytes") out.index_step_bytes = n;
+        else if (key == "index_interval_ms") out.index_interval_ms = static_cast<uint32_t>(n);
+    }
+
+    if (out.block_size == 0 || out.total_size < out.block_size)
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
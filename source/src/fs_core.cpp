@@ -1,5 +1,10 @@
 #include "../include/fs_core.hpp"
 #include "../include/odf_types.hpp"
+#include "../include/fs_file.hpp"
+#include "../include/fs_dir.hpp"
+#include "../include/fs_info.hpp"
+#include "../include/checkpoint.hpp"
+#include "../include/checksum.hpp"
 #include <fstream>
 #include <iostream>
 #include <cstring>
@@ -12,20 +17,354 @@ FileSystemInstance* g_fs = nullptr;
 static const unsigned long long DEFAULT_TOTAL_SIZE = 4ULL * 1024 * 1024;
 static const unsigned long long DEFAULT_BLOCK_SIZE = 4096ULL;
 
+static_assert(sizeof(OMNILayout) <= sizeof(OMNIHeader::reserved), "OMNILayout must fit in the header reserved area");
+
+static uint64_t align_up(uint64_t value, uint64_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+// CRC32C of a header with its own header_crc field taken as zero.
+static uint32_t header_checksum(const OMNIHeader& hdr)
+{
+    OMNIHeader copy = hdr;
+    OMNILayout layout = read_layout(copy);
+    layout.header_crc = 0;
+    write_layout(copy, layout);
+    return crc32c(&copy, sizeof(copy));
+}
+
+static void seal_header(OMNIHeader& hdr)
+{
+    OMNILayout layout = read_layout(hdr);
+    layout.header_crc = header_checksum(hdr);
+    write_layout(hdr, layout);
+}
+
 static int write_header_to_file(const char* path, const OMNIHeader& hdr)
 {
     ofstream ofs(path, ios::binary | ios::trunc);
     if (!ofs) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     ofs.write(reinterpret_cast<const char*>(&hdr), sizeof(OMNIHeader));
+
+    // Size the container up front so the data region exists on disk.
+    if (hdr.total_size > sizeof(OMNIHeader))
+    {
+        ofs.seekp(static_cast<streamoff>(hdr.total_size - 1));
+        ofs.put('\0');
+    }
     return ofs ? static_cast<int>(OFSErrorCodes::SUCCESS): static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
 }
 
-static int read_header_from_file(const char* path, OMNIHeader& out_hdr)
+// Fills the checksum table of a freshly formatted container: every data
+// block starts out as zeros.
+static int write_checksum_table(const char* path, const OMNIHeader& hdr, const OMNILayout& layout)
+{
+    fstream fs(path, ios::binary | ios::in | ios::out);
+    if (!fs) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+    vector<char> zero(hdr.block_size, 0);
+    vector<uint32_t> sums(layout.data_blocks, crc32c(zero.data(), zero.size()));
+    fs.seekp(static_cast<streamoff>(layout.checksum_offset));
+    fs.write(reinterpret_cast<const char*>(sums.data()), static_cast<streamsize>(sums.size() * sizeof(uint32_t)));
+    return fs ? static_cast<int>(OFSErrorCodes::SUCCESS): static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+}
+
+// Opens (formatting first if needed) the container and reads its header
+// from the mapping, or with a single pread when the container is too big
+// to map.
+static int open_container(FileSystemInstance* fs, const char* omni_path, const char* config_path, const FSConfig& cfg)
+{
+    OFSErrorCodes r = fs->store.open(omni_path, cfg.mmap_budget);
+    if (r == OFSErrorCodes::SUCCESS)
+        r = fs->store.readAt(0, &fs->header, sizeof(OMNIHeader));
+
+    if (r != OFSErrorCodes::SUCCESS)
+    {
+        fs->store.close();
+        int f = fs_format(omni_path, config_path);
+        if (f != static_cast<int>(OFSErrorCodes::SUCCESS))
+            return f;
+        r = fs->store.open(omni_path, cfg.mmap_budget);
+        if (r == OFSErrorCodes::SUCCESS)
+            r = fs->store.readAt(0, &fs->header, sizeof(OMNIHeader));
+    }
+    return static_cast<int>(r);
+}
+
+static uint32_t user_table_checksum(FileSystemInstance* fs)
+{
+    const OMNIHeader& hdr = fs->header;
+    vector<UserInfo> table(hdr.max_users);
+    if (fs->store.readAt(hdr.user_table_offset, table.data(), table.size() * sizeof(UserInfo)) != OFSErrorCodes::SUCCESS)
+        return 0;
+    return crc32c(table.data(), table.size() * sizeof(UserInfo)) | 1u;
+}
+
+// Records the checksum of the user table in the header after it changed.
+static int seal_user_table(FileSystemInstance* fs)
+{
+    OMNILayout layout = read_layout(fs->header);
+    layout.users_crc = user_table_checksum(fs);
+    write_layout(fs->header, layout);
+    return write_header(fs);
+}
+
+static void load_user_table(FileSystemInstance* fs)
+{
+    const OMNIHeader& hdr = fs->header;
+    uint64_t bytes = static_cast<uint64_t>(hdr.max_users) * sizeof(UserInfo);
+
+    // The table is still loaded when it does not match, so an administrator
+    // can log in; the mismatch is counted in the corrupt_blocks statistic.
+    OMNILayout layout = read_layout(hdr);
+    if (layout.users_crc != 0 && layout.users_crc != user_table_checksum(fs))
+    {
+        cerr << "[fs_init] User table does not match its checksum.\n";
+        fs->metadata_corrupt++;
+    }
+
+    vector<UserInfo> copy;
+    const UserInfo* table = reinterpret_cast<const UserInfo*>(fs->store.mappedAt(hdr.user_table_offset));
+    if (!table)
+    {
+        copy.resize(hdr.max_users);
+        if (fs->store.readAt(hdr.user_table_offset, copy.data(), bytes) != OFSErrorCodes::SUCCESS)
+            return;
+        table = copy.data();
+    }
+
+    for (uint32_t i = 0; i < hdr.max_users; ++i)
+    {
+        if (table[i].is_active == 1 && table[i].username[0] != '\0')
+            fs->users.push_back(table[i]);
+    }
+}
+
+static uint64_t user_slot_offset(uint32_t slot)
+{
+    return g_fs->header.user_table_offset + static_cast<uint64_t>(slot) * sizeof(UserInfo);
+}
+
+int user_table_store(const UserInfo& user)
+{
+    if (!g_fs)
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+
+    int free_slot = -1;
+    for (uint32_t i = 0; i < g_fs->header.max_users; ++i)
+    {
+        UserInfo cur;
+        if (g_fs->store.readAt(user_slot_offset(i), &cur, sizeof(cur)) != OFSErrorCodes::SUCCESS)
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+        if (cur.is_active == 1 && strncmp(cur.username, user.username, sizeof(cur.username)) == 0)
+        {
+            free_slot = static_cast<int>(i);
+            break;
+        }
+        if (free_slot < 0 && cur.is_active != 1)
+            free_slot = static_cast<int>(i);
+    }
+    if (free_slot < 0)
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+
+    uint64_t off = user_slot_offset(static_cast<uint32_t>(free_slot));
+    if (g_fs->store.writeAt(off, &user, sizeof(user)) != OFSErrorCodes::SUCCESS)
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    OFSErrorCodes fr = g_fs->store.flushRange(off, sizeof(user));
+    if (fr != OFSErrorCodes::SUCCESS)
+        return static_cast<int>(fr);
+    return seal_user_table(g_fs);
+}
+
+int user_table_erase(const char* username)
+{
+    if (!g_fs || !username)
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+
+    for (uint32_t i = 0; i < g_fs->header.max_users; ++i)
+    {
+        UserInfo cur;
+        uint64_t off = user_slot_offset(i);
+        if (g_fs->store.readAt(off, &cur, sizeof(cur)) != OFSErrorCodes::SUCCESS)
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+        if (cur.is_active == 1 && strncmp(cur.username, username, sizeof(cur.username)) == 0)
+        {
+            UserInfo empty{};
+            if (g_fs->store.writeAt(off, &empty, sizeof(empty)) != OFSErrorCodes::SUCCESS)
+                return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+            OFSErrorCodes fr = g_fs->store.flushRange(off, sizeof(empty));
+            if (fr != OFSErrorCodes::SUCCESS)
+                return static_cast<int>(fr);
+            return seal_user_table(g_fs);
+        }
+    }
+    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+}
+
+uint64_t fs_now()
+{
+    if (g_fs && g_fs->replaying)
+        return g_fs->replay_time;
+    return static_cast<uint64_t>(time(nullptr));
+}
+
+// The FSLock the calling thread holds, if any.
+static thread_local FSLock* t_fs_lock = nullptr;
+
+FSLock::FSLock(bool locked)
+    : lk_(g_fs->op_lock, defer_lock), outer_(t_fs_lock)
+{
+    if (locked)
+        lk_.lock();
+    t_fs_lock = this;
+}
+
+FSLock::~FSLock()
+{
+    t_fs_lock = outer_;
+}
+
+void FSLock::lock()
+{
+    lk_.lock();
+}
+
+void FSLock::unlock()
+{
+    lk_.unlock();
+}
+
+bool FSLock::held() const
+{
+    return lk_.owns_lock();
+}
+
+int fs_log_commit(const LogRecord& rec)
+{
+    if (!g_fs || g_fs->replaying || !g_fs->log.isOpen())
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+
+    // Vault records the operation stored must be durable before the
+    // record naming them can be.
+    if (g_fs->vault.sync() != OFSErrorCodes::SUCCESS)
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+
+    // The mutation is already applied in memory, so when the log has no
+    // room a checkpoint makes it durable instead.
+    uint64_t lsn = g_fs->log.append(rec);
+    if (lsn == 0)
+        return checkpoint_write(g_fs);
+
+    // The mutation is complete; only its durability is left to wait for.
+    FSLock* held = t_fs_lock && t_fs_lock->held() ? t_fs_lock : nullptr;
+    if (held)
+        held->unlock();
+    int rc = static_cast<int>(g_fs->log.commit(lsn));
+    if (held)
+        held->lock();
+    if (rc != static_cast<int>(OFSErrorCodes::SUCCESS))
+        return rc;
+
+    const FSConfig& cfg = g_fs->config;
+    bool log_full = g_fs->log.usedBytes() * 100 >= g_fs->log.capacity() * cfg.checkpoint_log_percent;
+    bool overdue = static_cast<uint64_t>(time(nullptr)) >= g_fs->last_checkpoint + cfg.checkpoint_interval;
+    if (log_full || overdue)
+        checkpoint_write(g_fs);
+    return rc;
+}
+
+// Re-executes one logged mutation through the public API on behalf of the
+// user that originally issued it.
+static void apply_log_record(LogRecord& rec)
 {
-    ifstream ifs(path, ios::binary);
-    if (!ifs) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
-    ifs.read(reinterpret_cast<char*>(&out_hdr), sizeof(OMNIHeader));
-    return ifs ? static_cast<int>(OFSErrorCodes::SUCCESS) : static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    string user;
+    uint32_t role = 0;
+    if (!rec.getString(user) || !rec.getU32(role))
+        return;
+
+    SessionInfo s{};
+    strncpy(s.user.username, user.c_str(), sizeof(s.user.username) - 1);
+    s.user.role = static_cast<UserRole>(role);
+    g_fs->replay_time = rec.time();
+    g_fs->replay_saved.vault_pos = VAULT_NONE;
+
+    string a, b;
+    uint32_t n = 0;
+    switch (rec.op())
+    {
+        case LogOp::FILE_CREATE:
+            if (rec.getString(a) && rec.getString(b))
+                file_create(&s, a.c_str(), b.data(), b.size());
+            break;
+        case LogOp::FILE_EDIT:
+            if (rec.getString(a) && rec.getU32(n) && rec.getString(b))
+            {
+                vault_unlog(rec, g_fs->replay_saved);
+                file_edit(&s, a.c_str(), b.data(), b.size(), n);
+            }
+            break;
+        case LogOp::FILE_DELETE:
+            if (rec.getString(a))
+                file_delete(&s, a.c_str());
+            break;
+        case LogOp::FILE_TRUNCATE:
+            if (rec.getString(a))
+            {
+                vault_unlog(rec, g_fs->replay_saved);
+                file_truncate(&s, a.c_str());
+            }
+            break;
+        case LogOp::FILE_RENAME:
+            if (rec.getString(a) && rec.getString(b))
+                file_rename(&s, a.c_str(), b.c_str());
+            break;
+        case LogOp::SET_PERMISSIONS:
+            if (rec.getString(a) && rec.getU32(n))
+                set_permissions(&s, a.c_str(), n);
+            break;
+        case LogOp::DIR_CREATE:
+            if (rec.getString(a))
+                dir_create(&s, a.c_str());
+            break;
+        case LogOp::DIR_DELETE:
+            if (rec.getString(a))
+                dir_delete(&s, a.c_str());
+            break;
+        case LogOp::USER_CREATE:
+            if (rec.getString(a) && rec.getString(b) && rec.getU32(n))
+                user_create(&s, a.c_str(), b.c_str(), static_cast<UserRole>(n));
+            break;
+        case LogOp::USER_DELETE:
+            if (rec.getString(a))
+                user_delete(&s, a.c_str());
+            break;
+        case LogOp::FILE_ROLLBACK:
+            if (rec.getString(a) && rec.getU32(n))
+            {
+                vault_unlog(rec, g_fs->replay_saved);
+                file_rollback(&s, a.c_str(), n);
+            }
+            break;
+        case LogOp::SET_COMPRESSION:
+            if (rec.getString(a) && rec.getU32(n))
+                set_compression(&s, a.c_str(), n);
+            break;
+        case LogOp::DIR_RENAME:
+            if (rec.getString(a) && rec.getString(b))
+                dir_rename(&s, a.c_str(), b.c_str());
+            break;
+        case LogOp::DIR_DELETE_RECURSIVE:
+            if (rec.getString(a))
+                dir_delete_recursive(&s, a.c_str());
+            break;
+        case LogOp::TREE_COPY:
+            if (rec.getString(a) && rec.getString(b))
+                tree_copy(&s, a.c_str(), b.c_str());
+            break;
+    }
 }
 
 int fs_format(const char* omni_path, const char* config_path)
@@ -33,17 +372,179 @@ int fs_format(const char* omni_path, const char* config_path)
     if (!omni_path || !config_path)
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
 
+    FSConfig cfg;
+    int c = load_config(config_path, cfg);
+    if (c != static_cast<int>(OFSErrorCodes::SUCCESS))
+        return c;
+
     OMNIHeader hdr = {};
     strncpy(hdr.magic, "OMNIFS01", sizeof(hdr.magic) - 1);
     hdr.format_version = 0x00010000;
-    hdr.total_size = DEFAULT_TOTAL_SIZE;
+    hdr.total_size = cfg.total_size;
     hdr.header_size = sizeof(OMNIHeader);
-    hdr.block_size = DEFAULT_BLOCK_SIZE;
+    hdr.block_size = cfg.block_size;
     hdr.config_timestamp = static_cast<uint64_t>(time(nullptr));
     hdr.user_table_offset = hdr.header_size;
-    hdr.max_users = 1024;
+    hdr.max_users = cfg.max_users;
+
+    OMNILayout layout = {};
+    uint64_t users_end = hdr.user_table_offset + static_cast<uint64_t>(hdr.max_users) * sizeof(UserInfo);
+    hdr.change_log_offset = static_cast<uint32_t>(align_up(users_end, hdr.block_size));
+    layout.change_log_size = align_up(cfg.change_log_size, hdr.block_size);
+    hdr.file_state_storage_offset = static_cast<uint32_t>(hdr.change_log_offset + layout.change_log_size);
+    layout.vault_size = align_up(cfg.vault_size, hdr.block_size);
+    layout.data_offset = hdr.file_state_storage_offset + layout.vault_size;
+    uint64_t max_size = max(cfg.max_size, cfg.total_size);
+    uint64_t table = 0;
+    if (cfg.checksums)
+    {
+        // 4 bytes per data block, carved from the space the blocks would
+        // use, sized for the largest the container may grow to.
+        layout.checksum_offset = layout.data_offset;
+        uint64_t rest = max_size > layout.data_offset ? max_size - layout.data_offset : 0;
+        table = align_up(rest / (hdr.block_size + sizeof(uint32_t)) * sizeof(uint32_t), hdr.block_size);
+        layout.data_offset += table;
+    }
+    if (layout.data_offset + hdr.block_size > hdr.total_size)
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+    layout.data_blocks = (hdr.total_size - layout.data_offset) / hdr.block_size;
+    if (max_size > hdr.total_size)
+        layout.max_blocks = (max_size - layout.data_offset) / hdr.block_size;
+    if (layout.checksum_offset != 0)
+    {
+        layout.data_blocks = min<uint64_t>(layout.data_blocks, table / sizeof(uint32_t));
+        layout.max_blocks = min<uint64_t>(layout.max_blocks, table / sizeof(uint32_t));
+    }
+    write_layout(hdr, layout);
+    seal_header(hdr);
+
+    int w = write_header_to_file(omni_path, hdr);
+    if (w != static_cast<int>(OFSErrorCodes::SUCCESS) || layout.checksum_offset == 0)
+        return w;
+    return write_checksum_table(omni_path, hdr, layout);
+}
+
+void write_layout(OMNIHeader& hdr, const OMNILayout& layout)
+{
+    memcpy(hdr.reserved, &layout, sizeof(layout));
+}
+
+int write_header(FileSystemInstance* fs)
+{
+    seal_header(fs->header);
+    OFSErrorCodes rc = fs->store.writeAt(0, &fs->header, sizeof(OMNIHeader));
+    if (rc != OFSErrorCodes::SUCCESS)
+        return static_cast<int>(rc);
+    return static_cast<int>(fs->store.flushRange(0, sizeof(OMNIHeader)));
+}
+
+uint32_t find_entry(FileSystemInstance* fs, const char* path)
+{
+    return fs->tree.lookup(fs->inodes, path);
+}
+
+uint32_t add_entry(FileSystemInstance* fs, const char* path, EntryType type, const char* owner, uint32_t permissions)
+{
+    uint32_t slot = fs->inodes.allocate(type);
+    Inode& i = fs->inodes[slot];
+    i.owner = fs->inodes.internOwner(owner);
+    i.permissions = permissions;
+    i.ctime = i.mtime = fs_now();
+    fs->inodes.data(slot).author = i.owner;
+    fs->tree.link(fs->inodes, slot, path);
+    fs->meta.add(fs->inodes, slot);
+    text_changed(fs, slot);
+    quota_charge(fs, i.owner, 0, 1);
+    return slot;
+}
+
+void remove_entry(FileSystemInstance* fs, uint32_t slot)
+{
+    fs->tree.unlink(fs->inodes, slot);
+    fs->meta.remove(fs->inodes, slot);
+    text_changed(fs, slot);
+    quota_charge(fs, fs->inodes[slot].owner, 0, -1);
+    fs->inodes.release(slot);
+}
+
+OFSErrorCodes rename_entry(FileSystemInstance* fs, uint32_t slot, const char* new_path)
+{
+    return fs->tree.move(fs->inodes, slot, new_path);
+}
+
+uint64_t entry_cursor(FileSystemInstance* fs, uint32_t slot)
+{
+    if (slot == NO_INODE)
+        return 0;
+    return (static_cast<uint64_t>(fs->inodes[slot].generation) << 32) | InodeTable::inodeNumber(slot);
+}
+
+bool cursor_entry(FileSystemInstance* fs, uint64_t cursor, uint32_t& slot)
+{
+    slot = NO_INODE;
+    if (cursor == 0)
+        return true;
+    uint32_t s = static_cast<uint32_t>(cursor) - 1;
+    if (s >= fs->inodes.slots() || !fs->inodes.used(s) || entry_cursor(fs, s) != cursor)
+        return false;
+    slot = s;
+    return true;
+}
+
+void touch_entry(FileSystemInstance* fs, uint32_t slot)
+{
+    fs->inodes[slot].mtime = fs_now();
+    fs->meta.touched(fs->inodes, slot);
+    fs->tree.sync(fs->inodes, slot);
+}
+
+OMNILayout read_layout(const OMNIHeader& hdr)
+{
+    OMNILayout layout;
+    memcpy(&layout, hdr.reserved, sizeof(layout));
 
-    return write_header_to_file(omni_path, hdr);
+    // Containers written before the layout was recorded: derive the same
+    // layout fs_format would have produced.
+    if (layout.data_offset == 0)
+    {
+        uint64_t block_size = hdr.block_size ? hdr.block_size : DEFAULT_BLOCK_SIZE;
+        uint64_t total_size = hdr.total_size ? hdr.total_size : DEFAULT_TOTAL_SIZE;
+        uint64_t users_end = hdr.user_table_offset + static_cast<uint64_t>(hdr.max_users) * sizeof(UserInfo);
+        layout.data_offset = align_up(users_end, block_size);
+        layout.data_blocks = total_size > layout.data_offset ? (total_size - layout.data_offset) / block_size : 0;
+        layout.change_log_size = 0;
+        layout.vault_size = 0;
+    }
+    return layout;
+}
+
+// Grows the data region by at least `more` blocks (a whole grow_step when
+// there is room for it) without going past max_blocks. The container is
+// extended before the header records the new size, so a crash in between
+// only leaves unused space at the end of the file.
+static bool grow_container(FileSystemInstance* fs, unsigned int more)
+{
+    OMNILayout layout = read_layout(fs->header);
+    uint64_t bs = fs->store.blockSize();
+    if (layout.max_blocks < layout.data_blocks + more)
+        return false;
+
+    uint64_t step = max<uint64_t>(more, fs->config.grow_step / bs);
+    uint64_t target = min<uint64_t>(layout.max_blocks, layout.data_blocks + step);
+    if (fs->store.grow(static_cast<unsigned int>(target)) != OFSErrorCodes::SUCCESS)
+        return false;
+    fs->bitmap.grow(static_cast<unsigned int>(target));
+
+    uint64_t added = (target - layout.data_blocks) * bs;
+    layout.data_blocks = target;
+    write_layout(fs->header, layout);
+    fs->header.total_size = layout.data_offset + target * bs;
+    write_header(fs);
+
+    fs->stats.total_size += added;
+    fs->stats.free_space += added;
+    cout << "[fs] Container grown to " << fs->header.total_size << " bytes.\n";
+    return true;
 }
 
 int fs_init(void** instance, const char* omni_path, const char* config_path)
@@ -51,29 +552,63 @@ int fs_init(void** instance, const char* omni_path, const char* config_path)
     if (!instance || !omni_path || !config_path)
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
 
-    OMNIHeader hdr;
-    int r = read_header_from_file(omni_path, hdr);
-    if (r != static_cast<int>(OFSErrorCodes::SUCCESS))
-    {
-        int f = fs_format(omni_path, config_path);
-        if (f != static_cast<int>(OFSErrorCodes::SUCCESS))
-            return f;
-        r = read_header_from_file(omni_path, hdr);
-        if (r != static_cast<int>(OFSErrorCodes::SUCCESS))
-            return r;
-    }
+    FSConfig cfg;
+    int c = load_config(config_path, cfg);
+    if (c != static_cast<int>(OFSErrorCodes::SUCCESS))
+        return c;
 
     auto* fs = new FileSystemInstance();
     fs->omni_path = omni_path;
     fs->config_path = config_path;
+    fs->config = cfg;
+
+    int r = open_container(fs, omni_path, config_path, cfg);
+    if (r != static_cast<int>(OFSErrorCodes::SUCCESS))
+    {
+        delete fs;
+        return r;
+    }
+    const OMNIHeader& hdr = fs->header;
+    if (read_layout(hdr).header_crc != 0 && read_layout(hdr).header_crc != header_checksum(hdr))
+    {
+        cerr << "[fs_init] Container header does not match its checksum.\n";
+        delete fs;
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
 
     unsigned long long block_size = hdr.block_size ? hdr.block_size : DEFAULT_BLOCK_SIZE;
     unsigned long long total_size = hdr.total_size ? hdr.total_size : DEFAULT_TOTAL_SIZE;
-    unsigned long long total_blocks = total_size / block_size;
+    OMNILayout layout = read_layout(hdr);
+    unsigned long long total_blocks = layout.data_blocks;
     if (total_blocks == 0) total_blocks = 1024ULL;
 
     fs->bitmap.init(static_cast<unsigned int>(total_blocks));
 
+    // Without a checksum table nothing is sized for the maximum, so it can
+    // follow max_size in the config.
+    if (layout.checksum_offset == 0 && cfg.max_size > layout.data_offset + total_blocks * block_size)
+    {
+        layout.max_blocks = (cfg.max_size - layout.data_offset) / block_size;
+        write_layout(fs->header, layout);
+    }
+
+    OFSErrorCodes so = fs->store.setLayout(layout.data_offset, static_cast<uint32_t>(block_size),
+                                           static_cast<unsigned int>(total_blocks), static_cast<unsigned int>(layout.max_blocks));
+    if (so != OFSErrorCodes::SUCCESS)
+    {
+        delete fs;
+        return static_cast<int>(so);
+    }
+    if (layout.checksum_offset != 0)
+    {
+        so = fs->store.enableChecksums(layout.checksum_offset);
+        if (so != OFSErrorCodes::SUCCESS)
+        {
+            delete fs;
+            return static_cast<int>(so);
+        }
+    }
+
     fs->stats.total_size = total_size;
     fs->stats.used_space = 0;
     fs->stats.free_space = total_size;
@@ -83,13 +618,66 @@ int fs_init(void** instance, const char* omni_path, const char* config_path)
     fs->stats.active_sessions = 0;
     fs->stats.fragmentation = 0.0;
 
-    UserInfo admin("root", "root", UserRole::ADMIN, static_cast<uint64_t>(time(nullptr)));
-    fs->users.push_back(admin);
-
     g_fs = fs;
     *instance = fs;
 
-    cout << "[fs_init] Filesystem initialized successfully.\n";
+    fs->bitmap.setGrowHandler([fs](unsigned int more) { return grow_container(fs, more); });
+
+    load_user_table(fs);
+    if (fs->users.empty())
+    {
+        UserInfo admin("root", "root", UserRole::ADMIN, static_cast<uint64_t>(time(nullptr)));
+        fs->users.push_back(admin);
+        user_table_store(admin);
+    }
+    fs->stats.total_users = static_cast<uint32_t>(fs->users.size());
+
+    fs->root_compression = layout.root_compression;
+    if (layout.vault_size > 0 && hdr.file_state_storage_offset != 0)
+        fs->vault.open(&fs->store, hdr.file_state_storage_offset, layout.vault_size, layout.vault_head, layout.vault_tail);
+
+    uint64_t checkpoint_lsn = 0;
+    int cr = checkpoint_load(fs, &checkpoint_lsn);
+    if (cr != static_cast<int>(OFSErrorCodes::SUCCESS))
+    {
+        cerr << "[fs_init] Checkpoint is unreadable.\n";
+        g_fs = nullptr;
+        *instance = nullptr;
+        delete fs;
+        return cr;
+    }
+    if (fs->last_checkpoint == 0)
+        fs->last_checkpoint = static_cast<uint64_t>(time(nullptr));
+    quota_load_limits(fs);
+
+    // A larger total_size in the config grows the container right away.
+    uint64_t have = layout.data_offset + total_blocks * block_size;
+    if (cfg.total_size > have && layout.max_blocks > total_blocks)
+        grow_container(fs, static_cast<unsigned int>((cfg.total_size - have) / block_size));
+
+    if (layout.change_log_size > 0 && hdr.change_log_offset != 0)
+    {
+        OFSErrorCodes lo = fs->log.open(&fs->store, hdr.change_log_offset, layout.change_log_size, cfg.commit_window_us);
+        if (lo != OFSErrorCodes::SUCCESS)
+        {
+            g_fs = nullptr;
+            *instance = nullptr;
+            delete fs;
+            return static_cast<int>(lo);
+        }
+
+        fs->replaying = true;
+        size_t replayed = fs->log.replay(apply_log_record, checkpoint_lsn);
+        fs->replaying = false;
+        if (replayed > 0)
+            cout << "[fs_init] Replayed " << replayed << " change log records.\n";
+    }
+
+    // The text index is not saved; it is rebuilt in the background.
+    text_reindex_all(fs);
+
+    cout << "[fs_init] Filesystem initialized successfully"
+         << (fs->store.isMapped() ? " (mmap).\n" : " (pread/pwrite).\n");
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
@@ -101,6 +689,10 @@ void fs_shutdown(void* instance)
     for (auto* s : fs->sessions)
         delete s;
     fs->sessions.clear();
+    if (fs->log.isOpen())
+        checkpoint_write(fs);
+    fs->store.flush();
+    fs->store.close();
 
     if (g_fs == fs)
         g_fs = nullptr;
@@ -1,5 +1,8 @@
 #include "../include/fs_dir.hpp"
 #include "../include/fs_core.hpp"
+#include "../include/checkpoint.hpp"
+#include "../include/defrag.hpp"
+#include <algorithm>
 #include <cstring>
 #include <vector>
 
@@ -7,15 +10,6 @@ using namespace std;
 
 extern FileSystemInstance* g_fs;
 
-static bool is_direct_child(const char* full, const char* parent)
-{
-    int plen = strlen(parent);
-    if (strncmp(full, parent, plen) != 0) return false;
-    if (full[plen] != '/') return false;
-    const char* rest = full + plen + 1;
-    return strchr(rest, '/') == nullptr;
-}
-
 int dir_create(void* session, const char* path) 
 {
     if (!session || !path) 
@@ -23,24 +17,26 @@ int dir_create(void* session, const char* path)
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
 
-    for (auto& f : g_fs->files) 
+    OFSErrorCodes rc = g_fs->tree.canCreate(g_fs->inodes, path);
+    if (rc != OFSErrorCodes::SUCCESS)
     {
-        if (strcmp(f.path, path) == 0) 
-        {
-            return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
-        }
+        return static_cast<int>(rc);
     }
 
-    FileMetadata dirMeta;
-    memset(&dirMeta, 0, sizeof(dirMeta));
-    strncpy(dirMeta.path, path, sizeof(dirMeta.path) - 1);
-    dirMeta.entry = FileEntry(path, EntryType::DIRECTORY, 0, 0755, "system", static_cast<uint32_t>(g_fs->files.size() + 1));
-    dirMeta.entry.created_time = dirMeta.entry.modified_time = static_cast<uint64_t>(time(nullptr));
+    // A directory belongs to, and counts against the inode quota of, the
+    // user who created it.
+    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    if (!quota_allows(g_fs, g_fs->inodes.internOwner(s->user.username), 0, 1))
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    }
 
-    g_fs->files.push_back(dirMeta);
+    add_entry(g_fs, path, EntryType::DIRECTORY, s->user.username, 0755);
     g_fs->stats.total_directories++;
 
-    return static_cast<int>(OFSErrorCodes::SUCCESS);
+    LogRecord rec(LogOp::DIR_CREATE, s);
+    rec.putString(path);
+    return fs_log_commit(rec);
 }
 
 int dir_list(void* session, const char* path, FileEntry** entries, int* count)
@@ -48,31 +44,12 @@ int dir_list(void* session, const char* path, FileEntry** entries, int* count)
     if (!session || !path || !entries || !count)
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
 
-    vector<FileEntry> result;
-    string base = string(path);
+    vector<uint32_t> slots;
+    OFSErrorCodes rc = g_fs->tree.listDirectory(g_fs->inodes, path, slots);
+    if (rc != OFSErrorCodes::SUCCESS)
+        return static_cast<int>(rc);
 
-    if (base.size() > 1 && base.back() == '/')
-        base.pop_back();
-
-    size_t baseLen = base.size();
-
-    for (auto& f : g_fs->files)
-    {
-        string fp = string(f.path);
-
-        if (fp == base) continue;
-
-        if (fp.size() > baseLen &&
-            fp.compare(0, baseLen, base) == 0 &&
-            fp[baseLen] == '/')
-        {
-            string rest = fp.substr(baseLen + 1);
-            if (rest.find('/') == string::npos)
-                result.push_back(f.entry);
-        }
-    }
-
-    *count = result.size();
+    *count = slots.size();
     if (*count == 0)
     {
         *entries = nullptr;
@@ -81,11 +58,65 @@ int dir_list(void* session, const char* path, FileEntry** entries, int* count)
 
     *entries = new FileEntry[*count];
     for (int i = 0; i < *count; ++i)
-        (*entries)[i] = result[i];
+        (*entries)[i] = g_fs->inodes.entry(slots[i]);
 
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
+int dir_list_plus(void* session, const char* path, uint64_t cursor, int limit, FileEntry** entries, int* count,
+                  uint64_t* next_cursor)
+{
+    if (!session || !path || !entries || !count || !next_cursor || limit <= 0)
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    if (limit > DIR_PAGE_MAX)
+        limit = DIR_PAGE_MAX;
+
+    uint32_t from;
+    if (!cursor_entry(g_fs, cursor, from))
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+
+    vector<uint32_t> slots;
+    uint32_t next;
+    OFSErrorCodes rc = g_fs->tree.listPage(g_fs->inodes, path, from, limit, slots, next);
+    if (rc != OFSErrorCodes::SUCCESS)
+        return static_cast<int>(rc);
+
+    *next_cursor = entry_cursor(g_fs, next);
+    *count = slots.size();
+    *entries = *count ? new FileEntry[*count] : nullptr;
+    for (int i = 0; i < *count; ++i)
+        (*entries)[i] = g_fs->inodes.entry(slots[i]);
+
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int dir_find(void* session, const char* pattern, int limit, char** paths, size_t* size, int* count)
+{
+    if (!session || !pattern || !paths || !size || !count || limit <= 0)
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+
+    vector<uint32_t> slots;
+    g_fs->tree.glob(g_fs->inodes, pattern, slots);
+    sort(slots.begin(), slots.end());
+    slots.erase(unique(slots.begin(), slots.end()), slots.end());
+
+    vector<string> found;
+    found.reserve(slots.size());
+    for (uint32_t s : slots)
+        found.push_back(g_fs->inodes.path(s));
+    sort(found.begin(), found.end());
+    if (found.size() > static_cast<size_t>(limit))
+        found.resize(limit);
+
+    string out;
+    for (const string& p : found)
+        out += p + "\n";
+    *count = found.size();
+    *size = out.size();
+    *paths = new char[out.size() + 1];
+    memcpy(*paths, out.c_str(), out.size() + 1);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
 
 int dir_delete(void* session, const char* path) 
 {
@@ -94,44 +125,251 @@ int dir_delete(void* session, const char* path)
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
 
-    size_t prefixLen = strlen(path);
-    for (auto& f : g_fs->files) 
+    uint32_t dir = find_entry(g_fs, path);
+    if (dir == NO_INODE || g_fs->inodes[dir].type != (uint8_t)EntryType::DIRECTORY) 
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+
+    if (g_fs->inodes[dir].child != NO_INODE)
+    {
+        return (int)OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY;
+    }
+
+    remove_entry(g_fs, dir);
+    g_fs->stats.total_directories--;
+
+    LogRecord rec(LogOp::DIR_DELETE, reinterpret_cast<SessionInfo*>(session));
+    rec.putString(path);
+    return fs_log_commit(rec);
+}
+
+int dir_exists(void* session, const char* path) 
+{
+    if (!session || !path) 
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+
+    uint32_t dir = find_entry(g_fs, path);
+    if (dir != NO_INODE && g_fs->inodes[dir].type == (uint8_t)EntryType::DIRECTORY) 
+    {
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+
+    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+}
+
+int dir_rename(void* session, const char* old_path, const char* new_path)
+{
+    if (!session || !old_path || !new_path)
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+
+    uint32_t dir = find_entry(g_fs, old_path);
+    if (dir == NO_INODE || g_fs->inodes[dir].type != (uint8_t)EntryType::DIRECTORY)
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+
+    OFSErrorCodes rc = rename_entry(g_fs, dir, new_path);
+    if (rc != OFSErrorCodes::SUCCESS)
+    {
+        return static_cast<int>(rc);
+    }
+    touch_entry(g_fs, dir);
+
+    LogRecord rec(LogOp::DIR_RENAME, reinterpret_cast<SessionInfo*>(session));
+    rec.putString(old_path);
+    rec.putString(new_path);
+    return fs_log_commit(rec);
+}
+
+// Slots of root and everything below it, each directory before its
+// children; parents[i] is the index in out of the parent of out[i].
+static void collect_subtree(uint32_t root, vector<uint32_t>& out, vector<size_t>* parents)
+{
+    out.push_back(root);
+    if (parents)
+    {
+        parents->push_back(0);
+    }
+    for (size_t i = 0; i < out.size(); ++i)
     {
-        if (strcmp(f.path, path) != 0 && is_direct_child(f.path, path))
+        uint32_t head = g_fs->inodes[out[i]].child;
+        if (head == NO_INODE)
         {
-            return (int)OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY;
+            continue;
         }
+        uint32_t s = head;
+        do
+        {
+            out.push_back(s);
+            if (parents)
+            {
+                parents->push_back(i);
+            }
+            s = g_fs->inodes[s].next;
+        } while (s != head);
+    }
+}
 
+int dir_delete_recursive(void* session, const char* path)
+{
+    if (!session || !path)
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+
+    uint32_t dir = find_entry(g_fs, path);
+    if (dir == NO_INODE || g_fs->inodes[dir].type != (uint8_t)EntryType::DIRECTORY)
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
 
-    for (size_t i = 0; i < g_fs->files.size(); ++i) 
+    vector<uint32_t> slots;
+    collect_subtree(dir, slots, nullptr);
+
+    vector<Extent> freed;
+    uint64_t bytes = 0;
+    uint32_t files = 0;
+    for (uint32_t s : slots)
     {
-        if (strcmp(g_fs->files[i].path, path) == 0 && g_fs->files[i].entry.type == (uint8_t)EntryType::DIRECTORY) 
+        if (g_fs->inodes[s].type == (uint8_t)EntryType::DIRECTORY)
         {
-            g_fs->files.erase(g_fs->files.begin() + i);
-        
-            g_fs->stats.total_directories--;
-            return static_cast<int>(OFSErrorCodes::SUCCESS);
+            continue;
         }
+        const vector<Extent>& extents = g_fs->inodes.data(s).extents;
+        frag_account(g_fs, s, -1);
+        freed.insert(freed.end(), extents.begin(), extents.end());
+        quota_charge(g_fs, g_fs->inodes[s].owner, -static_cast<int64_t>(g_fs->inodes[s].size), 0);
+        bytes += g_fs->inodes[s].size;
+        files++;
     }
+    checkpoint_release(g_fs, freed);
 
-    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    // Children come after their parent in slots, so this empties every
+    // directory before unlinking it.
+    for (auto it = slots.rbegin(); it != slots.rend(); ++it)
+    {
+        remove_entry(g_fs, *it);
+    }
+
+    g_fs->stats.used_space -= bytes;
+    g_fs->stats.free_space += bytes;
+    g_fs->stats.total_files -= files;
+    g_fs->stats.total_directories -= slots.size() - files;
+
+    LogRecord rec(LogOp::DIR_DELETE_RECURSIVE, reinterpret_cast<SessionInfo*>(session));
+    rec.putString(path);
+    return fs_log_commit(rec);
 }
 
-int dir_exists(void* session, const char* path) 
+int tree_copy(void* session, const char* src, const char* dst)
 {
-    if (!session || !path) 
+    if (!session || !src || !dst)
     {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
 
-    for (auto& f : g_fs->files) 
+    uint32_t root = find_entry(g_fs, src);
+    if (root == NO_INODE)
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    OFSErrorCodes rc = g_fs->tree.canCreate(g_fs->inodes, dst);
+    if (rc != OFSErrorCodes::SUCCESS)
     {
+        return static_cast<int>(rc);
+    }
 
-        if (strcmp(f.path, path) == 0 && f.entry.type == (uint8_t)EntryType::DIRECTORY) {
-            return static_cast<int>(OFSErrorCodes::SUCCESS);
+    // dst's parent exists (canCreate), so it can be checked by slot.
+    string dst_parent(dst, strrchr(dst, '/') - dst);
+    for (uint32_t up = dst_parent.empty() ? NO_INODE : find_entry(g_fs, dst_parent.c_str()); up != NO_INODE;
+         up = g_fs->inodes[up].parent)
+    {
+        if (up == root)
+        {
+            return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
         }
     }
 
-    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    // Every target path is worked out before anything is created, so a copy
+    // whose paths would grow too long fails without leaving a partial tree.
+    vector<uint32_t> slots;
+    vector<size_t> parents;
+    collect_subtree(root, slots, &parents);
+    vector<string> paths(slots.size());
+    paths[0] = dst;
+    for (size_t i = 1; i < slots.size(); ++i)
+    {
+        paths[i] = paths[parents[i]] + "/" + string(g_fs->inodes.name(slots[i]));
+        if (paths[i].size() >= sizeof(FileMetadata::path))
+        {
+            return static_cast<int>(OFSErrorCodes::ERROR_INVALID_PATH);
+        }
+    }
+
+    // The copies belong to the caller; the source's totals say how much
+    // they will take.
+    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    uint32_t owner = g_fs->inodes.internOwner(s->user.username);
+    DirUsage copied;
+    g_fs->tree.usage(g_fs->inodes, src, copied);
+    if (!quota_allows(g_fs, owner, copied.bytes, slots.size()))
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    }
+
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        uint32_t from = slots[i];
+        EntryType type = g_fs->inodes[from].getType();
+        uint32_t to = add_entry(g_fs, paths[i].c_str(), type, s->user.username, g_fs->inodes[from].permissions);
+        g_fs->inodes[to].compression = g_fs->inodes[from].compression;
+        if (type == EntryType::DIRECTORY)
+        {
+            g_fs->stats.total_directories++;
+            continue;
+        }
+
+        const vector<Extent>& extents = g_fs->inodes.data(from).extents;
+        for (const Extent& e : extents)
+        {
+            for (uint32_t b = 0; b < e.length; ++b)
+            {
+                g_fs->bitmap.addRef(e.start + b);
+            }
+        }
+        g_fs->inodes.data(to).extents = extents;
+        g_fs->inodes[to].blocks = g_fs->inodes[from].blocks;
+        g_fs->inodes[to].size = g_fs->inodes[from].size;
+        if (!g_fs->inodes.chunks(from).empty())
+        {
+            g_fs->inodes.extra(to).chunks = g_fs->inodes.chunks(from);
+        }
+        frag_account(g_fs, to, +1);
+        g_fs->tree.sync(g_fs->inodes, to);
+        quota_charge(g_fs, owner, static_cast<int64_t>(g_fs->inodes[to].size), 0);
+
+        g_fs->stats.total_files++;
+        g_fs->stats.used_space += g_fs->inodes[to].size;
+        g_fs->stats.free_space -= g_fs->inodes[to].size;
+    }
+
+    LogRecord rec(LogOp::TREE_COPY, s);
+    rec.putString(src);
+    rec.putString(dst);
+    return fs_log_commit(rec);
+}
+
+int dir_usage(void* session, const char* path, DirUsage* usage)
+{
+    if (!session || !path || !usage)
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+
+    return static_cast<int>(g_fs->tree.usage(g_fs->inodes, path, *usage));
 }
@@ -1,5 +1,10 @@
 #include "../include/fs_file.hpp"
 #include "../include/fs_core.hpp"
+#include "../include/defrag.hpp"
+#include "../include/delta_vault.hpp"
+#include "../include/dedup.hpp"
+#include "../include/compress.hpp"
+#include "../include/checkpoint.hpp"
 #include <cstring>
 #include <ctime>
 
@@ -7,41 +12,200 @@ using namespace std;
 
 extern FileSystemInstance* g_fs;
 
+static uint64_t blocks_for(uint64_t size)
+{
+    uint64_t bs = g_fs->store.blockSize();
+    return (size + bs - 1) / bs;
+}
+
+// Appends runs to an extent list, joining a run onto the last extent when
+// it follows on directly.
+static void append_extents(vector<Extent>& extents, const vector<Extent>& runs)
+{
+    for (const Extent& e : runs)
+    {
+        if (!extents.empty() && extents.back().start + extents.back().length == e.start)
+            extents.back().length += e.length;
+        else
+            extents.push_back(e);
+    }
+}
+
+// Grows or shrinks the extent list of a file so it covers exactly `size`
+// bytes. Growth asks for blocks right behind the last extent so files stay
+// contiguous wherever the free space allows.
+static int resize_blocks(uint32_t slot, uint64_t size)
+{
+    Inode& f = g_fs->inodes[slot];
+    vector<Extent>& extents = g_fs->inodes.data(slot).extents;
+    uint64_t need = blocks_for(size);
+    uint64_t have = f.blocks;
+    if (need == have)
+        return (int)OFSErrorCodes::SUCCESS;
+
+    frag_account(g_fs, slot, -1);
+
+    if (need > have)
+    {
+        unsigned int hint = FreeBitmap::NO_HINT;
+        if (!extents.empty())
+            hint = extents.back().start + extents.back().length;
+
+        auto res = g_fs->bitmap.allocateExtent(static_cast<unsigned int>(need - have), hint);
+        if (res.first != OFSErrorCodes::SUCCESS)
+        {
+            frag_account(g_fs, slot, +1);
+            return (int)res.first;
+        }
+        append_extents(extents, res.second);
+    }
+    else if (need < have)
+    {
+        uint64_t drop = have - need;
+        while (drop > 0)
+        {
+            Extent& last = extents.back();
+            uint32_t n = (uint32_t)(drop < last.length ? drop : last.length);
+            checkpoint_release(g_fs, {{last.start + last.length - n, n}});
+            last.length -= n;
+            drop -= n;
+            if (last.length == 0)
+                extents.pop_back();
+        }
+    }
+
+    f.blocks = (uint32_t)need;
+    frag_account(g_fs, slot, +1);
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+// The part of an extent list that covers file blocks [from, to).
+static vector<Extent> slice_extents(const vector<Extent>& extents, uint64_t from, uint64_t to)
+{
+    vector<Extent> out;
+    uint64_t pos = 0;
+    for (const Extent& e : extents)
+    {
+        uint64_t lo = pos > from ? pos : from;
+        uint64_t hi = pos + e.length < to ? pos + e.length : to;
+        if (lo < hi)
+            out.push_back({e.start + (uint32_t)(lo - pos), (uint32_t)(hi - lo)});
+        pos += e.length;
+    }
+    return out;
+}
+
+// Puts the units compress_encode re-encoded into freshly allocated blocks.
+// The blocks they replace are only released by the next checkpoint, so the
+// units the checkpoint on disk describes stay intact for log replay.
+static int write_compressed(uint32_t slot, uint64_t old_size, uint64_t offset, const char* data, uint64_t length)
+{
+    CompressedTail t;
+    int rc = compress_encode(g_fs, slot, old_size, offset, data, length, t);
+    if (rc != (int)OFSErrorCodes::SUCCESS)
+        return rc;
+
+    vector<Extent>& extents = g_fs->inodes.data(slot).extents;
+    uint64_t blocks = g_fs->inodes[slot].blocks;
+    vector<Extent> keep = slice_extents(extents, 0, t.first_block);
+    vector<Extent> old = slice_extents(extents, t.first_block, t.tail_block);
+    vector<Extent> tail = slice_extents(extents, t.tail_block, blocks);
+
+    unsigned int n = (unsigned int)(t.bytes.size() / g_fs->store.blockSize());
+    vector<Extent> fresh;
+    if (n > 0)
+    {
+        unsigned int hint = keep.empty() ? FreeBitmap::NO_HINT : keep.back().start + keep.back().length;
+        auto res = g_fs->bitmap.allocateExtent(n, hint);
+        if (res.first != OFSErrorCodes::SUCCESS)
+            return (int)res.first;
+        fresh = res.second;
+        if (g_fs->store.writeRange(fresh, 0, t.bytes.data(), t.bytes.size()) != OFSErrorCodes::SUCCESS)
+        {
+            g_fs->bitmap.freeExtents(fresh);
+            return (int)OFSErrorCodes::ERROR_IO_ERROR;
+        }
+    }
+
+    frag_account(g_fs, slot, -1);
+    extents = keep;
+    append_extents(extents, fresh);
+    append_extents(extents, tail);
+    g_fs->inodes[slot].blocks = (uint32_t)(t.first_block + n + (blocks - t.tail_block));
+    g_fs->inodes[slot].size = offset + length > old_size ? offset + length : old_size;
+    g_fs->inodes.extra(slot).chunks = t.chunks;
+    frag_account(g_fs, slot, +1);
+
+    g_fs->deferred_free.insert(g_fs->deferred_free.end(), old.begin(), old.end());
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+// Blocks replaced by writes to compressed files and by the defragmenter,
+// and shared blocks files let go of, only become free at the next
+// checkpoint. When an operation that is about
+// to allocate up to `blocks` blocks would run out without them, checkpoint
+// first, before it has changed anything.
+static void reserve_blocks(uint64_t blocks)
+{
+    if (blocks > g_fs->bitmap.freeCount())
+        checkpoint_reclaim(g_fs);
+}
+
 int file_create(void* session, const char* path, const char* data, size_t size)
 {
     if (!session || !path || !data)
         return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
 
-    for (auto& f : g_fs->files)
-        if (strcmp(f.path, path) == 0)
-            return (int)OFSErrorCodes::ERROR_FILE_EXISTS;
+    OFSErrorCodes placed = g_fs->tree.canCreate(g_fs->inodes, path);
+    if (placed != OFSErrorCodes::SUCCESS)
+        return (int)placed;
 
     SessionInfo* s = (SessionInfo*)session;
+    uint32_t owner = g_fs->inodes.internOwner(s->user.username);
+    if (!quota_allows(g_fs, owner, size, 1))
+        return (int)OFSErrorCodes::ERROR_NO_SPACE;
+    reserve_blocks(blocks_for(size));
 
-    FileMetadata meta{};
-    strncpy(meta.path, path, sizeof(meta.path) - 1);
+    uint32_t slot = add_entry(g_fs, path, EntryType::FILE, s->user.username, 0644);
+    g_fs->inodes[slot].size = size;
+    g_fs->inodes[slot].compression = (uint8_t)compress_policy(g_fs, slot);
 
-    meta.entry = FileEntry(
-        path,
-        EntryType::FILE,
-        size,
-        0644,
-        s->user.username,
-        (uint32_t)(g_fs->files.size() + 1)
-    );
-
-    meta.entry.created_time = meta.entry.modified_time = time(nullptr);
-    meta.actual_size = size;
-    meta.blocks_used = (size + 4095) / 4096;
-
-    meta.content = string(data, size);
+    int rc;
+    if (g_fs->inodes[slot].compression == COMPRESS_LZ)
+    {
+        rc = write_compressed(slot, 0, 0, data, size);
+    }
+    else if (g_fs->config.dedup)
+    {
+        rc = dedup_store(g_fs, slot, data, size);
+    }
+    else
+    {
+        rc = resize_blocks(slot, size);
+        if (rc == (int)OFSErrorCodes::SUCCESS
+            && g_fs->store.writeRange(g_fs->inodes.data(slot).extents, 0, data, size) != OFSErrorCodes::SUCCESS)
+        {
+            frag_account(g_fs, slot, -1);
+            g_fs->bitmap.freeExtents(g_fs->inodes.data(slot).extents);
+            rc = (int)OFSErrorCodes::ERROR_IO_ERROR;
+        }
+    }
+    if (rc != (int)OFSErrorCodes::SUCCESS)
+    {
+        remove_entry(g_fs, slot);
+        return rc;
+    }
 
-    g_fs->files.push_back(meta);
+    g_fs->tree.sync(g_fs->inodes, slot);
+    quota_charge(g_fs, owner, (int64_t)size, 0);
     g_fs->stats.total_files++;
     g_fs->stats.used_space += size;
     g_fs->stats.free_space -= size;
 
-    return (int)OFSErrorCodes::SUCCESS;
+    LogRecord rec(LogOp::FILE_CREATE, s);
+    rec.putString(path);
+    rec.putBytes(data, size);
+    return fs_log_commit(rec);
 }
 
 
@@ -50,97 +214,186 @@ int file_read(void* session, const char* path, char** buffer, size_t* size)
     if (!session || !path || !buffer || !size)
         return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
 
-    for (auto& f : g_fs->files)
-    {
-        if (strcmp(f.path, path) == 0)
-        {
-            const string& c = f.content;
-
-            *size = c.size();
-            *buffer = new char[*size + 1];
+    uint32_t slot = find_entry(g_fs, path);
+    if (slot == NO_INODE)
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
 
-            if (*size > 0)
-                memcpy(*buffer, c.data(), *size);
+    *size = g_fs->inodes[slot].size;
+    *buffer = new char[*size + 1];
 
-            (*buffer)[*size] = '\0';
-            return (int)OFSErrorCodes::SUCCESS;
-        }
+    if (content_read(g_fs, slot, 0, *size, *buffer) != (int)OFSErrorCodes::SUCCESS)
+    {
+        delete[] *buffer;
+        *buffer = nullptr;
+        *size = 0;
+        return (int)OFSErrorCodes::ERROR_IO_ERROR;
     }
-    return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+
+    (*buffer)[*size] = '\0';
+    return (int)OFSErrorCodes::SUCCESS;
 }
 
-int file_edit(void* session, const char* path, const char* data, size_t size, unsigned int index)
+int file_read_segments(void* session, const char* path, FileSegment** segments, int* count, size_t* size)
 {
-    if (!session || !path || !data)
+    if (!session || !path || !segments || !count || !size)
         return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
 
-    for (auto& f : g_fs->files)
+    if (!g_fs->store.isMapped())
+        return (int)OFSErrorCodes::ERROR_NOT_IMPLEMENTED;
+
+    uint32_t slot = find_entry(g_fs, path);
+    if (slot == NO_INODE)
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+    const Inode& f = g_fs->inodes[slot];
+    const vector<Extent>& extents = g_fs->inodes.data(slot).extents;
+
+    // Compressed content has to be decoded, so it is never shared.
+    if (f.compression == COMPRESS_LZ)
+        return (int)OFSErrorCodes::ERROR_NOT_IMPLEMENTED;
+
+    // The caller reads the mapping directly, so check it first.
+    if (!g_fs->store.verifyRange(extents, 0, (size_t)f.size))
+        return (int)OFSErrorCodes::ERROR_IO_ERROR;
+
+    uint64_t bs = g_fs->store.blockSize();
+    vector<FileSegment> out;
+    uint64_t remaining = f.size;
+
+    // One segment per extent.
+    for (size_t i = 0; i < extents.size() && remaining > 0; ++i)
     {
-        if (strcmp(f.path, path) == 0)
-        {
-            string& content = f.content;
+        const char* p = g_fs->store.blockData(extents[i].start);
+        if (!p)
+            return (int)OFSErrorCodes::ERROR_IO_ERROR;
+
+        uint64_t run = extents[i].length * bs;
+        size_t len = (size_t)(remaining < run ? remaining : run);
+        remaining -= len;
+        out.push_back({p, len});
+    }
 
-            if (index > content.size())
-                content.resize(index, '\0');
+    *size = f.size;
+    *count = (int)out.size();
+    *segments = nullptr;
+    if (!out.empty())
+    {
+        *segments = new FileSegment[out.size()];
+        for (size_t i = 0; i < out.size(); ++i)
+            (*segments)[i] = out[i];
+    }
+    return (int)OFSErrorCodes::SUCCESS;
+}
 
-            if (index + size <= content.size())
-            {
-                content.replace(index, size, data, size);
-            }
-            else
-            {
-                size_t overwrite = (index < content.size() ? content.size() - index : 0);
-                if (overwrite > 0)
-                    content.replace(index, overwrite, data, overwrite);
-                content.append(data + overwrite, size - overwrite);
-            }
+// Writes `size` bytes at `index` into g_fs->inodes[slot], growing it as
+// needed, and logs the write as a FILE_EDIT of path.
+static int write_at(SessionInfo* s, uint32_t slot, const char* path, const char* data, size_t size, unsigned int index)
+{
+    uint64_t old_sz = g_fs->inodes[slot].size;
+    uint64_t end = (uint64_t)index + size;
+    uint64_t new_sz = end > old_sz ? end : old_sz;
+    uint32_t owner = g_fs->inodes[slot].owner;
+    if (!quota_allows(g_fs, owner, new_sz - old_sz, 0))
+        return (int)OFSErrorCodes::ERROR_NO_SPACE;
+
+    // New blocks go to the growth and to shared blocks the write unshares,
+    // or, compressed, to every unit from the one the write starts in.
+    bool compressed = g_fs->inodes[slot].compression == COMPRESS_LZ;
+    uint64_t from = index < old_sz ? index : old_sz;
+    if (compressed)
+        from -= from % (COMPRESS_UNIT_BLOCKS * g_fs->store.blockSize());
+    reserve_blocks(blocks_for(new_sz) - from / g_fs->store.blockSize());
+
+    FileVersion saved;
+    if (compressed)
+    {
+        vault_save(g_fs, slot, index, size, s->user.username, saved);
+        int rc = write_compressed(slot, old_sz, index, data, size);
+        if (rc != (int)OFSErrorCodes::SUCCESS)
+            return rc;
+    }
+    else
+    {
+        int rc = resize_blocks(slot, new_sz);
+        if (rc != (int)OFSErrorCodes::SUCCESS)
+            return rc;
 
-            uint64_t old_sz = f.actual_size;
-            uint64_t new_sz = content.size();
+        rc = dedup_unshare(g_fs, slot, from, end - from);
+        if (rc != (int)OFSErrorCodes::SUCCESS)
+            return rc;
 
-            f.actual_size = new_sz;
-            f.entry.size = new_sz;
-            f.entry.modified_time = time(nullptr);
+        vault_save(g_fs, slot, index, size, s->user.username, saved);
 
-            if (new_sz > old_sz)
-            {
-                uint64_t diff = new_sz - old_sz;
-                g_fs->stats.used_space += diff;
-                g_fs->stats.free_space -= diff;
-            }
-            else if (old_sz > new_sz)
-            {
-                uint64_t diff = old_sz - new_sz;
-                g_fs->stats.used_space -= diff;
-                g_fs->stats.free_space += diff;
-            }
+        // Bytes between the old end of file and the edit point read back as zeros.
+        const vector<Extent>& extents = g_fs->inodes.data(slot).extents;
+        if (index > old_sz && g_fs->store.zeroRange(extents, old_sz, index - old_sz) != OFSErrorCodes::SUCCESS)
+            return (int)OFSErrorCodes::ERROR_IO_ERROR;
 
-            return (int)OFSErrorCodes::SUCCESS;
-        }
+        if (g_fs->store.writeRange(extents, index, data, size) != OFSErrorCodes::SUCCESS)
+            return (int)OFSErrorCodes::ERROR_IO_ERROR;
     }
-    return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+
+    g_fs->inodes[slot].size = new_sz;
+    touch_entry(g_fs, slot);
+    text_changed(g_fs, slot);
+
+    quota_charge(g_fs, owner, (int64_t)(new_sz - old_sz), 0);
+    if (new_sz > old_sz)
+    {
+        uint64_t diff = new_sz - old_sz;
+        g_fs->stats.used_space += diff;
+        g_fs->stats.free_space -= diff;
+    }
+    else if (old_sz > new_sz)
+    {
+        uint64_t diff = old_sz - new_sz;
+        g_fs->stats.used_space -= diff;
+        g_fs->stats.free_space += diff;
+    }
+
+    LogRecord rec(LogOp::FILE_EDIT, s);
+    rec.putString(path);
+    rec.putU32(index);
+    rec.putBytes(data, size);
+    vault_log(rec, saved);
+    return fs_log_commit(rec);
 }
 
-int file_delete(void* session, const char* path)
+int file_edit(void* session, const char* path, const char* data, size_t size, unsigned int index)
 {
-    if (!session || !path)
+    if (!session || !path || !data)
         return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
 
-    for (size_t i = 0; i < g_fs->files.size(); ++i)
-    {
-        if (strcmp(g_fs->files[i].path, path) == 0)
-        {
-            uint64_t removed = g_fs->files[i].content.size();
+    uint32_t slot = find_entry(g_fs, path);
+    if (slot == NO_INODE)
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
 
-            g_fs->stats.used_space -= removed;
-            g_fs->stats.free_space += removed;
-            g_fs->stats.total_files--;
+    return write_at((SessionInfo*)session, slot, path, data, size, index);
+}
 
-            g_fs->files.erase(g_fs->files.begin() + i);
-            return (int)OFSErrorCodes::SUCCESS;
-        }
-    }
-    return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+int file_delete(void* session, const char* path)
+{
+    if (!session || !path)
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+
+    uint32_t slot = find_entry(g_fs, path);
+    if (slot == NO_INODE)
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+    if (g_fs->inodes[slot].child != NO_INODE)
+        return (int)OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY;
+
+    uint64_t removed = g_fs->inodes[slot].size;
+    frag_account(g_fs, slot, -1);
+    checkpoint_release(g_fs, g_fs->inodes.data(slot).extents);
+
+    quota_charge(g_fs, g_fs->inodes[slot].owner, -(int64_t)removed, 0);
+    g_fs->stats.used_space -= removed;
+    g_fs->stats.free_space += removed;
+    g_fs->stats.total_files--;
+
+    remove_entry(g_fs, slot);
+    LogRecord rec(LogOp::FILE_DELETE, (SessionInfo*)session);
+    rec.putString(path);
+    return fs_log_commit(rec);
 }
 
 int file_truncate(void* session, const char* path)
@@ -148,25 +401,30 @@ int file_truncate(void* session, const char* path)
     if (!session || !path)
         return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
 
-    for (auto& f : g_fs->files)
-    {
-        if (strcmp(f.path, path) == 0)
-        {
-            uint64_t removed = f.content.size();
+    uint32_t slot = find_entry(g_fs, path);
+    if (slot == NO_INODE)
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
 
-            f.content.clear();
-            f.entry.size = 0;
-            f.actual_size = 0;
+    uint64_t removed = g_fs->inodes[slot].size;
 
-            g_fs->stats.used_space -= removed;
-            g_fs->stats.free_space += removed;
+    FileVersion saved;
+    vault_save(g_fs, slot, 0, UINT64_MAX, ((SessionInfo*)session)->user.username, saved);
+    resize_blocks(slot, 0);
+    if (!g_fs->inodes.chunks(slot).empty())
+        g_fs->inodes.extra(slot).chunks.clear();
+    g_fs->inodes[slot].size = 0;
 
-            f.entry.modified_time = time(nullptr);
+    quota_charge(g_fs, g_fs->inodes[slot].owner, -(int64_t)removed, 0);
+    g_fs->stats.used_space -= removed;
+    g_fs->stats.free_space += removed;
 
-            return (int)OFSErrorCodes::SUCCESS;
-        }
-    }
-    return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+    touch_entry(g_fs, slot);
+    text_changed(g_fs, slot);
+
+    LogRecord rec(LogOp::FILE_TRUNCATE, (SessionInfo*)session);
+    rec.putString(path);
+    vault_log(rec, saved);
+    return fs_log_commit(rec);
 }
 
 int file_exists(void* session, const char* path)
@@ -174,9 +432,8 @@ int file_exists(void* session, const char* path)
     if (!session || !path)
         return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
 
-    for (auto& f : g_fs->files)
-        if (strcmp(f.path, path) == 0)
-            return (int)OFSErrorCodes::SUCCESS;
+    if (find_entry(g_fs, path) != NO_INODE)
+        return (int)OFSErrorCodes::SUCCESS;
 
     return (int)OFSErrorCodes::ERROR_NOT_FOUND;
 }
@@ -186,22 +443,380 @@ int file_rename(void* session, const char* old_path, const char* new_path)
     if (!session || !old_path || !new_path)
         return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
 
-    for (auto& f : g_fs->files)
+    uint32_t slot = find_entry(g_fs, old_path);
+    if (slot == NO_INODE)
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+
+    OFSErrorCodes moved = rename_entry(g_fs, slot, new_path);
+    if (moved != OFSErrorCodes::SUCCESS)
+        return (int)moved;
+    touch_entry(g_fs, slot);
+
+    LogRecord rec(LogOp::FILE_RENAME, (SessionInfo*)session);
+    rec.putString(old_path);
+    rec.putString(new_path);
+    return fs_log_commit(rec);
+}
+
+int file_versions(void* session, const char* path, FileVersion** versions, int* count)
+{
+    if (!session || !path || !versions || !count)
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+
+    uint32_t slot = find_entry(g_fs, path);
+    if (slot == NO_INODE)
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+
+    vector<FileVersion> out;
+    for (const auto& v : g_fs->inodes.history(slot))
+        if (!g_fs->vault.expired(v.vault_pos))
+            out.push_back(v);
+
+    const InodeData& d = g_fs->inodes.data(slot);
+    FileVersion cur{};
+    cur.version = d.version;
+    cur.size = g_fs->inodes[slot].size;
+    cur.time = g_fs->inodes[slot].mtime;
+    strncpy(cur.author, g_fs->inodes.ownerName(d.author), sizeof(cur.author) - 1);
+    out.push_back(cur);
+
+    *count = (int)out.size();
+    *versions = new FileVersion[out.size()];
+    for (size_t i = 0; i < out.size(); ++i)
+        (*versions)[i] = out[i];
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+int file_read_version(void* session, const char* path, unsigned int version, char** buffer, size_t* size)
+{
+    if (!session || !path || !buffer || !size)
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+
+    uint32_t slot = find_entry(g_fs, path);
+    if (slot == NO_INODE)
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+
+    string content;
+    int rc = vault_read(g_fs, slot, version, content);
+    if (rc != (int)OFSErrorCodes::SUCCESS)
+        return rc;
+
+    *size = content.size();
+    *buffer = new char[*size + 1];
+    memcpy(*buffer, content.data(), *size);
+    (*buffer)[*size] = '\0';
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+int file_rollback(void* session, const char* path, unsigned int version)
+{
+    if (!session || !path)
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+
+    uint32_t slot = find_entry(g_fs, path);
+    if (slot == NO_INODE)
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+
+    string content;
+    int rc = vault_read(g_fs, slot, version, content);
+    if (rc != (int)OFSErrorCodes::SUCCESS)
+        return rc;
+
+    // The rollback is itself a new version; the one it replaces is
+    // kept in full.
+    uint64_t old_sz = g_fs->inodes[slot].size;
+    uint32_t owner = g_fs->inodes[slot].owner;
+    if (content.size() > old_sz && !quota_allows(g_fs, owner, content.size() - old_sz, 0))
+        return (int)OFSErrorCodes::ERROR_NO_SPACE;
+    reserve_blocks(blocks_for(content.size()));
+    FileVersion saved;
+    vault_save(g_fs, slot, 0, UINT64_MAX, ((SessionInfo*)session)->user.username, saved);
+
+    if (g_fs->inodes[slot].compression == COMPRESS_LZ)
     {
-        if (strcmp(f.path, old_path) == 0)
-        {
-            strncpy(f.path, new_path, sizeof(f.path) - 1);
+        rc = write_compressed(slot, 0, 0, content.data(), content.size());
+        if (rc != (int)OFSErrorCodes::SUCCESS)
+            return rc;
+    }
+    else
+    {
+        rc = resize_blocks(slot, content.size());
+        if (rc == (int)OFSErrorCodes::SUCCESS)
+            rc = dedup_unshare(g_fs, slot, 0, content.size());
+        if (rc != (int)OFSErrorCodes::SUCCESS)
+            return rc;
+        if (g_fs->store.writeRange(g_fs->inodes.data(slot).extents, 0, content.data(), content.size()) != OFSErrorCodes::SUCCESS)
+            return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    }
+
+    g_fs->inodes[slot].size = content.size();
+    touch_entry(g_fs, slot);
+    text_changed(g_fs, slot);
+    quota_charge(g_fs, owner, (int64_t)content.size() - (int64_t)old_sz, 0);
+    g_fs->stats.used_space = g_fs->stats.used_space - old_sz + content.size();
+    g_fs->stats.free_space = g_fs->stats.free_space + old_sz - content.size();
+
+    LogRecord rec(LogOp::FILE_ROLLBACK, (SessionInfo*)session);
+    rec.putString(path);
+    rec.putU32(version);
+    vault_log(rec, saved);
+    return fs_log_commit(rec);
+}
+
+int file_search(void* session, const char* query, int limit, char** results, size_t* size, int* count)
+{
+    if (!session || !query || !results || !size || !count || limit <= 0)
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+    if (g_fs->config.index_step_bytes == 0)
+        return (int)OFSErrorCodes::ERROR_NOT_IMPLEMENTED;
 
-            string p(new_path);
-            size_t slash = p.find_last_of('/');
-            string name = (slash == string::npos) ? p : p.substr(slash + 1);
+    text_merge(g_fs, g_fs->config.index_step_bytes);
+
+    // Postings of files still queued may be out of date.
+    vector<pair<uint32_t, uint64_t>> hits;
+    if (!g_fs->text.search(query, hits))
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+    size_t keep = 0;
+    for (size_t i = 0; i < hits.size() && keep < (size_t)limit; ++i)
+        if (!g_fs->text.isQueued(hits[i].first))
+            hits[keep++] = hits[i];
+    hits.resize(keep);
+
+    string out;
+    string snippet;
+    for (const auto& h : hits)
+    {
+        uint64_t file_size = g_fs->inodes[h.first].size;
+        uint64_t from = h.second > SEARCH_SNIPPET / 2 ? h.second - SEARCH_SNIPPET / 2 : 0;
+        uint64_t len = file_size - from < SEARCH_SNIPPET ? file_size - from : SEARCH_SNIPPET;
+        snippet.resize(len);
+        if (content_read(g_fs, h.first, from, len, &snippet[0]) != (int)OFSErrorCodes::SUCCESS)
+            snippet.clear();
+        for (char& c : snippet)
+            if ((unsigned char)c < 0x20 || c == 0x7F)
+                c = ' ';
+
+        out += g_fs->inodes.path(h.first);
+        out += '\t';
+        out += to_string(h.second);
+        out += '\t';
+        out += snippet;
+        out += '\n';
+    }
+
+    *count = (int)hits.size();
+    *size = out.size();
+    *results = new char[out.size() + 1];
+    memcpy(*results, out.c_str(), out.size() + 1);
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+// Switches the compression flag of a file in step with frag_account.
+static void set_file_compression(uint32_t slot, uint32_t mode)
+{
+    frag_account(g_fs, slot, -1);
+    g_fs->inodes[slot].compression = (uint8_t)mode;
+    frag_account(g_fs, slot, +1);
+}
+
+int set_compression(void* session, const char* path, uint32_t mode)
+{
+    if (!session || !path || mode > COMPRESS_OFF)
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+
+    // The root is not an entry; its policy is kept on its own and saved
+    // with each checkpoint.
+    if (strcmp(path, "/") == 0)
+    {
+        g_fs->root_compression = mode;
+        LogRecord rec(LogOp::SET_COMPRESSION, (SessionInfo*)session);
+        rec.putString(path);
+        rec.putU32(mode);
+        return fs_log_commit(rec);
+    }
 
-            strncpy(f.entry.name, name.c_str(), sizeof(f.entry.name) - 1);
+    uint32_t slot = find_entry(g_fs, path);
+    if (slot == NO_INODE)
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+    Inode& f = g_fs->inodes[slot];
 
-            f.entry.modified_time = time(nullptr);
+    uint32_t want = mode == COMPRESS_LZ ? COMPRESS_LZ : COMPRESS_NONE;
+    if (f.getType() == EntryType::DIRECTORY)
+    {
+        f.compression = (uint8_t)mode;
+    }
+    else if (f.compression != want)
+    {
+        reserve_blocks(blocks_for(f.size));
+        string content(f.size, '\0');
+        if (content_read(g_fs, slot, 0, content.size(), &content[0]) != (int)OFSErrorCodes::SUCCESS)
+            return (int)OFSErrorCodes::ERROR_IO_ERROR;
 
-            return (int)OFSErrorCodes::SUCCESS;
+        int rc = (int)OFSErrorCodes::SUCCESS;
+        if (want == COMPRESS_LZ)
+        {
+            set_file_compression(slot, COMPRESS_LZ);
+            rc = write_compressed(slot, 0, 0, content.data(), content.size());
+            if (rc != (int)OFSErrorCodes::SUCCESS)
+                set_file_compression(slot, COMPRESS_NONE);
+        }
+        else
+        {
+            // Plain copy into new blocks; the compressed ones are
+            // released by the next checkpoint, as in write_compressed.
+            uint64_t n = blocks_for(content.size());
+            vector<Extent> plain;
+            if (n > 0)
+            {
+                auto res = g_fs->bitmap.allocateExtent((unsigned int)n);
+                rc = (int)res.first;
+                if (rc == (int)OFSErrorCodes::SUCCESS)
+                    append_extents(plain, res.second);
+                if (rc == (int)OFSErrorCodes::SUCCESS
+                    && g_fs->store.writeRange(plain, 0, content.data(), content.size()) != OFSErrorCodes::SUCCESS)
+                {
+                    g_fs->bitmap.freeExtents(plain);
+                    rc = (int)OFSErrorCodes::ERROR_IO_ERROR;
+                }
+            }
+            if (rc == (int)OFSErrorCodes::SUCCESS)
+            {
+                vector<Extent>& extents = g_fs->inodes.data(slot).extents;
+                frag_account(g_fs, slot, -1);
+                g_fs->deferred_free.insert(g_fs->deferred_free.end(), extents.begin(), extents.end());
+                extents = plain;
+                f.blocks = (uint32_t)n;
+                f.compression = (uint8_t)want;
+                g_fs->inodes.extra(slot).chunks.clear();
+                frag_account(g_fs, slot, +1);
+            }
         }
+        if (rc != (int)OFSErrorCodes::SUCCESS)
+            return rc;
+    }
+
+    touch_entry(g_fs, slot);
+
+    LogRecord rec(LogOp::SET_COMPRESSION, (SessionInfo*)session);
+    rec.putString(path);
+    rec.putU32(mode);
+    return fs_log_commit(rec);
+}
+
+// The owner's bits apply to the owner, the others' bits to everyone else;
+// administrators may open anything.
+static bool may_open(const SessionInfo* s, uint32_t slot, uint32_t mode)
+{
+    if (s->user.role == UserRole::ADMIN)
+        return true;
+
+    const Inode& f = g_fs->inodes[slot];
+    bool owner = strcmp(g_fs->inodes.ownerName(f.owner), s->user.username) == 0;
+    uint32_t want = 0;
+    if (mode & OPEN_READ)
+        want |= (uint32_t)(owner ? FilePermissions::OWNER_READ : FilePermissions::OTHERS_READ);
+    if (mode & OPEN_WRITE)
+        want |= (uint32_t)(owner ? FilePermissions::OWNER_WRITE : FilePermissions::OTHERS_WRITE);
+    return (f.permissions & want) == want;
+}
+
+// The open file behind a handle, if it belongs to this session.
+static OpenFile* find_handle(void* session, uint64_t handle)
+{
+    auto it = g_fs->handles.find(handle);
+    if (it == g_fs->handles.end() || it->second.session != session)
+        return nullptr;
+    return &it->second;
+}
+
+// False once the opened inode was freed, even if its slot was reused.
+static bool handle_live(const OpenFile& h)
+{
+    return g_fs->inodes.used(h.slot) && g_fs->inodes[h.slot].generation == h.generation;
+}
+
+int file_open(void* session, const char* path, uint32_t mode, uint64_t* handle)
+{
+    if (!session || !path || !handle || mode == 0 || (mode & ~(OPEN_READ | OPEN_WRITE)))
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+
+    uint32_t slot = find_entry(g_fs, path);
+    if (slot == NO_INODE)
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+    if (g_fs->inodes[slot].getType() != EntryType::FILE)
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+    if (!may_open((SessionInfo*)session, slot, mode))
+        return (int)OFSErrorCodes::ERROR_PERMISSION_DENIED;
+
+    *handle = ++g_fs->next_handle;
+    g_fs->handles[*handle] = {(SessionInfo*)session, slot, g_fs->inodes[slot].generation, mode};
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+int file_pread(void* session, uint64_t handle, char* buffer, size_t size, uint64_t offset, size_t* read)
+{
+    if (!session || !buffer || !read)
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+
+    OpenFile* h = find_handle(session, handle);
+    if (!h)
+        return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    if (!handle_live(*h))
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+    if (!(h->mode & OPEN_READ))
+        return (int)OFSErrorCodes::ERROR_PERMISSION_DENIED;
+
+    uint64_t file_size = g_fs->inodes[h->slot].size;
+    *read = 0;
+    if (offset >= file_size)
+        return (int)OFSErrorCodes::SUCCESS;
+
+    size_t n = (size_t)(size < file_size - offset ? size : file_size - offset);
+    if (content_read(g_fs, h->slot, offset, n, buffer) != (int)OFSErrorCodes::SUCCESS)
+        return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    *read = n;
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+int file_pwrite(void* session, uint64_t handle, const char* data, size_t size, uint64_t offset)
+{
+    if (!session || !data)
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+
+    OpenFile* h = find_handle(session, handle);
+    if (!h)
+        return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    if (!handle_live(*h))
+        return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+    if (!(h->mode & OPEN_WRITE))
+        return (int)OFSErrorCodes::ERROR_PERMISSION_DENIED;
+
+    // The change log records edit offsets in 32 bits.
+    if (offset > UINT32_MAX)
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+
+    string path = g_fs->inodes.path(h->slot);
+    return write_at((SessionInfo*)session, h->slot, path.c_str(), data, size, (unsigned int)offset);
+}
+
+int file_close(void* session, uint64_t handle)
+{
+    if (!session)
+        return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+    if (!find_handle(session, handle))
+        return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+
+    g_fs->handles.erase(handle);
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+void file_close_all(void* session)
+{
+    for (auto it = g_fs->handles.begin(); it != g_fs->handles.end();)
+    {
+        if (it->second.session == session)
+            it = g_fs->handles.erase(it);
+        else
+            ++it;
     }
-    return (int)OFSErrorCodes::ERROR_NOT_FOUND;
 }
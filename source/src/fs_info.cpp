@@ -1,6 +1,11 @@
 #include "../include/fs_info.hpp"
 #include "../include/fs_core.hpp"
+#include "../include/defrag.hpp"
+#include "../include/dedup.hpp"
+#include "../include/compress.hpp"
+#include "../include/scrub.hpp"
 #include <cstring>
+#include <vector>
 
 using namespace std;
 
@@ -13,16 +18,15 @@ int get_metadata(void* session, const char* path, FileMetadata* meta)
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
 
-    for (auto& f : g_fs->files) 
+    uint32_t slot = find_entry(g_fs, path);
+    if (slot == NO_INODE)
     {
-        if (strcmp(f.path, path) == 0) 
-        {
-            *meta = f;
-            return static_cast<int>(OFSErrorCodes::SUCCESS);
-        }
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
 
-    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    g_fs->inodes.metadata(slot, *meta);
+    meta->actual_size = meta->blocks_used * g_fs->store.blockSize();
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
 int set_permissions(void* session, const char* path, uint32_t permissions) 
@@ -32,17 +36,19 @@ int set_permissions(void* session, const char* path, uint32_t permissions)
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
 
-    for (auto& f : g_fs->files) 
+    uint32_t slot = find_entry(g_fs, path);
+    if (slot == NO_INODE)
     {
-        if (strcmp(f.path, path) == 0) 
-        {
-            f.entry.permissions = permissions;
-            f.entry.modified_time = static_cast<uint64_t>(time(nullptr));
-            return static_cast<int>(OFSErrorCodes::SUCCESS);
-        }
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
 
-    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    g_fs->inodes[slot].permissions = permissions;
+    touch_entry(g_fs, slot);
+
+    LogRecord rec(LogOp::SET_PERMISSIONS, reinterpret_cast<SessionInfo*>(session));
+    rec.putString(path);
+    rec.putU32(permissions);
+    return fs_log_commit(rec);
 }
 
 int get_stats(void* session, FSStats* stats) 
@@ -52,10 +58,90 @@ int get_stats(void* session, FSStats* stats)
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
 
+    frag_refresh(g_fs);
+    dedup_refresh(g_fs);
+    compress_refresh(g_fs);
+    scrub_refresh(g_fs);
     *stats = g_fs->stats;
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
+int get_lookup_stats(void* session, LookupStats* stats)
+{
+    if (!session || !stats)
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+
+    stats->name_lookups = g_fs->tree.index().lookups();
+    stats->bloom_negatives = g_fs->tree.index().filtered();
+    stats->bloom_false_positives = g_fs->tree.index().falsePositives();
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// One path per line, in the order given.
+static void path_list(const vector<uint32_t>& slots, char** paths, size_t* size, int* count)
+{
+    string out;
+    for (uint32_t s : slots)
+    {
+        out += g_fs->inodes.path(s);
+        out.push_back('\n');
+    }
+    *count = static_cast<int>(slots.size());
+    *size = out.size();
+    *paths = new char[out.size() + 1];
+    memcpy(*paths, out.c_str(), out.size() + 1);
+}
+
+int find_by_owner(void* session, const char* owner, uint64_t cursor, int limit, char** paths, size_t* size,
+                  int* count, uint64_t* next_cursor)
+{
+    if (!session || !owner || !paths || !size || !count || !next_cursor || limit <= 0)
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+
+    uint32_t from;
+    if (!cursor_entry(g_fs, cursor, from))
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+
+    vector<uint32_t> slots;
+    uint32_t next = NO_INODE;
+    uint32_t id;
+    if (g_fs->inodes.findOwner(owner, id) && !g_fs->meta.byOwner(g_fs->inodes, id, from, limit, slots, next))
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+
+    *next_cursor = entry_cursor(g_fs, next);
+    path_list(slots, paths, size, count);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int changed_since(void* session, uint64_t since, uint64_t cursor, int limit, char** paths, size_t* size,
+                  int* count, uint64_t* next_cursor)
+{
+    if (!session || !paths || !size || !count || !next_cursor || limit <= 0)
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+
+    uint32_t from;
+    vector<uint32_t> slots;
+    uint32_t next;
+    if (!cursor_entry(g_fs, cursor, from) || !g_fs->meta.changedSince(g_fs->inodes, since, from, limit, slots, next))
+    {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+
+    *next_cursor = entry_cursor(g_fs, next);
+    path_list(slots, paths, size, count);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
 void free_buffer(void* buffer) 
 {
     if (buffer) 
@@ -1,5 +1,6 @@
 #include "../include/fs_user.hpp"
 #include "../include/fs_core.hpp"
+#include "../include/fs_file.hpp"
 #include "../include/user_manager_hash.hpp"
 
 #include <iostream>
@@ -74,6 +75,7 @@ int user_logout(void* session)
     SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
     for (size_t i = 0; i < g_fs->sessions.size(); ++i) {
         if (g_fs->sessions[i] == s) {
+            file_close_all(s);
             delete g_fs->sessions[i];
             g_fs->sessions.erase(g_fs->sessions.begin() + i);
             g_fs->stats.active_sessions = static_cast<uint32_t>(g_fs->sessions.size());
@@ -102,11 +104,19 @@ int user_create(void* admin_session, const char* username, const char* password,
         }
     }
 
-    UserInfo u(std::string(username), std::string(password), role, static_cast<uint64_t>(time(nullptr)));
+    UserInfo u(std::string(username), std::string(password), role, fs_now());
+    int rc = user_table_store(u);
+    if (rc != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        return rc;
+    }
     g_fs->users.push_back(u);
     g_fs->stats.total_users = static_cast<uint32_t>(g_fs->users.size());
 
-    return static_cast<int>(OFSErrorCodes::SUCCESS);
+    LogRecord rec(LogOp::USER_CREATE, reinterpret_cast<SessionInfo*>(admin_session));
+    rec.putString(username);
+    rec.putString(password);
+    rec.putU32(static_cast<uint32_t>(role));
+    return fs_log_commit(rec);
 }
 
 int user_delete(void* admin_session, const char* username)
@@ -123,9 +133,20 @@ int user_delete(void* admin_session, const char* username)
 
     for (size_t i = 0; i < g_fs->users.size(); ++i) {
         if (std::strncmp(g_fs->users[i].username, username, sizeof(g_fs->users[i].username)) == 0) {
+            int rc = user_table_erase(username);
+            if (rc != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+                return rc;
+            }
+            UserInfo gone = g_fs->users[i];
+            gone.quota_bytes = 0;
+            gone.quota_inodes = 0;
+            quota_set_limits(g_fs, gone);
             g_fs->users.erase(g_fs->users.begin() + i);
             g_fs->stats.total_users = static_cast<uint32_t>(g_fs->users.size());
-            return static_cast<int>(OFSErrorCodes::SUCCESS);
+
+            LogRecord rec(LogOp::USER_DELETE, reinterpret_cast<SessionInfo*>(admin_session));
+            rec.putString(username);
+            return fs_log_commit(rec);
         }
     }
 
@@ -169,3 +190,64 @@ int get_session_info(void* session, SessionInfo* info)
     *info = *s;
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
+
+int user_set_quota(void* admin_session, const char* username, uint64_t max_bytes, uint32_t max_inodes)
+{
+    if (!admin_session || !username) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    if (!g_fs) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+    }
+    if (!is_admin_session(admin_session)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+
+    for (size_t i = 0; i < g_fs->users.size(); ++i) {
+        if (std::strncmp(g_fs->users[i].username, username, sizeof(g_fs->users[i].username)) == 0) {
+            UserInfo u = g_fs->users[i];
+            u.quota_bytes = max_bytes;
+            u.quota_inodes = max_inodes;
+            int rc = user_table_store(u);
+            if (rc != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+                return rc;
+            }
+            g_fs->users[i] = u;
+            quota_set_limits(g_fs, u);
+            return static_cast<int>(OFSErrorCodes::SUCCESS);
+        }
+    }
+
+    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+}
+
+int user_get_quota(void* session, const char* username, QuotaInfo* info)
+{
+    if (!session || !username || !info) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    if (!g_fs) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+    }
+    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    if (!is_admin_session(session) && std::strncmp(s->user.username, username, sizeof(s->user.username)) != 0) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+
+    for (size_t i = 0; i < g_fs->users.size(); ++i) {
+        if (std::strncmp(g_fs->users[i].username, username, sizeof(g_fs->users[i].username)) == 0) {
+            OwnerQuota q{};
+            uint32_t id;
+            if (g_fs->inodes.findOwner(username, id) && id < g_fs->quotas.size()) {
+                q = g_fs->quotas[id];
+            }
+            info->used_bytes = q.bytes;
+            info->max_bytes = g_fs->users[i].quota_bytes;
+            info->used_inodes = q.inodes;
+            info->max_inodes = g_fs->users[i].quota_inodes;
+            return static_cast<int>(OFSErrorCodes::SUCCESS);
+        }
+    }
+
+    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+}
@@ -0,0 +1,249 @@
+#include "../include/inode_table.hpp"
+#include <cstring>
+
+using namespace std;
+
+// Rewrite the arena once more than half of it holds names no inode uses.
+static const size_t NAMES_COMPACT_MIN = 64 * 1024;
+
+static const vector<uint32_t> NO_CHUNKS;
+static const vector<FileVersion> NO_HISTORY;
+
+InodeTable::InodeTable()
+{
+    clear();
+}
+
+void InodeTable::clear()
+{
+    hot_.clear();
+    data_.clear();
+    extra_.clear();
+    names_.clear();
+    names_dead_ = 0;
+    owners_.clear();
+    owner_ids_.clear();
+    free_head_ = NO_INODE;
+    generation_ = 0;
+    count_ = 0;
+}
+
+static void reset(Inode& i, InodeData& d, EntryType type)
+{
+    memset(&i, 0, sizeof(i));
+    i.parent = i.child = i.next = i.prev = NO_INODE;
+    i.type = static_cast<uint8_t>(type);
+    d.extents.clear();
+    d.extents.shrink_to_fit();
+    d.version = 1;
+    d.author = 0;
+}
+
+uint32_t InodeTable::allocate(EntryType type)
+{
+    uint32_t slot = free_head_;
+    if (slot != NO_INODE)
+    {
+        free_head_ = hot_[slot].next;
+    }
+    else
+    {
+        slot = static_cast<uint32_t>(hot_.size());
+        hot_.emplace_back();
+        data_.emplace_back();
+    }
+    reset(hot_[slot], data_[slot], type);
+    hot_[slot].generation = ++generation_;
+    count_++;
+    return slot;
+}
+
+void InodeTable::release(uint32_t slot)
+{
+    Inode& i = hot_[slot];
+    names_dead_ += i.name_len;
+    reset(i, data_[slot], EntryType::FILE);
+    i.type = FREE_INODE;
+    i.next = free_head_;
+    free_head_ = slot;
+    extra_.erase(slot);
+    count_--;
+
+    if (names_dead_ > NAMES_COMPACT_MIN && names_dead_ * 2 > names_.size())
+        compactNames();
+}
+
+void InodeTable::claim(uint32_t slot, EntryType type)
+{
+    while (hot_.size() <= slot)
+    {
+        hot_.emplace_back();
+        data_.emplace_back();
+        hot_.back().type = FREE_INODE;
+    }
+    reset(hot_[slot], data_[slot], type);
+    count_++;
+}
+
+void InodeTable::relinkFree()
+{
+    // Lowest slots first, so they are reused first.
+    free_head_ = NO_INODE;
+    for (uint32_t s = static_cast<uint32_t>(hot_.size()); s-- > 0;)
+    {
+        if (hot_[s].type == FREE_INODE)
+        {
+            hot_[s].next = free_head_;
+            free_head_ = s;
+        }
+    }
+}
+
+uint32_t InodeTable::generation() const
+{
+    return generation_;
+}
+
+void InodeTable::setGeneration(uint32_t generation)
+{
+    generation_ = generation;
+}
+
+size_t InodeTable::size() const
+{
+    return count_;
+}
+
+uint32_t InodeTable::slots() const
+{
+    return static_cast<uint32_t>(hot_.size());
+}
+
+bool InodeTable::used(uint32_t slot) const
+{
+    return slot < hot_.size() && hot_[slot].type != FREE_INODE;
+}
+
+const vector<uint32_t>& InodeTable::chunks(uint32_t slot) const
+{
+    auto it = extra_.find(slot);
+    return it == extra_.end() ? NO_CHUNKS : it->second.chunks;
+}
+
+InodeExtra& InodeTable::extra(uint32_t slot)
+{
+    return extra_[slot];
+}
+
+const vector<FileVersion>& InodeTable::history(uint32_t slot) const
+{
+    auto it = extra_.find(slot);
+    return it == extra_.end() ? NO_HISTORY : it->second.history;
+}
+
+string_view InodeTable::name(uint32_t slot) const
+{
+    const Inode& i = hot_[slot];
+    return string_view(names_.data() + i.name, i.name_len);
+}
+
+void InodeTable::setName(uint32_t slot, string_view name)
+{
+    Inode& i = hot_[slot];
+    names_dead_ += i.name_len;
+    i.name = static_cast<uint32_t>(names_.size());
+    i.name_len = static_cast<uint16_t>(name.size());
+    names_.insert(names_.end(), name.begin(), name.end());
+}
+
+void InodeTable::compactNames()
+{
+    vector<char> packed;
+    packed.reserve(names_.size() - names_dead_);
+    for (Inode& i : hot_)
+    {
+        if (i.type == FREE_INODE)
+            continue;
+        uint32_t at = static_cast<uint32_t>(packed.size());
+        packed.insert(packed.end(), names_.begin() + i.name, names_.begin() + i.name + i.name_len);
+        i.name = at;
+    }
+    names_.swap(packed);
+    names_dead_ = 0;
+}
+
+uint32_t InodeTable::internOwner(const char* name)
+{
+    auto it = owner_ids_.find(name);
+    if (it != owner_ids_.end())
+        return it->second;
+    uint32_t id = static_cast<uint32_t>(owners_.size());
+    owners_.push_back(name);
+    owner_ids_.emplace(owners_.back(), id);
+    return id;
+}
+
+bool InodeTable::findOwner(const char* name, uint32_t& id) const
+{
+    auto it = owner_ids_.find(name);
+    if (it == owner_ids_.end())
+        return false;
+    id = it->second;
+    return true;
+}
+
+const char* InodeTable::ownerName(uint32_t id) const
+{
+    return id < owners_.size() ? owners_[id].c_str() : "";
+}
+
+string InodeTable::path(uint32_t slot) const
+{
+    vector<uint32_t> chain;
+    for (uint32_t s = slot; s != NO_INODE; s = hot_[s].parent)
+        chain.push_back(s);
+
+    string out;
+    for (size_t k = chain.size(); k-- > 0;)
+    {
+        out += '/';
+        out += name(chain[k]);
+    }
+    return out;
+}
+
+FileEntry InodeTable::entry(uint32_t slot) const
+{
+    const Inode& i = hot_[slot];
+    FileEntry e(string(name(slot)), i.getType(), i.size, i.permissions, ownerName(i.owner), inodeNumber(slot));
+    e.generation = i.generation;
+    e.created_time = i.ctime;
+    e.modified_time = i.mtime;
+    return e;
+}
+
+void InodeTable::metadata(uint32_t slot, FileMetadata& out) const
+{
+    const Inode& i = hot_[slot];
+    const InodeData& d = data_[slot];
+    out = FileMetadata(path(slot), entry(slot));
+    out.blocks_used = i.blocks;
+    out.actual_size = 0;
+    out.extents = d.extents;
+    out.version = d.version;
+    strncpy(out.author, ownerName(d.author), sizeof(out.author) - 1);
+    out.history = history(slot);
+    out.compression = i.compression;
+    out.chunks = chunks(slot);
+}
+
+size_t InodeTable::memoryUsage() const
+{
+    size_t bytes = hot_.capacity() * sizeof(Inode) + data_.capacity() * sizeof(InodeData) + names_.capacity();
+    for (const InodeData& d : data_)
+        bytes += d.extents.capacity() * sizeof(Extent);
+    for (const auto& x : extra_)
+        bytes += sizeof(x) + x.second.chunks.capacity() * sizeof(uint32_t)
+               + x.second.history.capacity() * sizeof(FileVersion);
+    return bytes;
+}
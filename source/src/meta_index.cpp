@@ -0,0 +1,169 @@
+#include "../include/meta_index.hpp"
+#include <algorithm>
+
+using namespace std;
+
+MetaIndex::MetaIndex()
+{
+    clear();
+}
+
+void MetaIndex::clear()
+{
+    links_.clear();
+    owner_head_.clear();
+    oldest_ = newest_ = NO_INODE;
+}
+
+void MetaIndex::linkOwner(const InodeTable& inodes, uint32_t slot)
+{
+    Links& l = links_[slot];
+    auto it = owner_head_.find(inodes[slot].owner);
+    if (it == owner_head_.end())
+    {
+        l.owner_next = l.owner_prev = slot;
+        owner_head_[inodes[slot].owner] = slot;
+        return;
+    }
+    uint32_t head = it->second;
+    uint32_t tail = links_[head].owner_prev;
+    l.owner_next = head;
+    l.owner_prev = tail;
+    links_[tail].owner_next = slot;
+    links_[head].owner_prev = slot;
+}
+
+void MetaIndex::unlinkOwner(const InodeTable& inodes, uint32_t slot)
+{
+    Links& l = links_[slot];
+    auto it = owner_head_.find(inodes[slot].owner);
+    if (l.owner_next == slot)
+    {
+        owner_head_.erase(it);
+        return;
+    }
+    links_[l.owner_prev].owner_next = l.owner_next;
+    links_[l.owner_next].owner_prev = l.owner_prev;
+    if (it->second == slot)
+        it->second = l.owner_next;
+}
+
+void MetaIndex::linkTime(const InodeTable& inodes, uint32_t slot)
+{
+    // Normally the newest; walk back only if the clock went backwards.
+    uint32_t after = newest_;
+    while (after != NO_INODE && inodes[after].mtime > inodes[slot].mtime)
+        after = links_[after].older;
+
+    Links& l = links_[slot];
+    l.older = after;
+    l.newer = after == NO_INODE ? oldest_ : links_[after].newer;
+    if (l.older != NO_INODE)
+        links_[l.older].newer = slot;
+    else
+        oldest_ = slot;
+    if (l.newer != NO_INODE)
+        links_[l.newer].older = slot;
+    else
+        newest_ = slot;
+}
+
+void MetaIndex::unlinkTime(uint32_t slot)
+{
+    Links& l = links_[slot];
+    if (l.older != NO_INODE)
+        links_[l.older].newer = l.newer;
+    else
+        oldest_ = l.newer;
+    if (l.newer != NO_INODE)
+        links_[l.newer].older = l.older;
+    else
+        newest_ = l.older;
+}
+
+void MetaIndex::add(const InodeTable& inodes, uint32_t slot)
+{
+    if (slot >= links_.size())
+        links_.resize(inodes.slots());
+    linkOwner(inodes, slot);
+    linkTime(inodes, slot);
+}
+
+void MetaIndex::remove(const InodeTable& inodes, uint32_t slot)
+{
+    unlinkOwner(inodes, slot);
+    unlinkTime(slot);
+}
+
+void MetaIndex::touched(const InodeTable& inodes, uint32_t slot)
+{
+    unlinkTime(slot);
+    linkTime(inodes, slot);
+}
+
+void MetaIndex::rebuild(const InodeTable& inodes)
+{
+    clear();
+    links_.resize(inodes.slots());
+
+    vector<pair<uint64_t, uint32_t>> order;
+    order.reserve(inodes.size());
+    for (uint32_t s = 0; s < inodes.slots(); ++s)
+    {
+        if (inodes.used(s))
+        {
+            order.push_back({inodes[s].mtime, s});
+            linkOwner(inodes, s);
+        }
+    }
+    sort(order.begin(), order.end());
+    for (const auto& o : order)
+        linkTime(inodes, o.second);
+}
+
+bool MetaIndex::byOwner(const InodeTable& inodes, uint32_t owner, uint32_t from, size_t limit,
+                        vector<uint32_t>& out, uint32_t& next) const
+{
+    next = NO_INODE;
+    auto it = owner_head_.find(owner);
+    if (it == owner_head_.end())
+        return from == NO_INODE;
+    if (from == NO_INODE)
+        from = it->second;
+    else if (from >= links_.size() || !inodes.used(from) || inodes[from].owner != owner)
+        return false;
+
+    uint32_t s = from;
+    while (out.size() < limit)
+    {
+        out.push_back(s);
+        s = links_[s].owner_next;
+        if (s == it->second)
+            return true;
+    }
+    next = s;
+    return true;
+}
+
+bool MetaIndex::changedSince(const InodeTable& inodes, uint64_t since, uint32_t from, size_t limit,
+                             vector<uint32_t>& out, uint32_t& next) const
+{
+    next = NO_INODE;
+    if (from == NO_INODE)
+        from = newest_;
+    else if (from >= links_.size() || !inodes.used(from) || inodes[from].mtime < since)
+        return false;
+
+    uint32_t s = from;
+    while (s != NO_INODE && inodes[s].mtime >= since)
+    {
+        if (out.size() == limit)
+        {
+            next = s;
+            return true;
+        }
+        out.push_back(s);
+        s = links_[s].older;
+    }
+    return true;
+}
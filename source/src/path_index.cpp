@@ -1,76 +1,143 @@
 #include "../include/path_index.hpp"
+#include "../include/checksum.hpp"
+#include <cstring>
 
 using namespace std;
 
+static const size_t INITIAL_BUCKETS = 1024;
+
 PathIndex::PathIndex() 
 {
-    index_.reserve(1024);
+    clear();
+    lookups_ = filtered_ = false_positives_ = 0;
 }
 
 PathIndex::~PathIndex() = default;
 
-OFSErrorCodes PathIndex::insert(const string& path, const FileMetadata& meta) 
+uint32_t PathIndex::hashName(uint32_t parent, string_view name)
+{
+    uint64_t h = xxhash64(name.data(), name.size()) ^ (static_cast<uint64_t>(parent) * 0x9E3779B97F4A7C15ULL);
+    return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+size_t PathIndex::locate(const InodeTable& inodes, uint32_t parent, string_view name, uint32_t hash) const
 {
-    for (auto& p : index_) 
+    // Stops at the entry for (parent, name) or at the empty bucket ending its run.
+    size_t i = hash & mask_;
+    while (buckets_[i].slot != NO_INODE)
     {
-        if (p.first == path) 
+        uint32_t s = buckets_[i].slot;
+        if (buckets_[i].hash == hash && inodes[s].parent == parent && inodes.name(s) == name)
         {
-            return OFSErrorCodes::ERROR_FILE_EXISTS;
+            return i;
         }
+        i = (i + 1) & mask_;
     }
-    index_.push_back({path, meta});
-    return OFSErrorCodes::SUCCESS;
+    return i;
 }
 
-OFSErrorCodes PathIndex::remove(const string& path) 
+uint32_t PathIndex::find(const InodeTable& inodes, uint32_t parent, string_view name) const
 {
-    for (auto it = index_.begin(); it != index_.end(); ++it) 
+    uint32_t hash = hashName(parent, name);
+    lookups_++;
+    if (!filter_.mayContain(hash))
     {
-        if (it->first == path) 
-        {
-            index_.erase(it);
-            return OFSErrorCodes::SUCCESS;
-        }
+        filtered_++;
+        return NO_INODE;
     }
-    return OFSErrorCodes::ERROR_NOT_FOUND;
+    uint32_t slot = buckets_[locate(inodes, parent, name, hash)].slot;
+    if (slot == NO_INODE)
+    {
+        false_positives_++;
+    }
+    return slot;
 }
 
-FileMetadata* PathIndex::find(const string& path) 
+OFSErrorCodes PathIndex::insert(const InodeTable& inodes, uint32_t slot)
 {
-    for (auto& p : index_) 
+    if ((count_ + 1) * 2 > buckets_.size())
     {
-        if (p.first == path) 
-        {
-            return &p.second;
-        }
+        grow();
+    }
+
+    uint32_t parent = inodes[slot].parent;
+    string_view name = inodes.name(slot);
+    uint32_t hash = hashName(parent, name);
+    size_t i = locate(inodes, parent, name, hash);
+    if (buckets_[i].slot != NO_INODE)
+    {
+        return OFSErrorCodes::ERROR_FILE_EXISTS;
     }
-    return nullptr;
+    buckets_[i] = {hash, slot};
+    filter_.add(hash);
+    count_++;
+    return OFSErrorCodes::SUCCESS;
 }
 
-const FileMetadata* PathIndex::find(const string& path) const 
+OFSErrorCodes PathIndex::remove(const InodeTable& inodes, uint32_t slot)
 {
-    for (const auto& p : index_) 
+    uint32_t parent = inodes[slot].parent;
+    string_view name = inodes.name(slot);
+    uint32_t hash = hashName(parent, name);
+    size_t i = locate(inodes, parent, name, hash);
+    if (buckets_[i].slot != slot)
+    {
+        return OFSErrorCodes::ERROR_NOT_FOUND;
+    }
+    filter_.remove(hash);
+
+    // Backward shift: pull later entries of the run into the hole unless
+    // that would move one in front of its home bucket.
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask_; buckets_[j].slot != NO_INODE; j = (j + 1) & mask_)
     {
-        if (p.first == path) 
+        size_t home = buckets_[j].hash & mask_;
+        if (((j - home) & mask_) >= ((j - hole) & mask_))
         {
-            return &p.second;
+            buckets_[hole] = buckets_[j];
+            hole = j;
         }
     }
-    return nullptr;
+    buckets_[hole].slot = NO_INODE;
+    count_--;
+    return OFSErrorCodes::SUCCESS;
 }
 
-vector<string> PathIndex::listPaths() const 
+void PathIndex::grow()
 {
-    vector<string> out;
-    out.reserve(index_.size());
-    for (const auto& p : index_) 
+    // Stored hashes are enough to re-place every entry and refill the
+    // filter at its new size.
+    vector<Bucket> old;
+    old.swap(buckets_);
+    buckets_.assign(old.size() * 2, {0, NO_INODE});
+    mask_ = buckets_.size() - 1;
+    filter_.reset(buckets_.size() / 2);
+
+    for (const Bucket& b : old)
     {
-        out.push_back(p.first);
+        if (b.slot == NO_INODE)
+        {
+            continue;
+        }
+        size_t i = b.hash & mask_;
+        while (buckets_[i].slot != NO_INODE)
+        {
+            i = (i + 1) & mask_;
+        }
+        buckets_[i] = b;
+        filter_.add(b.hash);
     }
-    return out;
 }
 
 void PathIndex::clear() 
 {
-    index_.clear();
+    buckets_.assign(INITIAL_BUCKETS, {0, NO_INODE});
+    mask_ = INITIAL_BUCKETS - 1;
+    count_ = 0;
+    filter_.reset(INITIAL_BUCKETS / 2);
+}
+
+size_t PathIndex::size() const
+{
+    return count_;
 }
@@ -0,0 +1,44 @@
+#include "../include/quota.hpp"
+#include "../include/fs_core.hpp"
+
+using namespace std;
+
+static OwnerQuota& quota_of(FileSystemInstance* fs, uint32_t owner)
+{
+    if (owner >= fs->quotas.size())
+        fs->quotas.resize(static_cast<size_t>(owner) + 1, OwnerQuota{});
+    return fs->quotas[owner];
+}
+
+bool quota_allows(FileSystemInstance* fs, uint32_t owner, uint64_t bytes, uint64_t inodes)
+{
+    if (fs->replaying || owner >= fs->quotas.size())
+        return true;
+
+    const OwnerQuota& q = fs->quotas[owner];
+    if (q.max_bytes != 0 && q.bytes + bytes > q.max_bytes)
+        return false;
+    if (q.max_inodes != 0 && q.inodes + inodes > q.max_inodes)
+        return false;
+    return true;
+}
+
+void quota_charge(FileSystemInstance* fs, uint32_t owner, int64_t bytes, int64_t inodes)
+{
+    OwnerQuota& q = quota_of(fs, owner);
+    q.bytes += static_cast<uint64_t>(bytes);
+    q.inodes += static_cast<uint64_t>(inodes);
+}
+
+void quota_set_limits(FileSystemInstance* fs, const UserInfo& user)
+{
+    OwnerQuota& q = quota_of(fs, fs->inodes.internOwner(user.username));
+    q.max_bytes = user.quota_bytes;
+    q.max_inodes = user.quota_inodes;
+}
+
+void quota_load_limits(FileSystemInstance* fs)
+{
+    for (const UserInfo& u : fs->users)
+        quota_set_limits(fs, u);
+}
@@ -0,0 +1,55 @@
+#include "../include/scrub.hpp"
+#include "../include/fs_core.hpp"
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+unsigned int scrub_step(FileSystemInstance* fs, unsigned int max_blocks)
+{
+    if (!fs->store.checksumsEnabled())
+        return 0;
+
+    unsigned int total = fs->bitmap.totalBlocks();
+    uint64_t corrupt_before = fs->store.corruptBlocks();
+    unsigned int checked = 0;
+    while (checked < max_blocks)
+    {
+        unsigned int b = fs->bitmap.nextUsed(fs->scrub_cursor);
+        if (b >= total)
+        {
+            // End of the pass: start over from the first block next time.
+            fs->scrub_cursor = 0;
+            fs->stats.scrub_passes++;
+            break;
+        }
+        fs->store.scrubBlock(b);
+        fs->scrub_cursor = b + 1;
+        checked++;
+    }
+    fs->stats.scrubbed_blocks += checked;
+
+    if (fs->store.corruptBlocks() > corrupt_before)
+        cerr << "[scrub] " << fs->store.corruptBlocks() << " corrupt block(s) found.\n";
+    return checked;
+}
+
+int fs_scrub_step()
+{
+    FileSystemInstance* fs = g_fs;
+    if (!fs || fs->replaying || fs->config.scrub_step_blocks == 0)
+        return 0;
+
+    uint64_t now = static_cast<uint64_t>(chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count());
+    if (now - fs->last_scrub_ms < fs->config.scrub_interval_ms)
+        return 0;
+    fs->last_scrub_ms = now;
+
+    return static_cast<int>(scrub_step(fs, fs->config.scrub_step_blocks));
+}
+
+void scrub_refresh(FileSystemInstance* fs)
+{
+    fs->stats.corrupt_blocks = static_cast<uint32_t>(fs->store.corruptBlocks() + fs->metadata_corrupt);
+}
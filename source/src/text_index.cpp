@@ -0,0 +1,365 @@
+#include "../include/text_index.hpp"
+#include "../include/fs_core.hpp"
+#include "../include/compress.hpp"
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+static void put_varint(string& out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+static uint64_t get_varint(const string& in, size_t& pos)
+{
+    uint64_t v = 0;
+    int shift = 0;
+    while (pos < in.size())
+    {
+        uint8_t b = static_cast<uint8_t>(in[pos++]);
+        v |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            break;
+        shift += 7;
+    }
+    return v;
+}
+
+TextIndex::TextIndex()
+{
+    clear();
+}
+
+void TextIndex::clear()
+{
+    lists_.clear();
+    free_lists_.clear();
+    ids_.clear();
+    slot_terms_.clear();
+    queue_.clear();
+    queue_head_ = 0;
+    is_queued_.clear();
+}
+
+void TextIndex::changed(uint32_t slot)
+{
+    if (slot >= is_queued_.size())
+        is_queued_.resize(static_cast<size_t>(slot) + 1, false);
+    if (is_queued_[slot])
+        return;
+    is_queued_[slot] = true;
+    queue_.push_back(slot);
+}
+
+bool TextIndex::nextQueued(uint32_t& slot)
+{
+    if (queue_head_ == queue_.size())
+    {
+        queue_.clear();
+        queue_head_ = 0;
+        return false;
+    }
+    slot = queue_[queue_head_++];
+    is_queued_[slot] = false;
+    return true;
+}
+
+bool TextIndex::isQueued(uint32_t slot) const
+{
+    return slot < is_queued_.size() && is_queued_[slot];
+}
+
+size_t TextIndex::queued() const
+{
+    return queue_.size() - queue_head_;
+}
+
+uint32_t TextIndex::termId(const string& term)
+{
+    auto it = ids_.find(term);
+    if (it != ids_.end())
+        return it->second;
+
+    uint32_t id;
+    if (!free_lists_.empty())
+    {
+        id = free_lists_.back();
+        free_lists_.pop_back();
+    }
+    else
+    {
+        id = static_cast<uint32_t>(lists_.size());
+        lists_.emplace_back();
+    }
+    lists_[id].term = term;
+    lists_[id].bytes.clear();
+    lists_[id].files = 0;
+    ids_[term] = id;
+    return id;
+}
+
+void TextIndex::decode(const Postings& p, vector<Group>& out)
+{
+    size_t pos = 0;
+    uint32_t slot = 0;
+    out.resize(p.files);
+    for (Group& g : out)
+    {
+        slot += static_cast<uint32_t>(get_varint(p.bytes, pos));
+        g.slot = slot;
+        g.offsets.resize(get_varint(p.bytes, pos));
+        uint64_t offset = 0;
+        for (uint64_t& o : g.offsets)
+        {
+            offset += get_varint(p.bytes, pos);
+            o = offset;
+        }
+    }
+}
+
+void TextIndex::encode(const vector<Group>& groups, Postings& p)
+{
+    p.bytes.clear();
+    p.files = static_cast<uint32_t>(groups.size());
+    uint32_t slot = 0;
+    for (const Group& g : groups)
+    {
+        put_varint(p.bytes, g.slot - slot);
+        slot = g.slot;
+        put_varint(p.bytes, g.offsets.size());
+        uint64_t offset = 0;
+        for (uint64_t o : g.offsets)
+        {
+            put_varint(p.bytes, o - offset);
+            offset = o;
+        }
+    }
+    p.bytes.shrink_to_fit();
+}
+
+// Drops the groups of the batch's slots from list id and adds `added`, which
+// is sorted by slot. An emptied list is freed.
+void TextIndex::rewrite(uint32_t id, const vector<uint32_t>& batch, vector<Group>& added)
+{
+    Postings& p = lists_[id];
+    vector<Group> old;
+    decode(p, old);
+
+    vector<Group> merged;
+    merged.reserve(old.size() + added.size());
+    size_t a = 0;
+    for (Group& g : old)
+    {
+        if (binary_search(batch.begin(), batch.end(), g.slot))
+            continue;
+        while (a < added.size() && added[a].slot < g.slot)
+            merged.push_back(move(added[a++]));
+        merged.push_back(move(g));
+    }
+    while (a < added.size())
+        merged.push_back(move(added[a++]));
+
+    if (merged.empty())
+    {
+        ids_.erase(p.term);
+        p.term.clear();
+        p.bytes.clear();
+        p.bytes.shrink_to_fit();
+        p.files = 0;
+        free_lists_.push_back(id);
+        return;
+    }
+    encode(merged, p);
+}
+
+void TextIndex::merge(const vector<uint32_t>& slots, vector<Terms>& terms)
+{
+    vector<uint32_t> batch(slots);
+    sort(batch.begin(), batch.end());
+
+    // Every list that loses or gains a group, with the groups it gains.
+    unordered_map<uint32_t, vector<Group>> touched;
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        auto it = slot_terms_.find(slots[i]);
+        if (it != slot_terms_.end())
+        {
+            for (uint32_t id : it->second)
+                touched[id];
+            slot_terms_.erase(it);
+        }
+
+        Terms& found = terms[i];
+        if (found.empty())
+            continue;
+
+        vector<uint32_t>& ids = slot_terms_[slots[i]];
+        ids.reserve(found.size());
+        for (auto& t : found)
+        {
+            uint32_t id = termId(t.first);
+            ids.push_back(id);
+            touched[id].push_back(Group{slots[i], move(t.second)});
+        }
+    }
+
+    for (auto& t : touched)
+    {
+        sort(t.second.begin(), t.second.end(), [](const Group& x, const Group& y) { return x.slot < y.slot; });
+        rewrite(t.first, batch, t.second);
+    }
+}
+
+bool TextIndex::search(const string& query, vector<pair<uint32_t, uint64_t>>& hits) const
+{
+    hits.clear();
+    vector<string> words;
+    tokenize(query.data(), query.size(), [&](const string& term, uint64_t) { words.push_back(term); });
+    if (words.empty())
+        return false;
+
+    vector<const Postings*> lists;
+    for (const string& w : words)
+    {
+        auto it = ids_.find(w);
+        if (it == ids_.end())
+            return true;
+        lists.push_back(&lists_[it->second]);
+    }
+    // Start from the shortest list so the candidates only shrink.
+    sort(lists.begin(), lists.end(), [](const Postings* x, const Postings* y) { return x->files < y->files; });
+
+    vector<Group> groups;
+    decode(*lists[0], groups);
+    for (const Group& g : groups)
+        hits.push_back({g.slot, g.offsets.front()});
+
+    for (size_t i = 1; i < lists.size() && !hits.empty(); ++i)
+    {
+        decode(*lists[i], groups);
+        size_t keep = 0;
+        size_t j = 0;
+        for (const auto& h : hits)
+        {
+            while (j < groups.size() && groups[j].slot < h.first)
+                j++;
+            if (j < groups.size() && groups[j].slot == h.first)
+                hits[keep++] = h;
+        }
+        hits.resize(keep);
+    }
+    return true;
+}
+
+size_t TextIndex::terms() const
+{
+    return ids_.size();
+}
+
+size_t TextIndex::memoryUsage() const
+{
+    size_t bytes = lists_.capacity() * sizeof(Postings) + queue_.capacity() * sizeof(uint32_t)
+                 + is_queued_.capacity() / 8;
+    for (const Postings& p : lists_)
+        bytes += p.bytes.capacity() + p.term.capacity();
+    for (const auto& s : slot_terms_)
+        bytes += sizeof(s) + s.second.capacity() * sizeof(uint32_t);
+    bytes += ids_.size() * (sizeof(string) + sizeof(uint32_t) + TEXT_MAX_TERM);
+    return bytes;
+}
+
+void text_changed(FileSystemInstance* fs, uint32_t slot)
+{
+    if (fs->config.index_step_bytes == 0 || fs->inodes[slot].getType() != EntryType::FILE)
+        return;
+    fs->text.changed(slot);
+}
+
+void text_reindex_all(FileSystemInstance* fs)
+{
+    fs->text.clear();
+    if (fs->config.index_step_bytes == 0)
+        return;
+    for (uint32_t s = 0; s < fs->inodes.slots(); ++s)
+        if (fs->inodes.used(s))
+            text_changed(fs, s);
+}
+
+// Collects the terms of fs->inodes[slot], reading its content in chunks. A
+// run of term characters at the end of a chunk is carried into the next
+// one; at most TEXT_MAX_TERM + 1 bytes of it, as a longer run is not
+// indexed anyway. A file that cannot be read gets no terms.
+static void read_terms(FileSystemInstance* fs, uint32_t slot, TextIndex::Terms& found)
+{
+    uint64_t size = fs->inodes[slot].size;
+    string buf;
+    uint64_t base = 0;      // File offset of buf[0]
+    uint64_t next = 0;      // Next file offset to read
+    while (next < size)
+    {
+        uint64_t n = min(TEXT_READ_CHUNK, size - next);
+        size_t have = buf.size();
+        buf.resize(have + n);
+        if (content_read(fs, slot, next, n, &buf[have]) != static_cast<int>(OFSErrorCodes::SUCCESS))
+        {
+            found.clear();
+            return;
+        }
+        next += n;
+
+        size_t cut = buf.size();
+        if (next < size)
+            while (cut > 0 && TextIndex::isTermChar(buf[cut - 1]))
+                cut--;
+        TextIndex::tokenize(buf.data(), cut, [&](const string& term, uint64_t offset) { found[term].push_back(base + offset); });
+
+        size_t drop = max<size_t>(cut, buf.size() > TEXT_MAX_TERM + 1 ? buf.size() - (TEXT_MAX_TERM + 1) : 0);
+        buf.erase(0, drop);
+        base += drop;
+    }
+}
+
+size_t text_merge(FileSystemInstance* fs, uint64_t max_bytes)
+{
+    vector<uint32_t> slots;
+    vector<TextIndex::Terms> terms;
+    uint64_t bytes = 0;
+    uint32_t slot;
+    while (bytes < max_bytes && fs->text.nextQueued(slot))
+    {
+        // The slot may have been freed or reused since it was queued; what
+        // it holds now is what gets indexed.
+        slots.push_back(slot);
+        terms.emplace_back();
+        if (fs->inodes.used(slot) && fs->inodes[slot].getType() == EntryType::FILE)
+        {
+            read_terms(fs, slot, terms.back());
+            bytes += fs->inodes[slot].size;
+        }
+        bytes++;
+    }
+    if (!slots.empty())
+        fs->text.merge(slots, terms);
+    return slots.size();
+}
+
+int fs_index_step()
+{
+    FileSystemInstance* fs = g_fs;
+    if (!fs || fs->replaying || fs->config.index_step_bytes == 0 || fs->text.queued() == 0)
+        return 0;
+
+    uint64_t now = static_cast<uint64_t>(chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count());
+    if (now - fs->last_index_ms < fs->config.index_interval_ms)
+        return 0;
+    fs->last_index_ms = now;
+
+    return static_cast<int>(text_merge(fs, fs->config.index_step_bytes));
+}
@@ -0,0 +1,179 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include "../source/include/fs_core.hpp"
+#include "../source/include/fs_user.hpp"
+#include "../source/include/fs_file.hpp"
+#include "../source/include/fs_dir.hpp"
+#include "../source/include/fs_info.hpp"
+#include "../source/include/compress.hpp"
+#include "../source/include/odf_types.hpp"
+
+using namespace std;
+
+// Compares the LZ codec on text and binary payloads: ratio and throughput of
+// the codec alone, then FILE_CREATE/FILE_READ of the same payload through a
+// compressed and a plain directory. Usage: bench_compress [MB]  (default 32)
+
+static double ms_since(chrono::steady_clock::time_point t0)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+}
+
+static double mb_per_s(size_t bytes, double ms)
+{
+    return ms > 0 ? (bytes / (1024.0 * 1024.0)) / (ms / 1000.0) : 0.0;
+}
+
+static string make_text(size_t n)
+{
+    static const char* words[] = {
+        "the", "file", "system", "block", "of", "and", "server", "user", "data", "to",
+        "omni", "directory", "write", "read", "version", "is", "a", "log", "in", "checkpoint"
+    };
+    string s;
+    s.reserve(n + 16);
+    uint32_t x = 12345;
+    unsigned int col = 0;
+    while (s.size() < n)
+    {
+        x = x * 1103515245u + 12345u;
+        const char* w = words[(x >> 16) % 20];
+        s += w;
+        col += 1 + static_cast<unsigned int>(strlen(w));
+        s += col > 72 ? '\n' : ' ';
+        if (col > 72) col = 0;
+    }
+    s.resize(n);
+    return s;
+}
+
+static string make_binary(size_t n)
+{
+    string s(n, '\0');
+    uint64_t x = 88172645463325252ULL;
+    for (size_t i = 0; i < n; ++i)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        s[i] = static_cast<char>(x);
+    }
+    return s;
+}
+
+static void bench_codec(const char* name, const string& payload, size_t unit)
+{
+    vector<char> packed(unit + unit / 255 + 16);
+    vector<char> back(unit);
+    size_t stored = 0;
+    vector<size_t> lens;
+
+    auto t0 = chrono::steady_clock::now();
+    for (size_t off = 0; off < payload.size(); off += unit)
+    {
+        size_t n = min(unit, payload.size() - off);
+        size_t c = lz_compress(payload.data() + off, n, packed.data(), packed.size());
+        lens.push_back(c);
+        stored += c;
+    }
+    double comp_ms = ms_since(t0);
+
+    // Decode the last unit repeatedly so only the codec is measured.
+    size_t n = min(unit, payload.size());
+    size_t c = lz_compress(payload.data(), n, packed.data(), packed.size());
+    size_t rounds = payload.size() / n;
+    bool ok = true;
+    t0 = chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r)
+        ok = lz_decompress(packed.data(), c, back.data(), n) && ok;
+    double decomp_ms = ms_since(t0);
+    ok = ok && memcmp(back.data(), payload.data(), n) == 0;
+
+    printf(" %-7s ratio = %5.2f | compress = %8.1f MB/s | decompress = %8.1f MB/s%s\n",
+           name, static_cast<double>(payload.size()) / stored, mb_per_s(payload.size(), comp_ms),
+           mb_per_s(rounds * n, decomp_ms), ok ? "" : "  (ROUND TRIP FAILED)");
+}
+
+static void bench_files(void* session, const char* dir, const char* name, const string& payload, size_t file_size)
+{
+    FSStats before, after;
+    get_stats(session, &before);
+
+    size_t files = payload.size() / file_size;
+    auto t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < files; ++i)
+    {
+        string path = string(dir) + "/" + name + to_string(i);
+        file_create(session, path.c_str(), payload.data() + i * file_size, file_size);
+    }
+    double write_ms = ms_since(t0);
+
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < files; ++i)
+    {
+        string path = string(dir) + "/" + name + to_string(i);
+        char* buf = nullptr;
+        size_t size = 0;
+        if (file_read(session, path.c_str(), &buf, &size) == 0)
+            free_buffer(buf);
+    }
+    double read_ms = ms_since(t0);
+
+    get_stats(session, &after);
+    uint64_t stored = after.physical_bytes - before.physical_bytes;
+    printf(" %-7s %-6s stored = %9lu bytes | create = %8.1f MB/s | read = %8.1f MB/s\n",
+           name, dir + 1, static_cast<unsigned long>(stored),
+           mb_per_s(files * file_size, write_ms), mb_per_s(files * file_size, read_ms));
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb = argc > 1 ? strtoul(argv[1], nullptr, 10) : 32;
+    size_t bytes = mb * 1024 * 1024;
+    string text = make_text(bytes);
+    string binary = make_binary(bytes);
+
+    const char* omni = "bench_compress.omni";
+    const char* cfg = "bench_compress.uconf";
+    {
+        ofstream c(cfg);
+        c << "total_size = " << (bytes * 6 + 64ULL * 1024 * 1024) << "\n";
+        c << "commit_window_us = 0\n";
+        c << "change_log_size = 0\n";
+        c << "vault_size = 0\n";
+    }
+
+    void* fs = nullptr;
+    fs_format(omni, cfg);
+    if (fs_init(&fs, omni, cfg) != 0) { cout << "fs_init failed" << endl; return 1; }
+    size_t unit = static_cast<size_t>(COMPRESS_UNIT_BLOCKS) * g_fs->store.blockSize();
+
+    cout << "===== OMNI COMPRESSION BENCHMARK =====" << endl;
+    cout << "\n[codec, " << mb << " MB in " << unit / 1024 << " KB units]" << endl;
+    bench_codec("text", text, unit);
+    bench_codec("binary", binary, unit);
+
+    void* session = nullptr;
+    user_login(&session, "admin", "admin123");
+    if (!session) user_login(&session, "root", "root");
+    dir_create(session, "/lz");
+    dir_create(session, "/plain");
+    set_compression(session, "/lz", COMPRESS_LZ);
+
+    size_t file_size = 256 * 1024;
+    cout << "\n[files of " << file_size / 1024 << " KB]" << endl;
+    bench_files(session, "/lz", "text", text, file_size);
+    bench_files(session, "/plain", "text", text, file_size);
+    bench_files(session, "/lz", "binary", binary, file_size);
+    bench_files(session, "/plain", "binary", binary, file_size);
+
+    fs_shutdown(fs);
+    remove(omni);
+    remove(cfg);
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include "../source/include/fs_core.hpp"
+#include "../source/include/fs_user.hpp"
+#include "../source/include/fs_file.hpp"
+#include "../source/include/fs_dir.hpp"
+#include "../source/include/fs_info.hpp"
+#include "../source/include/odf_types.hpp"
+
+using namespace std;
+
+// Path lookup latency as the namespace grows from 1k to 1M entries:
+// dir_exists on existing paths, file_exists on missing ones (with the share
+// of them the Bloom filter let through to the index) and
+// get_metadata, all through the hash index, and dir_list of a ten-entry
+// directory. Also a full scan of the inode table per entry, the memory the
+// table holds per entry, next to the sizeof(FileMetadata) every entry used
+// to take, dir_rename of /projects, which holds every entry, and dir_find
+// of one team's subtree per path returned. Usage: bench_lookup [max entries]  (default 1000000)
+
+static double ns_since(chrono::steady_clock::time_point t0)
+{
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count();
+}
+
+static string entry_path(size_t i)
+{
+    return "/projects/team" + to_string(i % 97) + "/entry_" + to_string(i);
+}
+
+int main(int argc, char** argv)
+{
+    size_t max_entries = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+
+    const char* omni = "bench_lookup.omni";
+    const char* cfg = "bench_lookup.uconf";
+    {
+        ofstream c(cfg);
+        c << "total_size = 67108864\n";
+        c << "change_log_size = 0\n";
+        c << "vault_size = 0\n";
+    }
+
+    void* fs = nullptr;
+    void* session = nullptr;
+    fs_format(omni, cfg);
+    if (fs_init(&fs, omni, cfg) != 0) { cout << "fs_init failed" << endl; return 1; }
+    user_login(&session, "root", "root");
+
+    cout << "===== OMNI PATH LOOKUP BENCHMARK =====" << endl;
+    printf("\n FileMetadata: %zu bytes per entry\n", sizeof(FileMetadata));
+    printf("\n %9s | %12s | %12s | %12s | %12s | %12s | %12s | %12s | %12s | %12s\n", "entries", "hit ns", "miss ns", "metadata ns", "ls ns",
+           "scan ns/ent", "bytes/ent", "mvdir ns", "find ns/hit", "bloom fp %");
+
+    const size_t probes = 200000;
+    size_t created = 0;
+    uint32_t x = 2463534242u;
+    dir_create(session, "/small");
+    for (int i = 0; i < 10; ++i)
+        dir_create(session, ("/small/d" + to_string(i)).c_str());
+    dir_create(session, "/projects");
+    for (int t = 0; t < 97; ++t)
+        dir_create(session, ("/projects/team" + to_string(t)).c_str());
+
+    for (size_t n = 1000; n <= max_entries; n *= 10)
+    {
+        for (; created < n; ++created)
+            dir_create(session, entry_path(created).c_str());
+
+        vector<string> hits, misses;
+        for (size_t i = 0; i < 1024; ++i)
+        {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+            hits.push_back(entry_path(x % n));
+            misses.push_back(entry_path(n + x % n) + "_missing");
+        }
+
+        int found = 0;
+        auto t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < probes; ++i)
+            found += dir_exists(session, hits[i & 1023].c_str()) == 0;
+        double hit_ns = ns_since(t0) / probes;
+
+        LookupStats st;
+        get_lookup_stats(session, &st);
+        uint64_t fp_before = st.bloom_false_positives;
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < probes; ++i)
+            found += file_exists(session, misses[i & 1023].c_str()) == 0;
+        double miss_ns = ns_since(t0) / probes;
+        get_lookup_stats(session, &st);
+        double fp_pct = 100.0 * (st.bloom_false_positives - fp_before) / probes;
+
+        FileMetadata meta;
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < probes; ++i)
+            found += get_metadata(session, hits[i & 1023].c_str(), &meta) == 0;
+        double meta_ns = ns_since(t0) / probes;
+
+        size_t lists = 20000;
+        int listed = 0;
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < lists; ++i)
+        {
+            FileEntry* entries = nullptr;
+            int count = 0;
+            dir_list(session, "/small", &entries, &count);
+            listed += count;
+            delete[] entries;
+        }
+        double ls_ns = ns_since(t0) / lists;
+
+        // A metadata scan, such as looking for recently changed entries.
+        const InodeTable& inodes = g_fs->inodes;
+        size_t scans = 16, recent = 0;
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < scans; ++i)
+            for (uint32_t s = 0; s < inodes.slots(); ++s)
+                recent += inodes.used(s) && inodes[s].mtime + i >= meta.entry.modified_time;
+        double scan_ns = ns_since(t0) / scans / inodes.size();
+        double bytes = static_cast<double>(inodes.memoryUsage()) / inodes.size();
+
+        size_t moves = 2000;
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < moves; ++i)
+        {
+            found += dir_rename(session, "/projects", "/projects_moved") == 0;
+            found -= dir_rename(session, "/projects_moved", "/projects") != 0;
+        }
+        double mv_ns = ns_since(t0) / (2 * moves);
+
+        size_t finds = 20, hits_found = 0;
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < finds; ++i)
+        {
+            char* paths = nullptr;
+            size_t size = 0;
+            int cnt = 0;
+            dir_find(session, "/projects/team7/**", 1 << 30, &paths, &size, &cnt);
+            hits_found += cnt;
+            free_buffer(paths);
+        }
+        double find_ns = ns_since(t0) / (hits_found ? hits_found : 1);
+
+        printf(" %9zu | %12.1f | %12.1f | %12.1f | %12.1f | %12.2f | %12.1f | %12.1f | %12.1f | %12.2f%s\n", n, hit_ns, miss_ns, meta_ns,
+               ls_ns, scan_ns, bytes, mv_ns, find_ns, fp_pct, found == static_cast<int>(2 * probes + moves) && listed == static_cast<int>(10 * lists) && recent > 0 ? "" : "  (WRONG RESULTS)");
+    }
+
+    fs_shutdown(fs);
+    remove(omni);
+    remove(cfg);
+    return 0;
+}
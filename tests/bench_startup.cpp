@@ -0,0 +1,81 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include "../source/include/fs_core.hpp"
+#include "../source/include/fs_file.hpp"
+#include "../source/include/checkpoint.hpp"
+#include "../source/include/odf_types.hpp"
+
+using namespace std;
+
+// Measures fs_init on containers holding N metadata entries, restored from
+// a checkpoint. Usage: bench_startup [N ...]  (default 10000 100000 1000000)
+
+static double ms_since(chrono::steady_clock::time_point t0)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+}
+
+static void populate(unsigned int n)
+{
+    add_entry(g_fs, "/bench", EntryType::DIRECTORY, "bench", 0755);
+    for (unsigned int i = 0; i < n; ++i)
+    {
+        bool dir = (i % 100) == 0;
+        string path = "/bench/d" + to_string(i / 100) + (dir ? "" : "/f" + to_string(i) + ".txt");
+        uint32_t slot = add_entry(g_fs, path.c_str(), dir ? EntryType::DIRECTORY : EntryType::FILE, "bench", dir ? 0755 : 0644);
+        if (!dir)
+            g_fs->inodes[slot].size = 128;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    vector<unsigned int> sizes;
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(static_cast<unsigned int>(strtoul(argv[i], nullptr, 10)));
+    if (sizes.empty())
+        sizes = {10000, 100000, 1000000};
+
+    cout << "===== OMNI STARTUP BENCHMARK =====" << endl;
+    for (unsigned int n : sizes)
+    {
+        const char* omni = "bench_startup.omni";
+        const char* cfg = "bench_startup.uconf";
+        {
+            ofstream c(cfg);
+            c << "total_size = " << (64ULL * 1024 * 1024 + n * 256ULL) << "\n";
+            c << "change_log_size = 1048576\n";
+            c << "commit_window_us = 0\n";
+        }
+
+        void* fs = nullptr;
+        fs_format(omni, cfg);
+        if (fs_init(&fs, omni, cfg) != 0) { cout << "fs_init failed" << endl; return 1; }
+        populate(n);
+
+        auto t0 = chrono::steady_clock::now();
+        int ck = fs_checkpoint();
+        double write_ms = ms_since(t0);
+        fs_shutdown(fs);
+
+        t0 = chrono::steady_clock::now();
+        int rc = fs_init(&fs, omni, cfg);
+        double init_ms = ms_since(t0);
+        size_t loaded = g_fs ? g_fs->inodes.size() : 0;
+        OMNILayout layout = read_layout(g_fs->header);
+        fs_shutdown(fs);
+
+        cout << "\n[" << n << " entries]" << endl;
+        cout << " checkpoint returned: " << ck << " | bytes = " << layout.checkpoint_bytes << " | write = " << write_ms << " ms" << endl;
+        cout << " fs_init returned: " << rc << " | loaded = " << loaded << " | time = " << init_ms << " ms" << endl;
+
+        remove(omni);
+        remove(cfg);
+    }
+    return 0;
+}
@@ -1,15 +1,84 @@
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <vector>
+#include <cstdio>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "../source/include/fs_core.hpp"
 #include "../source/include/fs_user.hpp"
 #include "../source/include/fs_file.hpp"
 #include "../source/include/fs_dir.hpp"
 #include "../source/include/fs_info.hpp"
+#include "../source/include/compress.hpp"
+#include "../source/include/checkpoint.hpp"
 #include "../source/include/odf_types.hpp"
 
 using namespace std;
 
+// Shares the blocks of /d/f with a copy, writes to /d/f, lets go of the
+// copy and lets other files take freed blocks, then exits without shutting
+// down. The copy is made by tree_copy after a checkpoint and deleted, or
+// with dedup on, is an identical file created before the checkpoint and
+// truncated. Returns the start of /d/f after log replay.
+static string shared_blocks_after_crash(bool dedup)
+{
+    {
+        ofstream cfg("crash_test.cfg");
+        cfg << "total_size = 2097152\nchange_log_size = 262144\nvault_size = 262144\ncommit_window_us = 0\n"
+            << "dedup = " << (dedup ? 1 : 0) << "\n";
+    }
+    remove("crash_test.omni");
+    fs_format("crash_test.omni", "crash_test.cfg");
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        void* fs = nullptr;
+        void* s = nullptr;
+        fs_init(&fs, "crash_test.omni", "crash_test.cfg");
+        user_login(&s, "root", "root");
+        string a = string(4096, 'A') + string(4096, 'B');
+        dir_create(s, "/d");
+        file_create(s, "/d/f", a.data(), a.size());
+        if (dedup) {
+            file_create(s, "/d/g", a.data(), a.size());
+        }
+        fs_checkpoint();
+        if (dedup) {
+            file_edit(s, "/d/f", "X", 1, 0);
+            file_truncate(s, "/d/g");
+        } else {
+            tree_copy(s, "/d", "/e");
+            file_edit(s, "/d/f", "X", 1, 0);
+            dir_delete_recursive(s, "/e");
+        }
+        string g(4096, 'G');
+        for (int i = 0; i < 8; ++i) {
+            g.back() = static_cast<char>('0' + i);
+            file_create(s, ("/g" + to_string(i)).c_str(), g.data(), g.size());
+        }
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    void* fs = nullptr;
+    void* s = nullptr;
+    char* buf = nullptr;
+    size_t size = 0;
+    string head;
+    if (fs_init(&fs, "crash_test.omni", "crash_test.cfg") == 0) {
+        user_login(&s, "root", "root");
+        if (file_read(s, "/d/f", &buf, &size) == 0) {
+            head.assign(buf, size < 4 ? size : 4);
+            delete[] buf;
+        }
+        user_logout(s);
+        fs_shutdown(fs);
+    }
+    return head;
+}
+
 int main() 
 {
     cout << "===== OMNI FILE SYSTEM TEST =====" << endl;
@@ -71,6 +140,98 @@ int main()
     cout << "file_create readme.txt: " << f1 << endl;
     cout << "file_create summary.txt: " << f2 << endl;
 
+    cout << "\n[9a] Read Back and Edit readme.txt..." << endl;
+    char* buf = nullptr;
+    size_t buf_size = 0;
+    int rd1 = file_read(alice_session, "/docs/readme.txt", &buf, &buf_size);
+    cout << "file_read returned: " << rd1 << " | Content = " << (buf ? buf : "(null)") << endl;
+    free_buffer(buf);
+    int ed1 = file_edit(alice_session, "/docs/readme.txt", " v2", 3, 13);
+    int rd2 = file_read(alice_session, "/docs/readme.txt", &buf, &buf_size);
+    cout << "file_edit returned: " << ed1 << " | file_read returned: " << rd2 << " | Content = " << (buf ? buf : "(null)") << endl;
+    free_buffer(buf);
+
+    cout << "\n[9b] Version History of readme.txt..." << endl;
+    FileVersion* versions = nullptr;
+    int version_count = 0;
+    int vl = file_versions(alice_session, "/docs/readme.txt", &versions, &version_count);
+    cout << "file_versions returned: " << vl << " | Count = " << version_count << endl;
+    for (int i = 0; i < version_count; ++i) {
+        cout << " - v" << versions[i].version << " size=" << versions[i].size << " by " << versions[i].author << endl;
+    }
+    delete[] versions;
+    int rv = file_read_version(alice_session, "/docs/readme.txt", 1, &buf, &buf_size);
+    cout << "file_read_version(1) returned: " << rv << " | Content = " << (buf ? buf : "(null)") << endl;
+    free_buffer(buf);
+
+    cout << "\n[9c] Compressed Directory /archive..." << endl;
+    dir_create(admin_session, "/archive");
+    int sc = set_compression(admin_session, "/archive", COMPRESS_LZ);
+    string log_text;
+    for (int i = 0; i < 2000; ++i) log_text += "request " + to_string(i % 50) + " served by OFS\n";
+    int cc = file_create(admin_session, "/archive/log.txt", log_text.c_str(), log_text.size());
+    int cr = file_read(admin_session, "/archive/log.txt", &buf, &buf_size);
+    FileMetadata archived;
+    get_metadata(admin_session, "/archive/log.txt", &archived);
+    cout << "set_compression returned: " << sc << " | file_create returned: " << cc << " | file_read returned: " << cr
+         << " | Intact = " << (buf && string(buf, buf_size) == log_text ? "yes" : "no")
+         << " | Size = " << archived.entry.size << " | Blocks = " << archived.blocks_used << endl;
+    free_buffer(buf);
+    file_delete(admin_session, "/archive/log.txt");
+    dir_delete(admin_session, "/archive");
+    int rs = set_compression(admin_session, "/", COMPRESS_LZ);
+    file_create(admin_session, "/top.txt", log_text.c_str(), log_text.size());
+    get_metadata(admin_session, "/top.txt", &archived);
+    cout << "set_compression(/) returned: " << rs << " | New file at / compressed = "
+         << (archived.compression == COMPRESS_LZ ? "yes" : "no") << endl;
+    file_delete(admin_session, "/top.txt");
+    set_compression(admin_session, "/", COMPRESS_NONE);
+
+    cout << "\n[9d] Handle I/O on /docs/notes.txt..." << endl;
+    file_create(alice_session, "/docs/notes.txt", "0123456789", 10);
+    uint64_t handle = 0;
+    int op = file_open(alice_session, "/docs/notes.txt", OPEN_READ | OPEN_WRITE, &handle);
+    int pw = file_pwrite(alice_session, handle, "abc", 3, 4);
+    char pbuf[16] = {0};
+    size_t pn = 0;
+    int pr = file_pread(alice_session, handle, pbuf, 8, 2, &pn);
+    cout << "file_open returned: " << op << " | file_pwrite returned: " << pw << " | file_pread returned: " << pr
+         << " | Content = " << string(pbuf, pn) << endl;
+    FileMetadata notes;
+    get_metadata(alice_session, "/docs/notes.txt", &notes);
+    file_delete(alice_session, "/docs/notes.txt");
+    file_create(alice_session, "/docs/notes.txt", "new", 3);
+    FileMetadata renewed;
+    get_metadata(alice_session, "/docs/notes.txt", &renewed);
+    int stale = file_pread(alice_session, handle, pbuf, 8, 0, &pn);
+    cout << "Same inode = " << (notes.entry.inode == renewed.entry.inode ? "yes" : "no")
+         << " | New generation = " << (notes.entry.generation != renewed.entry.generation ? "yes" : "no")
+         << " | Stale file_pread returned: " << stale << " | file_close returned: " << file_close(alice_session, handle) << endl;
+    file_delete(alice_session, "/docs/notes.txt");
+
+    cout << "\n[9e] Move Directory /docs/reports..." << endl;
+    int mv1 = dir_rename(alice_session, "/docs/reports", "/reports");
+    int moved_file = file_exists(alice_session, "/reports/summary.txt");
+    int into_self = dir_rename(alice_session, "/reports", "/reports/inner");
+    int mv2 = dir_rename(alice_session, "/reports", "/docs/reports");
+    cout << "dir_rename returned: " << mv1 << " | /reports/summary.txt exists: " << moved_file
+         << " | Move into itself returned: " << into_self << " | Move back returned: " << mv2 << endl;
+
+    cout << "\n[9f] Copy and Recursively Delete /docs..." << endl;
+    int cp = tree_copy(alice_session, "/docs", "/docs_copy");
+    int cp_self = tree_copy(alice_session, "/docs", "/docs/reports/loop");
+    int ed2 = file_edit(alice_session, "/docs_copy/readme.txt", "!", 1, 0);
+    char* orig = nullptr;
+    size_t orig_size = 0;
+    file_read(alice_session, "/docs/readme.txt", &orig, &orig_size);
+    int rd3 = file_read(alice_session, "/docs_copy/readme.txt", &buf, &buf_size);
+    cout << "tree_copy returned: " << cp << " | Copy into itself returned: " << cp_self << " | file_edit of copy returned: " << ed2 << endl;
+    cout << "file_read of copy returned: " << rd3 << " | Copy = " << (buf ? buf : "(null)") << " | Original = " << (orig ? orig : "(null)") << endl;
+    free_buffer(buf);
+    free_buffer(orig);
+    int rmr = dir_delete_recursive(alice_session, "/docs_copy");
+    int gone = dir_exists(alice_session, "/docs_copy/reports");
+    cout << "dir_delete_recursive returned: " << rmr << " | /docs_copy/reports exists: " << gone << endl;
 
 
     cout << "\n[10] List /docs Directory..." << endl;
@@ -85,6 +246,122 @@ int main()
         free(entries);
     }
 
+    cout << "\n[10a] List /docs One Entry per Page..." << endl;
+    uint64_t cursor = 0;
+    int pages = 0;
+    do {
+        int page_count = 0;
+        int lp = dir_list_plus(alice_session, "/docs", cursor, 1, &entries, &page_count, &cursor);
+        cout << "dir_list_plus returned: " << lp << " | Count = " << page_count;
+        for (int i = 0; i < page_count; ++i) {
+            cout << " | " << entries[i].name << " size=" << entries[i].size << " owner=" << entries[i].owner;
+        }
+        cout << endl;
+        delete[] entries;
+        pages++;
+    } while (cursor != 0 && pages < 10);
+
+    cout << "\n[10b] Find Paths by Pattern..." << endl;
+    const char* patterns[] = {"/docs/**", "/docs/*.txt", "/**/summary.*", "/d?cs/re[a-z]orts"};
+    for (const char* pattern : patterns) {
+        char* found = nullptr;
+        size_t found_size = 0;
+        int found_count = 0;
+        int fd = dir_find(alice_session, pattern, 100, &found, &found_size, &found_count);
+        cout << "dir_find " << pattern << " returned: " << fd << " | Count = " << found_count << endl;
+        cout << string(found ? found : "", found_size);
+        free_buffer(found);
+    }
+
+    cout << "\n[10c] Find by Owner and Recent Changes..." << endl;
+    uint64_t owner_cursor = 0;
+    do {
+        char* owned = nullptr;
+        size_t owned_size = 0;
+        int owned_count = 0;
+        int fo = find_by_owner(admin_session, "alice", owner_cursor, 1, &owned, &owned_size, &owned_count, &owner_cursor);
+        cout << "find_by_owner alice returned: " << fo << " | Count = " << owned_count << " | " << string(owned ? owned : "", owned_size);
+        free_buffer(owned);
+    } while (owner_cursor != 0);
+    char* changed = nullptr;
+    size_t changed_size = 0;
+    int changed_count = 0;
+    uint64_t changed_next = 0;
+    int cs = changed_since(admin_session, 0, 0, 100, &changed, &changed_size, &changed_count, &changed_next);
+    cout << "changed_since(0) returned: " << cs << " | Count = " << changed_count << " | Newest = "
+         << string(changed ? changed : "", changed_size).substr(0, string(changed ? changed : "").find('\n')) << endl;
+    free_buffer(changed);
+    cs = changed_since(admin_session, UINT64_MAX, 0, 100, &changed, &changed_size, &changed_count, &changed_next);
+    cout << "changed_since(future) returned: " << cs << " | Count = " << changed_count << endl;
+    free_buffer(changed);
+
+    cout << "\n[10d] Full-Text Search..." << endl;
+    string minutes = "Meeting notes:\ndeploy the Server on Friday.\nRollback plan is ready.";
+    file_create(alice_session, "/docs/minutes.txt", minutes.c_str(), minutes.size());
+    const char* queries[] = {"server friday", "ROLLBACK", "server monday", "x"};
+    for (const char* q : queries) {
+        char* hits = nullptr;
+        size_t hits_size = 0;
+        int hits_count = 0;
+        int sr = file_search(alice_session, q, 10, &hits, &hits_size, &hits_count);
+        cout << "file_search \"" << q << "\" returned: " << sr << " | Count = " << hits_count << endl;
+        cout << string(hits ? hits : "", hits_size);
+        free_buffer(hits);
+    }
+    file_edit(alice_session, "/docs/minutes.txt", "Monday", 6, minutes.find("Friday"));
+    char* hits = nullptr;
+    size_t hits_size = 0;
+    int hits_count = 0;
+    file_search(alice_session, "friday", 10, &hits, &hits_size, &hits_count);
+    cout << "after edit, friday Count = " << hits_count;
+    free_buffer(hits);
+    file_search(alice_session, "monday", 10, &hits, &hits_size, &hits_count);
+    cout << " | monday Count = " << hits_count << endl;
+    free_buffer(hits);
+    file_delete(alice_session, "/docs/minutes.txt");
+    file_search(alice_session, "monday", 10, &hits, &hits_size, &hits_count);
+    cout << "after delete, monday Count = " << hits_count << endl;
+    free_buffer(hits);
+
+    cout << "\n[10e] Directory Usage..." << endl;
+    DirUsage du_before, du_after, du_all;
+    dir_usage(alice_session, "/docs", &du_before);
+    file_create(alice_session, "/docs/usage.txt", "12345", 5);
+    file_edit(alice_session, "/docs/usage.txt", "67890", 5, 5);
+    int du = dir_usage(alice_session, "/docs", &du_after);
+    cout << "dir_usage /docs returned: " << du << " | Bytes +" << (du_after.bytes - du_before.bytes)
+         << " | Files +" << (du_after.files - du_before.files) << " | Blocks +" << (du_after.blocks - du_before.blocks) << endl;
+    file_delete(alice_session, "/docs/usage.txt");
+    dir_usage(alice_session, "/docs", &du_after);
+    dir_usage(alice_session, "/", &du_all);
+    cout << "after delete, /docs unchanged = " << (du_after.bytes == du_before.bytes && du_after.files == du_before.files ? "yes" : "no")
+         << " | / covers /docs = " << (du_all.bytes >= du_after.bytes && du_all.files >= du_after.files ? "yes" : "no") << endl;
+
+    cout << "\n[10f] Per-User Quotas..." << endl;
+    QuotaInfo quota;
+    user_get_quota(alice_session, "alice", &quota);
+    int sq = user_set_quota(alice_session, "alice", quota.used_bytes + 100, 0);
+    cout << "user_set_quota by alice returned: " << sq << endl;
+    sq = user_set_quota(admin_session, "alice", quota.used_bytes + 100, 0);
+    cout << "user_set_quota by admin returned: " << sq << endl;
+    string fits(60, 'q');
+    int q1 = file_create(alice_session, "/docs/quota1.txt", fits.c_str(), fits.size());
+    int q2 = file_create(alice_session, "/docs/quota2.txt", fits.c_str(), fits.size());
+    int q3 = file_edit(alice_session, "/docs/quota1.txt", fits.c_str(), fits.size(), 60);
+    cout << "within quota: " << q1 << " | over quota create: " << q2 << " | over quota edit: " << q3 << endl;
+    file_delete(alice_session, "/docs/quota1.txt");
+    q2 = file_create(alice_session, "/docs/quota2.txt", fits.c_str(), fits.size());
+    user_get_quota(alice_session, "alice", &quota);
+    cout << "after delete: " << q2 << " | Used = " << quota.used_bytes << " / " << quota.max_bytes << endl;
+    file_delete(alice_session, "/docs/quota2.txt");
+    user_get_quota(alice_session, "alice", &quota);
+    user_set_quota(admin_session, "alice", 0, quota.used_inodes + 1);
+    int d1 = dir_create(alice_session, "/docs/quota_dir1");
+    int d2 = dir_create(alice_session, "/docs/quota_dir2");
+    cout << "mkdir within inode quota: " << d1 << " | over inode quota: " << d2 << endl;
+    dir_delete(alice_session, "/docs/quota_dir1");
+    user_set_quota(admin_session, "alice", 0, 0);
+
     cout << "\n[11] Get Metadata for /docs/readme.txt..." << endl;
     FileMetadata meta;
     int meta_code = get_metadata(alice_session, "/docs/readme.txt", &meta);
@@ -110,6 +387,19 @@ int main()
         cout << " Free Space: " << stats.free_space << endl;
     }
 
+    cout << "\n[13a] Bloom Filter on Missing Paths..." << endl;
+    LookupStats before;
+    get_lookup_stats(alice_session, &before);
+    int missing = 0;
+    for (int i = 0; i < 1000; ++i) {
+        missing += file_exists(alice_session, ("/docs/missing_" + to_string(i) + ".txt").c_str()) != 0;
+    }
+    LookupStats after;
+    get_lookup_stats(alice_session, &after);
+    uint64_t negatives = after.bloom_negatives - before.bloom_negatives;
+    uint64_t false_pos = after.bloom_false_positives - before.bloom_false_positives;
+    cout << "Missing: " << missing << " | Answered by filter: " << (negatives + false_pos == 1000 && negatives >= 950 ? "most" : "too few") << endl;
+
     cout << "\n[14] Delete Directory /docs/reports..." << endl;
     int del_dir1 = dir_delete(alice_session, "/docs/reports");
     cout << "dir_delete returned: " << del_dir1 << endl;
@@ -134,6 +424,12 @@ int main()
     fs_shutdown(fs_instance);
     cout << "fs_shutdown complete." << endl;
 
+    cout << "\n[20] Crash Recovery with Shared Blocks..." << endl;
+    string recovered = shared_blocks_after_crash(false);
+    cout << "tree_copy, edit, delete copy, crash: /d/f starts with " << recovered << endl;
+    recovered = shared_blocks_after_crash(true);
+    cout << "dedup, edit, truncate copy, crash: /d/f starts with " << recovered << endl;
+
     cout << "Test complete" << endl;
     return 0;
 }